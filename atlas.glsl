@@ -0,0 +1,15 @@
+#version 400 core
+
+out vec4 FragColor;
+
+uniform sampler2D u_atlas;
+
+flat in ivec2 to_texel;
+
+void main()
+{
+    // the quad is pixel aligned, so every fragment maps to exactly one texel
+    ivec2 texel = ivec2(gl_FragCoord.xy) + to_texel;
+    FragColor.rgb = vec3(0);
+    FragColor.a = texelFetch(u_atlas, texel, 0).r;
+}
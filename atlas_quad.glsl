@@ -0,0 +1,23 @@
+#version 400 core
+
+uniform ivec2 u_dims;
+
+// one struct sprite_instance per quad
+layout(location = 0) in ivec4 a_rect;
+layout(location = 1) in ivec2 a_texel;
+
+// what to add to a fragment's position to get the texel it shows
+flat out ivec2 to_texel;
+
+void main()
+{
+    ivec2 corners[4] = ivec2[4](ivec2(0, 0),
+                                ivec2(1, 0),
+                                ivec2(0, 1),
+                                ivec2(1, 1));
+
+    vec2 pos = vec2(a_rect.xy + corners[gl_VertexID] * a_rect.zw);
+    to_texel = a_texel - a_rect.xy;
+
+    gl_Position = vec4(2.0 * pos / vec2(u_dims) - 1.0, 0, 1);
+}
@@ -3,49 +3,52 @@
 out vec4 FragColor;
 
 uniform vec2 u_pos;
-uniform isamplerBuffer u_points;
-uniform isamplerBuffer endpoints;
-uniform uint num_contours;
-uniform uint num_points;
+uniform usamplerBuffer u_segments;
+uniform uint num_segments;
+uniform ivec2 u_origin;
 uniform float units_per_em;
 uniform float u_size;
 uniform ivec2 u_bbox_min;
 uniform ivec2 u_bbox_max;
 
-dvec3 scale()
+double scale()
 {
-    return dvec3(u_size / units_per_em, u_size / units_per_em, 1);
+    return double(u_size / units_per_em);
 }
 
-dvec3 point(int j)
-{
-    return (dvec3(u_pos, 0) + dvec3(texelFetch(u_points, j).rgb)) * scale();
-}
+const uint LINE = 0u;
+
+// how far past the outline the edge is drawn, SDF_EDGE_BIAS in sdf.h
+const float EDGE_BIAS = 0.4;
 
-bool on_curve(dvec3 point)
+/**
+ * Unpack one of a segment's points, two 16 bit coordinates in half units
+ * from u_origin, see generate_glyph_mesh().
+ */
+dvec2 point(uint xy)
 {
-    return point.z >= 0.5;
+    dvec2 p = dvec2(xy & 0xffffu, xy >> 16) / 2 + dvec2(u_origin);
+    return (dvec2(u_pos) + p) * scale();
 }
 
-int endpoint(int i)
+/**
+ * Squared distance to the box around a segment's control points, which is
+ * never more than the distance to the segment itself.
+ */
+double box_dist(dvec2 pos, dvec2 a, dvec2 b, dvec2 c)
 {
-    return texelFetch(endpoints, i).r;
+    dvec2 d = max(max(min(min(a, b), c) - pos, pos - max(max(a, b), c)), 0);
+    return dot(d, d);
 }
 
-dvec2 min_dist_straight(dvec2 pos, dvec2 start, dvec2 end)
+double min_dist_straight(dvec2 pos, dvec2 start, dvec2 end)
 {
     dvec2 b = end - start;
     dvec2 c = pos - start;
 
     double t = clamp(dot(b, c) / dot(b, b), 0, 1);
-    dvec2 p = b * clamp(t, 0, 1);
-    dvec2 q = c - p;
-    double dist = dot(q, q);
-
-    double norm = (b.x * q.y - b.y * q.x);
-    double ortho_sq = norm * norm / dot(b, b);
-
-    return dvec2(dist * sign(norm), ortho_sq);
+    dvec2 q = c - b * t;
+    return dot(q, q);
 }
 
 /**
@@ -61,13 +64,15 @@ dvec2 newton_rhapson_cubic(dvec2 t, dvec4 f)
     for (int i = 0; i < 2; i++)
     {
         dmat4x2 bases = dmat4x2(t*t*t, t*t, t, dvec2(1));
-        t -= (bases * f) / (bases * g);
+        dvec2 slope = bases * g;
+        // a flat spot would send t off to infinity, stay put on one
+        t -= mix((bases * f) / slope, dvec2(0), equal(slope, dvec2(0)));
     }
 
     return t;
 }
 
-dvec2 min_dist_bezier(dvec2 pos, dvec2 start, dvec2 control, dvec2 end)
+double min_dist_bezier(dvec2 pos, dvec2 start, dvec2 control, dvec2 end)
 {
     dvec2 aA = start - 2 * control + end;
     dvec2 bB = control - start;
@@ -83,38 +88,38 @@ dvec2 min_dist_bezier(dvec2 pos, dvec2 start, dvec2 control, dvec2 end)
     dmat2 curve_point = dmat3x2(aA, 2 * bB, start)
             * transpose(dmat3x2(t * t, t, dvec2(1)));
     dmat2 dist_vec = curve_point - dmat2(pos, pos);
-    dvec2 dist = dvec2(dot(dist_vec[0], dist_vec[0]),
-            dot(dist_vec[1], dist_vec[1]));
-
-    int i = int(dist.x > dist.y);
-    double min_dist = dist[i];
-    double min_factor = t[i];
-    dvec2 nearest_point = curve_point[i];
-
-    dvec2 direction = 2 * (aA * min_factor + bB);
-    dvec2 nearest_vec = pos - nearest_point;
-
-    double norm = (direction.x * nearest_vec.y - direction.y * nearest_vec.x);
-    double ortho_sq = norm * norm / dot(direction, direction);
-
-    return dvec2(min_dist * sign(norm), ortho_sq);
+    return min(dot(dist_vec[0], dist_vec[0]), dot(dist_vec[1], dist_vec[1]));
 }
 
-bool min_dist_either(dvec2 pos, dvec3 a, dvec3 b, dvec3 c, out dvec2 result)
+/**
+ * Which way a segment crosses the scanline through pos to the right of it:
+ * 1 going up, -1 going down, 0 not at all. Segments never turn back in y,
+ * see sdf_segments(), and count from their lower end up to but not
+ * including their upper one. Keep in sync with crossing() in sdf.c.
+ */
+int crossing(dvec2 pos, dvec2 a, dvec2 b, dvec2 c, bool quadratic)
 {
-    if (on_curve(b))
+    if (min(a.y, c.y) > pos.y || max(a.y, c.y) <= pos.y) return 0;
+    int dir = c.y > a.y ? 1 : -1;
+
+    double k = pos.y - a.y;
+    double x;
+    if (!quadratic)
     {
-        if (!on_curve(a)) return true;
-        result = min_dist_straight(pos, a.xy, b.xy);
+        x = a.x + (c.x - a.x) * (k / (c.y - a.y));
     }
     else
     {
-        if (!on_curve(a)) a = (a + b) / 2;
-        if (!on_curve(c)) c = (b + c) / 2;
-        result = min_dist_bezier(pos, a.xy, b.xy, c.xy);
+        // the root of (a - 2b + c)t^2 + 2(b - a)t = k that's on the curve,
+        // written so it holds up when the curve is nearly straight
+        dvec2 aA = a - 2 * b + c;
+        dvec2 bB = b - a;
+        double den = bB.y + dir * sqrt(max(bB.y * bB.y + aA.y * k, 0));
+        double t = clamp(den == 0 ? 0 : k / den, 0, 1);
+        x = (aA.x * t + 2 * bB.x) * t + a.x;
     }
 
-    return false;
+    return x > pos.x ? dir : 0;
 }
 
 void main()
@@ -122,36 +127,29 @@ void main()
     dvec2 pos = gl_FragCoord.xy;
 
     double min_dist = 1.0 / 0.0;
-    double best_ortho = 0;
+    int winding = 0;
 
-    int c = -1, start_contour = 0, end_contour = 0;
-    for (int point_index = 0; point_index < num_points; point_index++)
+    for (int i = 0; i < num_segments; i++)
     {
-        if (point_index == end_contour)
-        {
-            c++;
-            start_contour = point_index;
-            end_contour = endpoint(c) + 1;
-        }
-
-        int i = point_index;
-        dvec3 a = point(i);
-        dvec3 b = point(++i < end_contour ? i : i - end_contour + start_contour);
-        dvec3 c = point(++i < end_contour ? i : i - end_contour + start_contour);
-        dvec2 result;
-        if (min_dist_either(pos, a, b, c, result)) continue;
-
-        double diff = abs(min_dist) - abs(result.x);
-        const double err = 0.00000000001;
-        if (diff > err || abs(diff) <= err && result.y > best_ortho)
-        {
-            min_dist = result.x;
-            best_ortho = result.y;
-        }
+        uvec4 segment = texelFetch(u_segments, i);
+        dvec2 a = point(segment.r);
+        dvec2 b = point(segment.g);
+        dvec2 c = point(segment.b);
+
+        // inside is wherever the contours wind around, nonzero
+        winding += crossing(pos, a, b, c, segment.a != LINE);
+
+        // nothing in a box farther than the best so far can beat it
+        if (box_dist(pos, a, b, c) >= min_dist) continue;
+
+        min_dist = min(min_dist, segment.a == LINE
+                ? min_dist_straight(pos, a, c)
+                : min_dist_bezier(pos, a, b, c));
     }
 
-    // TODO: de-magic the magic number
-    min_dist = sqrt(abs(min_dist)) * sign(min_dist) - 0.4;
+    min_dist = sqrt(min_dist);
+    if (winding != 0) min_dist = -min_dist;
+    min_dist -= EDGE_BIAS;
     vec3 foreground = vec3(0);
     vec3 background = vec3(1, 0, 0);
     float alpha = float(-min_dist);
@@ -0,0 +1,229 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "atlas.h"
+
+void atlas_init(struct atlas *atlas, int phases)
+{
+    if (phases < 1) phases = 1;
+    if (phases > 4) phases = 4;
+
+    atlas->num_pages = 0;
+    atlas->phases = phases;
+    atlas->num_glyphs = 0;
+    atlas->reclaimed = 0;
+    atlas->repacked = 0;
+}
+
+void atlas_destroy(struct atlas *atlas)
+{
+    for (int i = 0; i < atlas->num_pages; i++)
+    {
+        free(atlas->pages[i].pixels);
+        free(atlas->pages[i].shelves);
+    }
+    atlas->num_pages = 0;
+}
+
+static bool page_alloc(struct atlas_page *page, int width, int height,
+                       struct atlas_rect *out)
+{
+    // best fitting shelf that still has room
+    struct atlas_shelf *best = NULL;
+    for (int i = 0; i < page->num_shelves; i++)
+    {
+        struct atlas_shelf *shelf = &page->shelves[i];
+        if (shelf->height < height) continue;
+        if (ATLAS_PAGE_SIZE - shelf->cursor < width) continue;
+        if (best == NULL || shelf->height < best->height) best = shelf;
+    }
+
+    // don't waste a tall shelf on a short glyph if we can open a new one
+    int top = 0;
+    if (page->num_shelves > 0)
+    {
+        struct atlas_shelf *last = &page->shelves[page->num_shelves - 1];
+        top = last->y + last->height;
+    }
+    bool room = ATLAS_PAGE_SIZE - top >= height;
+
+    if (best == NULL || (room && best->height > height * 3 / 2))
+    {
+        if (!room || width > ATLAS_PAGE_SIZE) return false;
+
+        if (page->num_shelves >= page->cap_shelves)
+        {
+            page->cap_shelves = page->cap_shelves ? page->cap_shelves * 2 : 16;
+            page->shelves = realloc(page->shelves,
+                    sizeof(*page->shelves) * page->cap_shelves);
+        }
+        best = &page->shelves[page->num_shelves++];
+        best->y = top;
+        best->height = height;
+        best->cursor = 0;
+    }
+
+    out->x = best->cursor;
+    out->y = best->y;
+    out->width = width;
+    out->height = height;
+    best->cursor += width;
+    return true;
+}
+
+/**
+ * Find room for a width x height glyph, filling out where it goes. Fails if
+ * every page is full, or the glyph is bigger than a page.
+ */
+RESULT atlas_alloc(struct atlas *atlas, int width, int height,
+                   struct atlas_rect *out)
+{
+    if (width > ATLAS_PAGE_SIZE || height > ATLAS_PAGE_SIZE) return ERR;
+
+    int p = 0;
+    for (; p < atlas->num_pages; p++)
+        if (page_alloc(&atlas->pages[p], width, height, out))
+            break;
+
+    if (p == atlas->num_pages)
+    {
+        if (atlas->num_pages == ATLAS_MAX_PAGES) return ERR;
+
+        struct atlas_page *page = &atlas->pages[atlas->num_pages++];
+        page->pixels = calloc(ATLAS_PAGE_SIZE, ATLAS_PAGE_SIZE);
+        page->texture = 0;
+        damage_clear(&page->dirty);
+        page->used = 0;
+        page->num_shelves = 0;
+        page->cap_shelves = 0;
+        page->shelves = NULL;
+
+        if (!page_alloc(page, width, height, out))
+            return ERR;
+    }
+
+    out->page = p;
+    atlas->pages[p].used += (size_t) width * height;
+    atlas->num_glyphs++;
+    return OK;
+}
+
+/**
+ * Copy bitmap into the room atlas_alloc() found for it.
+ */
+void atlas_copy(struct atlas *atlas, struct bitmap *bitmap,
+                struct atlas_rect *rect)
+{
+    struct atlas_page *page = &atlas->pages[rect->page];
+    for (int y = 0; y < bitmap->height; y++)
+        memcpy(page->pixels + (rect->y + y) * ATLAS_PAGE_SIZE + rect->x,
+               bitmap->pixels + y * bitmap->width,
+               bitmap->width);
+    damage_add(&page->dirty, (struct rect) { rect->x, rect->y,
+                                             rect->width, rect->height });
+}
+
+void atlas_remove(struct atlas *atlas, struct atlas_rect *rect)
+{
+    struct atlas_page *page = &atlas->pages[rect->page];
+    page->used -= (size_t) rect->width * rect->height;
+    atlas->num_glyphs--;
+
+    // the last glyph is gone, start packing the page from scratch
+    if (page->used == 0 && page->num_shelves > 0)
+    {
+        page->num_shelves = 0;
+        atlas->reclaimed++;
+    }
+}
+
+static int compare_heights(const void *a, const void *b)
+{
+    const struct atlas_rect *ra = *(struct atlas_rect **) a;
+    const struct atlas_rect *rb = *(struct atlas_rect **) b;
+    return rb->height - ra->height;
+}
+
+/**
+ * Pack the glyphs still on a page again from scratch, tallest first, so the
+ * holes left by removed ones can be used. rects must be every glyph left on
+ * the page; they're moved, pixels and all, and updated in place. If they
+ * don't fit any better, the page is left as it was and this fails.
+ */
+RESULT atlas_repack(struct atlas *atlas, int p, struct atlas_rect **rects,
+                    int count)
+{
+    struct atlas_page *page = &atlas->pages[p];
+    qsort(rects, count, sizeof(*rects), compare_heights);
+
+    struct atlas_page packed = { 0 };
+    struct atlas_rect *moved = malloc(sizeof(*moved) * (count ? count : 1));
+    for (int i = 0; i < count; i++)
+    {
+        if (!page_alloc(&packed, rects[i]->width, rects[i]->height, &moved[i]))
+        {
+            free(packed.shelves);
+            free(moved);
+            return ERR;
+        }
+        moved[i].page = p;
+    }
+
+    uint8_t *pixels = calloc(ATLAS_PAGE_SIZE, ATLAS_PAGE_SIZE);
+    for (int i = 0; i < count; i++)
+    {
+        for (int y = 0; y < moved[i].height; y++)
+            memcpy(pixels + (moved[i].y + y) * ATLAS_PAGE_SIZE + moved[i].x,
+                   page->pixels + (rects[i]->y + y) * ATLAS_PAGE_SIZE + rects[i]->x,
+                   moved[i].width);
+        *rects[i] = moved[i];
+    }
+    free(moved);
+
+    free(page->pixels);
+    free(page->shelves);
+    page->pixels = pixels;
+    page->shelves = packed.shelves;
+    page->num_shelves = packed.num_shelves;
+    page->cap_shelves = packed.cap_shelves;
+    damage_add(&page->dirty, (struct rect) { 0, 0,
+                                             ATLAS_PAGE_SIZE, ATLAS_PAGE_SIZE });
+    atlas->repacked++;
+    return OK;
+}
+
+/**
+ * Split x into a whole pixel and the nearest subpixel phase.
+ */
+int atlas_phase(struct atlas *atlas, float x, float *whole)
+{
+    *whole = floorf(x);
+    int phase = (int) ((x - *whole) * atlas->phases + 0.5f);
+    if (phase == atlas->phases)
+    {
+        *whole += 1;
+        phase = 0;
+    }
+    return phase;
+}
+
+float atlas_phase_offset(struct atlas *atlas, int phase)
+{
+    return (float) phase / atlas->phases;
+}
+
+void atlas_print_stats(struct atlas *atlas, FILE *f)
+{
+    size_t used = 0;
+    for (int i = 0; i < atlas->num_pages; i++)
+        used += atlas->pages[i].used;
+
+    size_t page_bytes = (size_t) ATLAS_PAGE_SIZE * ATLAS_PAGE_SIZE;
+    fprintf(f, "atlas: %d phase%s, %u glyph variants, "
+            "%zu/%zu bytes used on %d page%s, "
+            "%u pages reclaimed, %u repacked\n",
+            atlas->phases, atlas->phases == 1 ? "" : "s",
+            atlas->num_glyphs, used, page_bytes * atlas->num_pages,
+            atlas->num_pages, atlas->num_pages == 1 ? "" : "s",
+            atlas->reclaimed, atlas->repacked);
+}
@@ -0,0 +1,82 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "bitmap.h"
+#include "damage.h"
+#include "truetype.h"
+
+#ifndef ATLAS_H
+#define ATLAS_H
+
+#ifndef ATLAS_PAGE_SIZE
+#define ATLAS_PAGE_SIZE 1024
+#endif
+
+#ifndef ATLAS_MAX_PAGES
+#define ATLAS_MAX_PAGES 8
+#endif
+
+// Pre-rendered glyphs packed onto square 8-bit pages with a shelf packer.
+// Each glyph can be stored in up to four variants, each rendered at a
+// different horizontal subpixel offset, so that text placed at fractional
+// positions still takes one texture fetch per pixel. Space is reclaimed a
+// page at a time, once every glyph on the page has been removed, or by
+// atlas_repack(), which packs what's left on a page again from scratch. So
+// when every page is full it's up to whoever owns the glyphs to remove some
+// of one page's and repack it, as only they know where the rest are.
+//
+// Space is reserved with atlas_alloc() before the glyph is rendered, and
+// the pixels copied in with atlas_copy(), so a glyph that won't fit isn't
+// rendered for nothing.
+//
+// Each page keeps track of where glyphs went since it was last uploaded, so
+// that only those parts need uploading again.
+
+struct atlas_shelf
+{
+    uint16_t y;
+    uint16_t height;
+    uint16_t cursor;
+};
+
+struct atlas_page
+{
+    uint8_t *pixels;
+    unsigned texture; // belongs to whoever uploads the page
+    struct damage dirty; // where glyphs went since the last upload
+    size_t used;
+    int num_shelves;
+    int cap_shelves;
+    struct atlas_shelf *shelves;
+};
+
+struct atlas_rect
+{
+    uint16_t page;
+    uint16_t x, y;
+    uint16_t width, height;
+};
+
+struct atlas
+{
+    struct atlas_page pages[ATLAS_MAX_PAGES];
+    int num_pages;
+    int phases;
+    uint32_t num_glyphs;
+    uint32_t reclaimed; // times a page emptied and started over
+    uint32_t repacked;
+};
+
+void atlas_init(struct atlas *, int phases);
+void atlas_destroy(struct atlas *);
+RESULT atlas_alloc(struct atlas *, int width, int height,
+                   struct atlas_rect *);
+void atlas_copy(struct atlas *, struct bitmap *, struct atlas_rect *);
+void atlas_remove(struct atlas *, struct atlas_rect *);
+RESULT atlas_repack(struct atlas *, int page, struct atlas_rect **,
+                    int count);
+int atlas_phase(struct atlas *, float x, float *whole);
+float atlas_phase_offset(struct atlas *, int phase);
+void atlas_print_stats(struct atlas *, FILE *);
+
+#endif // ATLAS_H
@@ -0,0 +1,560 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+#include <error.h>
+#include <errno.h>
+#include <pthread.h>
+#include "truetype.h"
+#include "document.h"
+#include "image.h"
+#include "layout.h"
+#include "raster.h"
+#include "utf8.h"
+
+// Renders every line of a text file into an image of its own, on as many
+// threads as there are cores. No GL, no window, nothing to link but libm and
+// pthreads, so it runs on any box.
+//
+// The threads share the parsed font and one glyph cache, see raster.h, and
+// claim records BATCH_CHUNK at a time. They hand their encoded images to a
+// single writer thread through a queue of BATCH_QUEUE, and wait when it's
+// full, so a slow disk slows them down rather than eating all memory.
+//
+// With -O it draws the whole file, or just a message, into one image
+// instead, on the calling thread, and writes it out BATCH_BAND rows at a
+// time, so a file of any length only ever needs one band in memory.
+
+// records a worker claims at once
+#ifndef BATCH_CHUNK
+#define BATCH_CHUNK 16
+#endif
+
+// encoded images waiting for the writer at most
+#ifndef BATCH_QUEUE
+#define BATCH_QUEUE 64
+#endif
+
+// rows of the one image -O draws at a time
+#ifndef BATCH_BAND
+#define BATCH_BAND 256
+#endif
+
+enum stage { DECODE, LAYOUT, RASTER, ENCODE, NUM_STAGES };
+
+static const char *stage_names[NUM_STAGES] =
+{
+    "decode", "layout", "raster", "encode",
+};
+
+struct encoded
+{
+    size_t record;
+    char *data;
+    size_t size;
+};
+
+struct output_queue
+{
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    struct encoded items[BATCH_QUEUE];
+    int head, len;
+    bool closed;
+};
+
+struct stats
+{
+    uint64_t records;
+    uint64_t failed; // not valid UTF-8
+    uint64_t glyphs;
+    uint64_t bytes;
+    double stages[NUM_STAGES]; // seconds
+    double waiting; // for room in the queue
+};
+
+struct batch
+{
+    struct document corpus;
+    struct raster raster;
+    struct output_queue queue;
+    _Atomic size_t next; // first record nobody has claimed yet
+    size_t limit;
+    float size;
+    int width;
+    int padding;
+    enum image_format format;
+    const char *out_dir; // NULL to throw the images away
+    double writing; // seconds the writer spent on files
+};
+
+struct worker
+{
+    struct batch *batch;
+    pthread_t thread;
+    struct ttf_reader font; // a clone, readers aren't thread safe
+    uint32_t *codepoints;
+    size_t codepoints_cap;
+    struct stats stats;
+};
+
+double now(void);
+void queue_init(struct output_queue *q);
+void queue_destroy(struct output_queue *q);
+void queue_push(struct output_queue *q, struct encoded item);
+bool queue_pop(struct output_queue *q, struct encoded *item);
+void queue_close(struct output_queue *q);
+bool get_record(struct batch *b, size_t record, const char **text,
+                size_t *len);
+RESULT render_record(struct worker *w, size_t record, const char *text,
+                     size_t len, struct encoded *out);
+void *work(void *arg);
+void *write_images(void *arg);
+void print_stats(struct stats *totals, int num_threads, double seconds,
+                 double writing);
+RESULT render_one_image(struct batch *b, struct ttf_reader *font,
+                        const char *message, const char *path);
+
+int main(int argc, char *argv[])
+{
+    // -j N: render on N threads, one per core by default
+    // -s PX: font size in pixels
+    // -w PX: image width in pixels, lines wrap to fit
+    // -f F: png or ppm
+    // -n N: stop after the first N records
+    // -o D: write the images into the directory D, named after the record
+    //       number, instead of throwing them away after encoding
+    // -a:   rasterize glyphs with exact coverage instead of the SDF
+    // -O F: draw every line of the corpus one under the other into the one
+    //       image F instead, PNG if it ends in .png and PPM otherwise. The
+    //       lines don't wrap, -w only sets how wide the image is
+    // -m S: with -O, draw S instead of a corpus, wrapped to fit
+    int num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    struct batch b =
+    {
+        .limit = SIZE_MAX,
+        .size = 24,
+        .width = 512,
+        .format = IMAGE_PNG,
+    };
+    bool usage = false, coverage = false;
+    const char *one_image = NULL, *message = NULL;
+    for (int opt; (opt = getopt(argc, argv, "j:s:w:f:n:o:aO:m:")) != -1;)
+    {
+        switch (opt)
+        {
+            case 'j': num_threads = atoi(optarg); break;
+            case 's': b.size = atof(optarg); break;
+            case 'w': b.width = atoi(optarg); break;
+            case 'f':
+                b.format = strcmp(optarg, "ppm") == 0 ? IMAGE_PPM : IMAGE_PNG;
+                break;
+            case 'n': b.limit = strtoull(optarg, NULL, 10); break;
+            case 'o': b.out_dir = optarg; break;
+            case 'a': coverage = true; break;
+            case 'O': one_image = optarg; break;
+            case 'm': message = optarg; break;
+            default: usage = true; break;
+        }
+    }
+    int num_args = message != NULL ? 1 : 2;
+    if (message != NULL && one_image == NULL) usage = true;
+    if (usage || argc - optind != num_args || num_threads < 1 || b.size <= 0)
+        error(ERR, 0, "usage: %s [-a] [-j threads] [-s size] [-w width] "
+              "[-f png|ppm] [-n records] [-o dir] corpus font.ttf "
+              "| [-a] [-s size] [-w width] [-n records] -O image "
+              "[-m text | corpus] font.ttf", argv[0]);
+    const char *corpus_path = message ? NULL : argv[optind];
+    const char *font_path = argv[argc - 1];
+    b.padding = ceilf(b.size / 2);
+    if (b.width <= 2 * b.padding)
+        error(ERR, 0, "%d pixels is too narrow for size %g", b.width, b.size);
+
+    struct ttf_reader font;
+    if (ttf_load(font_path, &font) == ERR)
+        error(ERR, errno, "Failed to load %s", font_path);
+    if (corpus_path != NULL && document_open(&b.corpus, corpus_path) != OK)
+        error(ERR, errno, "Failed to open %s", corpus_path);
+
+    raster_init(&b.raster, b.size);
+    b.raster.coverage = coverage;
+
+    if (one_image != NULL)
+    {
+        if (render_one_image(&b, &font, message, one_image) != OK)
+            error(ERR, errno, "Failed to write %s", one_image);
+        raster_destroy(&b.raster);
+        if (corpus_path != NULL) document_close(&b.corpus);
+        return 0;
+    }
+    queue_init(&b.queue);
+    atomic_init(&b.next, 0);
+
+    double start = now();
+
+    pthread_t writer;
+    pthread_create(&writer, NULL, write_images, &b);
+
+    struct worker *workers = calloc(num_threads, sizeof(*workers));
+    for (int i = 0; i < num_threads; i++)
+    {
+        workers[i].batch = &b;
+        ttf_reader_clone(&font, &workers[i].font);
+        pthread_create(&workers[i].thread, NULL, work, &workers[i]);
+    }
+
+    struct stats totals = { 0 };
+    for (int i = 0; i < num_threads; i++)
+    {
+        struct worker *w = &workers[i];
+        pthread_join(w->thread, NULL);
+
+        totals.records += w->stats.records;
+        totals.failed += w->stats.failed;
+        totals.glyphs += w->stats.glyphs;
+        totals.bytes += w->stats.bytes;
+        for (int s = 0; s < NUM_STAGES; s++)
+            totals.stages[s] += w->stats.stages[s];
+        totals.waiting += w->stats.waiting;
+
+        ttf_reader_free_clone(&w->font);
+        free(w->codepoints);
+    }
+
+    queue_close(&b.queue);
+    pthread_join(writer, NULL);
+
+    print_stats(&totals, num_threads, now() - start, b.writing);
+
+    free(workers);
+    queue_destroy(&b.queue);
+    raster_destroy(&b.raster);
+    document_close(&b.corpus);
+    return 0;
+}
+
+double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void queue_init(struct output_queue *q)
+{
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->not_empty, NULL);
+    pthread_cond_init(&q->not_full, NULL);
+    q->head = q->len = 0;
+    q->closed = false;
+}
+
+void queue_destroy(struct output_queue *q)
+{
+    pthread_mutex_destroy(&q->lock);
+    pthread_cond_destroy(&q->not_empty);
+    pthread_cond_destroy(&q->not_full);
+}
+
+/**
+ * Add an image for the writer, waiting for room if the queue is full.
+ */
+void queue_push(struct output_queue *q, struct encoded item)
+{
+    pthread_mutex_lock(&q->lock);
+    while (q->len == BATCH_QUEUE)
+        pthread_cond_wait(&q->not_full, &q->lock);
+
+    q->items[(q->head + q->len) % BATCH_QUEUE] = item;
+    q->len++;
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+}
+
+/**
+ * Take the oldest image, waiting for one if there are none. Returns false
+ * once the queue is closed and empty.
+ */
+bool queue_pop(struct output_queue *q, struct encoded *item)
+{
+    pthread_mutex_lock(&q->lock);
+    while (q->len == 0 && !q->closed)
+        pthread_cond_wait(&q->not_empty, &q->lock);
+
+    bool popped = q->len > 0;
+    if (popped)
+    {
+        *item = q->items[q->head];
+        q->head = (q->head + 1) % BATCH_QUEUE;
+        q->len--;
+        pthread_cond_signal(&q->not_full);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return popped;
+}
+
+/**
+ * No more images are coming, let the writer finish.
+ */
+void queue_close(struct output_queue *q)
+{
+    pthread_mutex_lock(&q->lock);
+    q->closed = true;
+    pthread_cond_broadcast(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+}
+
+/**
+ * Find a record in the corpus, waiting for the indexer to get to it if it
+ * hasn't yet. Returns false past the last one.
+ */
+bool get_record(struct batch *b, size_t record, const char **text,
+                size_t *len)
+{
+    if (record >= b->limit) return false;
+
+    for (;;)
+    {
+        bool indexed;
+        size_t num_lines = document_num_lines(&b->corpus, &indexed);
+        if (record < num_lines)
+            return document_line(&b->corpus, record, text, len);
+        if (indexed) return false;
+        usleep(1000);
+    }
+}
+
+/**
+ * Turn one record into an encoded image, timing every stage on the way.
+ */
+RESULT render_record(struct worker *w, size_t record, const char *text,
+                     size_t len, struct encoded *out)
+{
+    struct batch *b = w->batch;
+    double start = now();
+
+    if (len + 1 > w->codepoints_cap)
+    {
+        w->codepoints_cap = len + 1;
+        w->codepoints = realloc(w->codepoints,
+                                sizeof(*w->codepoints) * w->codepoints_cap);
+    }
+    size_t n;
+    RESULT decoded = utf8_decode(text, len, w->codepoints, &n, NULL);
+    double decode_end = now();
+    w->stats.stages[DECODE] += decode_end - start;
+    if (decoded != OK) return ERR;
+
+    struct layout layout;
+    layout_codepoints(&w->font, w->codepoints, n, b->size,
+                      b->width - 2 * b->padding, &layout);
+    double layout_end = now();
+    w->stats.stages[LAYOUT] += layout_end - decode_end;
+
+    struct image image;
+    image_alloc(&image, b->width, ceilf(layout.height) + 2 * b->padding);
+    raster_draw_layout(&b->raster, &image, &w->font, 0, &layout,
+                       b->padding, b->padding);
+    w->stats.glyphs += layout.num_glyphs;
+    layout_free(&layout);
+    double raster_end = now();
+    w->stats.stages[RASTER] += raster_end - layout_end;
+
+    out->record = record;
+    out->data = NULL;
+    FILE *file = open_memstream(&out->data, &out->size);
+    RESULT result = image_write_file(&image, file, b->format);
+    if (fclose(file) != 0) result = ERR;
+    image_free(&image);
+    w->stats.stages[ENCODE] += now() - raster_end;
+
+    if (result != OK)
+        error(ERR, errno, "Failed to encode record %zu", record);
+    w->stats.bytes += out->size;
+    return OK;
+}
+
+void *work(void *arg)
+{
+    struct worker *w = arg;
+    struct batch *b = w->batch;
+
+    for (;;)
+    {
+        size_t first = atomic_fetch_add(&b->next, BATCH_CHUNK);
+        for (size_t record = first; record < first + BATCH_CHUNK; record++)
+        {
+            // finding the line counts as decoding it
+            double start = now();
+            const char *text;
+            size_t len;
+            bool found = get_record(b, record, &text, &len);
+            w->stats.stages[DECODE] += now() - start;
+            if (!found) return NULL;
+
+            struct encoded item;
+            if (render_record(w, record, text, len, &item) != OK)
+            {
+                w->stats.failed++;
+                continue;
+            }
+            w->stats.records++;
+
+            start = now();
+            queue_push(&b->queue, item);
+            w->stats.waiting += now() - start;
+        }
+    }
+}
+
+void *write_images(void *arg)
+{
+    struct batch *b = arg;
+    const char *extension = b->format == IMAGE_PNG ? "png" : "ppm";
+
+    struct encoded item;
+    while (queue_pop(&b->queue, &item))
+    {
+        double start = now();
+        if (b->out_dir != NULL)
+        {
+            char path[4096];
+            snprintf(path, sizeof(path), "%s/%08zu.%s", b->out_dir,
+                     item.record, extension);
+
+            FILE *file = fopen(path, "wb");
+            if (file == NULL
+                    || fwrite(item.data, 1, item.size, file) != item.size
+                    || fclose(file) != 0)
+                error(ERR, errno, "Failed to write %s", path);
+        }
+        free(item.data);
+        b->writing += now() - start;
+    }
+
+    return NULL;
+}
+
+/**
+ * Throughput, and where the workers' time went. Stage times are summed over
+ * all workers, so they add up to about threads times the wall clock time.
+ */
+void print_stats(struct stats *totals, int num_threads, double seconds,
+                 double writing)
+{
+    printf("%" PRIu64 " records in %.2f s on %d thread%s: %.0f records/s, "
+           "%.0f glyphs/s, %.1f MB encoded\n",
+           totals->records, seconds, num_threads, num_threads == 1 ? "" : "s",
+           totals->records / seconds, totals->glyphs / seconds,
+           totals->bytes / 1e6);
+    if (totals->failed)
+        printf("%" PRIu64 " records skipped, not valid UTF-8\n",
+               totals->failed);
+
+    double busy = totals->waiting;
+    for (int s = 0; s < NUM_STAGES; s++)
+        busy += totals->stages[s];
+    if (busy <= 0) busy = 1;
+
+    uint64_t records = totals->records ? totals->records : 1;
+    for (int s = 0; s < NUM_STAGES; s++)
+        printf("  %-8s %9.3f s %5.1f%% %9.2f us/record\n", stage_names[s],
+               totals->stages[s], 100 * totals->stages[s] / busy,
+               1e6 * totals->stages[s] / records);
+    printf("  %-8s %9.3f s %5.1f%%  waiting for the writer\n", "queue",
+           totals->waiting, 100 * totals->waiting / busy);
+    printf("  %-8s %9.3f s on the writer thread\n", "write", writing);
+}
+
+/**
+ * Draw message, wrapped to the image, or if it's NULL every line of the
+ * corpus, unwrapped, one under the other into a single image at path. It's
+ * drawn and written out BATCH_BAND rows at a time.
+ */
+RESULT render_one_image(struct batch *b, struct ttf_reader *font,
+                        const char *message, const char *path)
+{
+    float line_height = (font->ascender - font->descender + font->line_gap)
+                      * b->size / font->units_per_em;
+
+    size_t num_lines = 0;
+    struct layout paragraph;
+    int height = 2 * b->padding;
+    if (message != NULL)
+    {
+        if (layout_paragraph(font, message, strlen(message), b->size,
+                             b->width - 2 * b->padding, &paragraph) != OK)
+            error(ERR, 0, "invalid UTF-8 in message");
+        height += ceilf(paragraph.height);
+    }
+    else
+    {
+        bool indexed = false;
+        while ((num_lines = document_num_lines(&b->corpus, &indexed)),
+                !indexed)
+            usleep(1000);
+        if (num_lines > b->limit) num_lines = b->limit;
+        height += ceilf(num_lines * line_height);
+    }
+
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) return ERR;
+
+    struct image_writer writer;
+    RESULT result = image_writer_begin(&writer, file, image_format_for(path),
+                                       b->width, height);
+
+    struct image band;
+    image_alloc(&band, b->width, BATCH_BAND);
+
+    for (int y0 = 0; y0 < height && result == OK; y0 += band.height)
+    {
+        int rows = height - y0 < band.height ? height - y0 : band.height;
+        image_clear(&band);
+
+        if (message != NULL)
+        {
+            raster_draw_layout(&b->raster, &band, font, 0, &paragraph,
+                               b->padding, b->padding - y0);
+        }
+        else
+        {
+            // the lines reaching into the band, and one more either side
+            // for ink outside the line boxes
+            double first = (y0 - b->padding) / line_height - 1,
+                   last = (y0 + rows - b->padding) / line_height + 1;
+            for (size_t line = first > 0 ? first : 0;
+                    line <= last && line < num_lines; line++)
+            {
+                const char *text;
+                size_t len;
+                struct layout layout;
+                if (!document_line(&b->corpus, line, &text, &len)) break;
+                if (layout_paragraph(font, text, len, b->size, 0,
+                                     &layout) != OK)
+                    continue;
+
+                raster_draw_layout(&b->raster, &band, font, 0, &layout,
+                                   b->padding,
+                                   b->padding + line * line_height - y0);
+                layout_free(&layout);
+            }
+        }
+
+        result = image_writer_rows(&writer, band.pixels, rows);
+    }
+
+    if (image_writer_end(&writer) != OK) result = ERR;
+    if (fclose(file) != 0) result = ERR;
+
+    image_free(&band);
+    if (message != NULL) layout_free(&paragraph);
+    return result;
+}
@@ -0,0 +1,1299 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+#include <error.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include "truetype.h"
+#include "document.h"
+#include "image.h"
+#include "layout.h"
+#include "measure.h"
+#include "raster.h"
+#include "coverage.h"
+#include "concmap.h"
+#include "hashmap.h"
+#include "sdf.h"
+#include "shape.h"
+#include "tiles.h"
+#include "utf8.h"
+
+// Benchmarks and tests for the pieces fonter and fonter-batch are made of,
+// kept out of both. The make targets bench-* and check run them.
+
+// how long -g spends on each rasterizer at each size, at most
+#ifndef BENCH_SECONDS
+#define BENCH_SECONDS 1.0
+#endif
+
+// the page -P fills with text, and how many times it renders it
+#ifndef BENCH_PAGE_WIDTH
+#define BENCH_PAGE_WIDTH 3840
+#endif
+#ifndef BENCH_PAGE_HEIGHT
+#define BENCH_PAGE_HEIGHT 2160
+#endif
+#ifndef BENCH_PAGE_FRAMES
+#define BENCH_PAGE_FRAMES 10
+#endif
+
+// how much of the corpus -L lays out, and how many times
+#ifndef BENCH_LAYOUT_BYTES
+#define BENCH_LAYOUT_BYTES (4 << 20)
+#endif
+#ifndef BENCH_LAYOUT_ROUNDS
+#define BENCH_LAYOUT_ROUNDS 5
+#endif
+
+// how many records at a time -E also measures, newlines and all
+#ifndef BENCH_MEASURE_LINES
+#define BENCH_MEASURE_LINES 8
+#endif
+
+// how far apart, in pixels, -T -E lets measure_text() and the layout be,
+// since one sums font units and the other pixels
+#ifndef BENCH_MEASURE_SLACK
+#define BENCH_MEASURE_SLACK 0.01
+#endif
+
+// operations -M times each map at for every size, at least
+#ifndef BENCH_MAP_OPS
+#define BENCH_MAP_OPS 2000000
+#endif
+
+// how many keys -T races threads over, and how many times
+#ifndef BENCH_TEST_KEYS
+#define BENCH_TEST_KEYS 200000
+#endif
+#ifndef BENCH_TEST_ROUNDS
+#define BENCH_TEST_ROUNDS 20
+#endif
+
+// entries in the map -C reads from, and lookups per reader
+#ifndef BENCH_READ_KEYS
+#define BENCH_READ_KEYS 65536
+#endif
+#ifndef BENCH_READ_LOOKUPS
+#define BENCH_READ_LOOKUPS 20000000
+#endif
+
+
+// what the corpus modes lay out, and how
+struct bench
+{
+    struct document corpus;
+    float size;
+    int width; // of the lines -L lays out
+    int padding;
+    const char *out_dir; // where -P writes its page, if anywhere
+};
+
+// The map hashmap_t replaced, as it was, for -M to compare against. Keys
+// are their own hash, NULL marks an empty bucket, and cap wraps to 0 past
+// 32768 buckets, so it can't hold more than 24576 entries.
+struct shortmap_bucket
+{
+    uint16_t key;
+    void *value;
+};
+
+typedef struct
+{
+    struct shortmap_bucket *buckets;
+    uint16_t cap;
+    uint16_t len;
+} shortmap_t;
+
+#define SHORTMAP_MAX 24576
+
+double now(void);
+bool get_record(struct bench *b, size_t record, const char **text,
+                size_t *len);
+void bench_rasterizers(struct ttf_reader *font);
+void bench_sdf_paths(struct ttf_reader *font);
+void bench_page(struct bench *b, struct ttf_reader *font, int num_threads);
+bool test_page(struct bench *b, struct ttf_reader *font, int num_threads);
+void bench_layout(struct bench *b, struct ttf_reader *font);
+bool test_measure(struct bench *b, struct ttf_reader *font);
+void bench_measure(struct bench *b, struct ttf_reader *font);
+shortmap_t shortmap_create(uint16_t initial_cap);
+void *shortmap_insert(shortmap_t *map, uint16_t key, void *value);
+void *shortmap_get(shortmap_t *map, uint16_t key);
+void bench_maps(void);
+bool test_concmap(void);
+void bench_concmap(int max_readers);
+
+int main(int argc, char *argv[])
+{
+    // one of these:
+    // -g:   time both rasterizers on every glyph of the font at a few
+    //       sizes, and the SDF's exact and EDT paths against each other by
+    //       how many segments glyphs have
+    // -P:   fill a 4K page with the corpus and time drawing it glyph by
+    //       glyph on one thread against the tiles on all of them, see
+    //       tiles.h. -o D writes the page into D
+    // -L:   time laying out the corpus's records with the font's kerning,
+    //       without, and without the shaper's word cache
+    // -E:   time measure_text() on the corpus's records, with and without
+    //       the ink box, against laying them out
+    // -M:   time inserts, hits and misses on hashmap_t against the shortmap
+    //       it replaced at a few sizes
+    // -C:   time lookups on a concmap from 1 up to -j threads at once
+    // -T:   race threads inserting into and reading from a concmap, and
+    //       fail if anything comes out wrong. With -P, render the page on
+    //       the tiles on 1 up to -j threads instead, and fail unless every
+    //       one comes out the same as glyph by glyph. With -E, fail unless
+    //       measure_text() agrees with layout_paragraph() on every record
+    // and what they take:
+    // -j N: threads, one per core by default
+    // -s PX: font size in pixels
+    // -w PX: how wide -L's lines are in pixels
+    // -o D: see -P
+    int num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    struct bench b =
+    {
+        .size = 24,
+        .width = 512,
+    };
+    bool usage = false, raster = false, page = false, layout = false,
+         measure = false, maps = false, concmap = false, test = false;
+    for (int opt; (opt = getopt(argc, argv, "j:s:w:o:gPLEMCT")) != -1;)
+    {
+        switch (opt)
+        {
+            case 'j': num_threads = atoi(optarg); break;
+            case 's': b.size = atof(optarg); break;
+            case 'w': b.width = atoi(optarg); break;
+            case 'o': b.out_dir = optarg; break;
+            case 'g': raster = true; break;
+            case 'P': page = true; break;
+            case 'L': layout = true; break;
+            case 'E': measure = true; break;
+            case 'M': maps = true; break;
+            case 'C': concmap = true; break;
+            case 'T': test = true; break;
+            default: usage = true; break;
+        }
+    }
+    if (num_threads < 1 || b.size <= 0) usage = true;
+    if (maps && argc == optind && !usage)
+    {
+        bench_maps();
+        return 0;
+    }
+    if (concmap && argc == optind && !usage)
+    {
+        bench_concmap(num_threads);
+        return 0;
+    }
+    if (test && !page && !measure && argc == optind && !usage)
+        return test_concmap() ? 0 : ERR;
+    if (raster && argc - optind == 1 && !usage)
+    {
+        struct ttf_reader font;
+        if (ttf_load(argv[optind], &font) == ERR)
+            error(ERR, errno, "Failed to load %s", argv[optind]);
+        bench_rasterizers(&font);
+        bench_sdf_paths(&font);
+        return 0;
+    }
+    if (usage || !(page || layout || measure) || argc - optind != 2)
+        error(ERR, 0, "usage: %s [-j threads] [-s size] [-w width] [-o dir] "
+              "-g font.ttf | -M | -C | -T | [-T] -P corpus font.ttf "
+              "| -L corpus font.ttf | [-T] -E corpus font.ttf", argv[0]);
+    const char *corpus_path = argv[optind], *font_path = argv[optind + 1];
+    b.padding = ceilf(b.size / 2);
+    if (b.width <= 2 * b.padding)
+        error(ERR, 0, "%d pixels is too narrow for size %g", b.width, b.size);
+
+    struct ttf_reader font;
+    if (ttf_load(font_path, &font) == ERR)
+        error(ERR, errno, "Failed to load %s", font_path);
+    if (document_open(&b.corpus, corpus_path) != OK)
+        error(ERR, errno, "Failed to open %s", corpus_path);
+
+    bool ok = true;
+    if (page && test)
+        ok = test_page(&b, &font, num_threads);
+    else if (page)
+        bench_page(&b, &font, num_threads);
+    else if (measure && test)
+        ok = test_measure(&b, &font);
+    else if (measure)
+        bench_measure(&b, &font);
+    else
+        bench_layout(&b, &font);
+    document_close(&b.corpus);
+    return ok ? 0 : ERR;
+}
+
+double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * Find a record in the corpus, waiting for the indexer to get to it if it
+ * hasn't yet. Returns false past the last one.
+ */
+bool get_record(struct bench *b, size_t record, const char **text,
+                size_t *len)
+{
+    for (;;)
+    {
+        bool indexed;
+        size_t num_lines = document_num_lines(&b->corpus, &indexed);
+        if (record < num_lines)
+            return document_line(&b->corpus, record, text, len);
+        if (indexed) return false;
+        usleep(1000);
+    }
+}
+
+static struct ttf_glyph *parse_glyphs(struct ttf_reader *font,
+                                      int *num_glyphs)
+{
+    struct ttf_glyph *glyphs = malloc(sizeof(*glyphs) * font->num_glyphs);
+    int n = 0;
+    for (int g = 0; g < font->num_glyphs; g++)
+        if (ttf_parse_glyf(font, g, &glyphs[n]) == OK
+                && glyphs[n].num_contours > 0)
+            n++;
+    *num_glyphs = n;
+    return glyphs;
+}
+
+static void free_glyphs(struct ttf_glyph *glyphs, int num_glyphs)
+{
+    for (int g = 0; g < num_glyphs; g++)
+    {
+        free(glyphs[g].points);
+        free(glyphs[g].contour_endpoints);
+    }
+    free(glyphs);
+}
+
+/**
+ * Glyphs per second for both rasterizers at sizes from 8 to 48 px. The SDF
+ * goes first, over as many of the font's glyphs as it gets through in
+ * BENCH_SECONDS, and coverage gets the same ones. Parsing is done up
+ * front and not counted.
+ */
+void bench_rasterizers(struct ttf_reader *font)
+{
+    int num_glyphs;
+    struct ttf_glyph *glyphs = parse_glyphs(font, &num_glyphs);
+
+    static const float sizes[] = { 8, 12, 16, 24, 32, 48, 96 };
+    static const char *names[] = { "sdf", "coverage" };
+    printf("%d glyphs with outlines\n", num_glyphs);
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(*sizes); s++)
+    {
+        float scale = sizes[s] / font->units_per_em;
+        double per_glyph[2];
+        struct sdf_stats stats = { 0 };
+        int limit = num_glyphs;
+        for (int r = 0; r < 2; r++)
+        {
+            double start = now(), elapsed = 0;
+            int done = 0;
+            while (done < limit && elapsed < BENCH_SECONDS)
+            {
+                struct bitmap bitmap;
+                if (r == 0)
+                    sdf_bake_glyph(&glyphs[done], scale, 0, &bitmap,
+                                   &stats);
+                else
+                    coverage_render_glyph(&glyphs[done], scale, 0, &bitmap);
+                bitmap_free(&bitmap);
+                done++;
+                elapsed = now() - start;
+            }
+            per_glyph[r] = elapsed / done;
+            limit = done;
+        }
+
+        printf("%2g px:", sizes[s]);
+        for (int r = 0; r < 2; r++)
+            printf(" %s %8.2f us/glyph %9.0f glyphs/s,", names[r],
+                   1e6 * per_glyph[r], 1 / per_glyph[r]);
+        printf(" %.0fx\n", per_glyph[0] / per_glyph[1]);
+        printf("       sdf looked at %.1f of %.1f segments per pixel\n",
+               (double) stats.evaluated / stats.pixels,
+               (double) stats.segments / stats.pixels);
+    }
+
+    free_glyphs(glyphs, num_glyphs);
+}
+
+/**
+ * The two ways the SDF can go, see sdf_bake_glyph(), on the font's glyphs
+ * grouped by how many segments they have, at 32 and 96 px. Each group gets
+ * BENCH_SECONDS per way at most, where SDF_EDT_SEGMENTS should fall.
+ */
+void bench_sdf_paths(struct ttf_reader *font)
+{
+    int num_glyphs;
+    struct ttf_glyph *glyphs = parse_glyphs(font, &num_glyphs);
+
+    static const uint32_t bounds[] = { 20, 30, 35, 40, 45, 50, 60, 80, 100,
+                                       150, 200, 300, 400 };
+    const int num_groups = sizeof(bounds) / sizeof(*bounds) + 1;
+    struct ttf_glyph **groups[num_groups];
+    int group_size[num_groups];
+    for (int i = 0; i < num_groups; i++)
+    {
+        groups[i] = malloc(sizeof(**groups) * num_glyphs);
+        group_size[i] = 0;
+    }
+    for (int g = 0; g < num_glyphs; g++)
+    {
+        struct sdf_segment *segments;
+        uint32_t n = sdf_segments(&glyphs[g], &segments);
+        free(segments);
+        int i = 0;
+        while (i < num_groups - 1 && n > bounds[i]) i++;
+        groups[i][group_size[i]++] = &glyphs[g];
+    }
+
+    static const float sizes[] = { 32, 96 };
+    printf("sdf exact against edt at %dx, by segments per glyph:\n",
+           SDF_EDT_SCALE);
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(*sizes); s++)
+    {
+        float scale = sizes[s] / font->units_per_em;
+        for (int i = 0; i < num_groups; i++)
+        {
+            if (group_size[i] == 0) continue;
+            double per_glyph[2];
+            int limit = group_size[i];
+            for (int r = 0; r < 2; r++)
+            {
+                double start = now(), elapsed = 0;
+                int done = 0;
+                while (done < limit && elapsed < BENCH_SECONDS)
+                {
+                    struct bitmap bitmap;
+                    if (r == 0)
+                        sdf_render_glyph(groups[i][done], scale, 0,
+                                         &bitmap, NULL);
+                    else
+                        sdf_render_glyph_edt(groups[i][done], scale, 0,
+                                             &bitmap);
+                    bitmap_free(&bitmap);
+                    done++;
+                    elapsed = now() - start;
+                }
+                per_glyph[r] = elapsed / done;
+                limit = done;
+            }
+
+            char range[32];
+            if (i == num_groups - 1)
+                snprintf(range, sizeof(range), "%" PRIu32 "+",
+                         bounds[i - 1] + 1);
+            else
+                snprintf(range, sizeof(range), "%" PRIu32 "-%" PRIu32,
+                         i == 0 ? 1 : bounds[i - 1] + 1, bounds[i]);
+            printf("%2g px %8s: %5d glyphs, exact %9.2f us/glyph, "
+                   "edt %9.2f us/glyph, %5.2fx\n", sizes[s], range,
+                   group_size[i], 1e6 * per_glyph[0], 1e6 * per_glyph[1],
+                   per_glyph[0] / per_glyph[1]);
+        }
+    }
+
+    for (int i = 0; i < num_groups; i++)
+        free(groups[i]);
+    free_glyphs(glyphs, num_glyphs);
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+static double median(double *times, int n)
+{
+    qsort(times, n, sizeof(*times), compare_doubles);
+    return times[n / 2];
+}
+
+/**
+ * Lay out as many records as fit on a BENCH_PAGE_WIDTH x BENCH_PAGE_HEIGHT
+ * page, one after the other.
+ */
+static void page_layout(struct bench *b, struct ttf_reader *font,
+                        struct layout *layout)
+{
+    int width = BENCH_PAGE_WIDTH, height = BENCH_PAGE_HEIGHT;
+    float max_width = width - 2 * b->padding;
+
+    // half again what could fit if every character were narrow
+    size_t wanted = (size_t) (max_width / (b->size * 0.4f) + 1)
+                  * (height / b->size + 1) * 3 / 2;
+    uint32_t *codepoints = malloc(sizeof(*codepoints) * wanted);
+    size_t n = 0;
+    const char *text;
+    size_t len;
+    for (size_t record = 0; n < wanted && get_record(b, record, &text, &len);
+            record++)
+    {
+        if (n > 0) codepoints[n++] = ' ';
+        size_t decoded;
+        uint32_t *buf = malloc(sizeof(*buf) * (len + 1));
+        if (utf8_decode(text, len, buf, &decoded, NULL) == OK)
+        {
+            if (decoded > wanted - n) decoded = wanted - n;
+            memcpy(codepoints + n, buf, sizeof(*buf) * decoded);
+            n += decoded;
+        }
+        free(buf);
+    }
+
+    layout_codepoints(font, codepoints, n, b->size, max_width, layout);
+    free(codepoints);
+
+    // only the lines that are on the page
+    uint32_t runs = 0;
+    while (runs < layout->num_runs
+            && -layout->runs[runs].baseline <= height - 2 * b->padding)
+        runs++;
+    if (runs < layout->num_runs)
+        layout->num_glyphs = layout->runs[runs].first;
+    layout->num_runs = runs;
+}
+
+/**
+ * Fill a page with page_layout() and render it BENCH_PAGE_FRAMES times both
+ * with the coverage raster on one thread and the tiles on num_threads.
+ * Prints the median frame of each, and a checksum of the tiles' page, which
+ * has to come out the same whatever the number of threads, see test_page().
+ */
+void bench_page(struct bench *b, struct ttf_reader *font, int num_threads)
+{
+    int width = BENCH_PAGE_WIDTH, height = BENCH_PAGE_HEIGHT;
+    struct layout layout;
+    page_layout(b, font, &layout);
+
+    printf("%dx%d page, %u lines, %u glyphs at %g px\n", width, height,
+           layout.num_runs, layout.num_glyphs, b->size);
+
+    struct image image;
+    image_alloc(&image, width, height);
+    double times[BENCH_PAGE_FRAMES];
+
+    // the first frame of each fills its caches
+    struct raster raster;
+    raster_init(&raster, b->size);
+    raster.coverage = true;
+    for (int f = -1; f < BENCH_PAGE_FRAMES; f++)
+    {
+        double start = now();
+        image_clear(&image);
+        raster_draw_layout(&raster, &image, font, 0, &layout,
+                           b->padding, b->padding);
+        if (f >= 0) times[f] = now() - start;
+    }
+    raster_destroy(&raster);
+    double glyphs = median(times, BENCH_PAGE_FRAMES);
+
+    struct tile_renderer tiles;
+    tiles_init(&tiles, width, height, num_threads);
+    for (int f = -1; f < BENCH_PAGE_FRAMES; f++)
+    {
+        double start = now();
+        image_clear(&image);
+        tiles_clear(&tiles);
+        tiles_draw_layout(&tiles, font, 0, b->size, &layout,
+                          b->padding, b->padding);
+        tiles_render(&tiles, &image);
+        if (f >= 0) times[f] = now() - start;
+    }
+    tiles_destroy(&tiles);
+    double tiled = median(times, BENCH_PAGE_FRAMES);
+
+    printf("glyphs, 1 thread:  %8.2f ms/page %10.0f glyphs/s\n",
+           1e3 * glyphs, layout.num_glyphs / glyphs);
+    printf("tiles, %d threads: %8.2f ms/page %10.0f glyphs/s, %.1fx\n",
+           num_threads, 1e3 * tiled, layout.num_glyphs / tiled,
+           glyphs / tiled);
+    printf("checksum %08x\n", crc32_update(0, image.pixels,
+                                           (size_t) width * height));
+
+    if (b->out_dir != NULL)
+    {
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/page.png", b->out_dir);
+        if (image_write(&image, path) != OK)
+            error(ERR, errno, "Failed to write %s", path);
+    }
+
+    image_free(&image);
+    layout_free(&layout);
+}
+
+/**
+ * Render the page bench_page() fills glyph by glyph, then on the tiles with
+ * every number of threads from 1 up to num_threads, BENCH_PAGE_FRAMES times
+ * each. Every frame has to come out the same bit for bit as the glyphs did.
+ * Returns whether they all did.
+ */
+bool test_page(struct bench *b, struct ttf_reader *font, int num_threads)
+{
+    int width = BENCH_PAGE_WIDTH, height = BENCH_PAGE_HEIGHT;
+    size_t size = (size_t) width * height;
+    struct layout layout;
+    page_layout(b, font, &layout);
+
+    struct image image;
+    image_alloc(&image, width, height);
+    image_clear(&image);
+    struct raster raster;
+    raster_init(&raster, b->size);
+    raster.coverage = true;
+    raster_draw_layout(&raster, &image, font, 0, &layout,
+                       b->padding, b->padding);
+    raster_destroy(&raster);
+    uint32_t expected = crc32_update(0, image.pixels, size);
+
+    bool ok = true;
+    for (int t = 1; t <= num_threads; t++)
+    {
+        struct tile_renderer tiles;
+        tiles_init(&tiles, width, height, t);
+        for (int f = 0; f < BENCH_PAGE_FRAMES; f++)
+        {
+            image_clear(&image);
+            tiles_clear(&tiles);
+            tiles_draw_layout(&tiles, font, 0, b->size, &layout,
+                              b->padding, b->padding);
+            tiles_render(&tiles, &image);
+            uint32_t checksum = crc32_update(0, image.pixels, size);
+            if (checksum != expected)
+            {
+                printf("page: %d thread%s, frame %d: checksum %08x, "
+                       "expected %08x\n", t, t == 1 ? "" : "s", f,
+                       checksum, expected);
+                ok = false;
+            }
+        }
+        tiles_destroy(&tiles);
+    }
+
+    printf("page: %u glyphs, tiles on 1 to %d threads against glyph by "
+           "glyph, %d frames each, checksum %08x: %s\n", layout.num_glyphs,
+           num_threads, BENCH_PAGE_FRAMES, expected, ok ? "ok" : "FAILED");
+    image_free(&image);
+    layout_free(&layout);
+    return ok;
+}
+
+/**
+ * Lay out the records in the first BENCH_LAYOUT_BYTES of the corpus one by
+ * one, the way the workers do, BENCH_LAYOUT_ROUNDS times with the font's
+ * kerning, as many without, and as many shaping every word again instead of
+ * taking it from the shaper's cache, taking turns. Prints the median round
+ * of each.
+ * They're decoded up front, so only the layout is timed.
+ */
+void bench_layout(struct bench *b, struct ttf_reader *font)
+{
+    uint32_t *codepoints = NULL;
+    size_t *ends = NULL; // of every record in codepoints
+    size_t n = 0, cap = 0, records = 0, records_cap = 0, bytes = 0;
+    const char *text;
+    size_t len;
+    for (size_t record = 0; bytes < BENCH_LAYOUT_BYTES
+            && get_record(b, record, &text, &len); record++)
+    {
+        if (n + len > cap)
+        {
+            cap = (n + len) * 2;
+            codepoints = realloc(codepoints, sizeof(*codepoints) * cap);
+        }
+        size_t decoded;
+        if (utf8_decode(text, len, codepoints + n, &decoded, NULL) != OK)
+            continue;
+        if (records == records_cap)
+        {
+            records_cap = records_cap ? records_cap * 2 : 1024;
+            ends = realloc(ends, sizeof(*ends) * records_cap);
+        }
+        n += decoded;
+        ends[records++] = n;
+        bytes += len;
+    }
+
+    float max_width = b->width - 2 * b->padding;
+    printf("%zu records, %zu codepoints at %g px in %g px lines\n",
+           records, n, b->size, max_width);
+
+    struct ttf_kerning *kerning = font->kerning;
+    if (kerning == NULL)
+        printf("the font has no kerning, every round is without\n");
+    if (font->shaper == NULL)
+        printf("the font has no GSUB, there's nothing to shape\n");
+
+    static const struct
+    {
+        const char *name;
+        bool kerning;
+        bool shape_cache;
+    } rounds[] =
+    {
+        { "kerning on", true, true },
+        { "kerning off", false, true },
+        { "no shape cache", true, false },
+    };
+    int num_rounds = font->shaper ? 3 : 2;
+    double times[3][BENCH_LAYOUT_ROUNDS];
+    uint64_t glyphs[3];
+
+    // one of each in turn, so whatever else the machine is up to falls on
+    // them alike. The first turn fills the shaper's cache, there's none to
+    // fill without it
+    for (int r = -1; r < BENCH_LAYOUT_ROUNDS; r++)
+        for (int k = 0; k < num_rounds; k++)
+        {
+            if (r < 0 && !rounds[k].shape_cache) continue;
+            font->kerning = rounds[k].kerning ? kerning : NULL;
+            if (font->shaper) font->shaper->uncached = !rounds[k].shape_cache;
+
+            double start = now();
+            glyphs[k] = 0;
+            for (size_t i = 0, first = 0; i < records; first = ends[i++])
+            {
+                struct layout layout;
+                layout_codepoints(font, codepoints + first, ends[i] - first,
+                                  b->size, max_width, &layout);
+                glyphs[k] += layout.num_glyphs;
+                layout_free(&layout);
+            }
+            if (r >= 0) times[k][r] = now() - start;
+        }
+
+    for (int k = 0; k < num_rounds; k++)
+    {
+        double seconds = median(times[k], BENCH_LAYOUT_ROUNDS);
+        printf("%-15s %8.2f ms %10.0f glyphs/s\n", rounds[k].name,
+               1e3 * seconds, glyphs[k] / seconds);
+    }
+
+    font->kerning = kerning;
+    if (font->shaper) font->shaper->uncached = false;
+    free(codepoints);
+    free(ends);
+}
+
+/**
+ * The records measure_text() is held to: each on its own, then every
+ * BENCH_MEASURE_LINES in a row as one text, the newlines between them
+ * included. Returns how many there are, up to about BENCH_LAYOUT_BYTES of
+ * them.
+ */
+static size_t measure_texts(struct bench *b, const char ***texts,
+                            size_t **lens)
+{
+    size_t n = 0, cap = 0, bytes = 0;
+    *texts = NULL;
+    *lens = NULL;
+    const char *text, *first = NULL;
+    size_t len;
+    for (size_t record = 0; bytes < BENCH_LAYOUT_BYTES
+            && get_record(b, record, &text, &len); record++)
+    {
+        if (n + 2 > cap)
+        {
+            cap = cap ? cap * 2 : 1024;
+            *texts = realloc(*texts, sizeof(**texts) * cap);
+            *lens = realloc(*lens, sizeof(**lens) * cap);
+        }
+        (*texts)[n] = text;
+        (*lens)[n++] = len;
+        bytes += len;
+
+        // records are one after the other in the corpus
+        if (record % BENCH_MEASURE_LINES == 0) first = text;
+        if (record % BENCH_MEASURE_LINES == BENCH_MEASURE_LINES - 1)
+        {
+            (*texts)[n] = first;
+            (*lens)[n++] = text + len - first;
+        }
+    }
+    return n;
+}
+
+/**
+ * What measure_text() should come out with for a layout of the same text
+ * at size, with no wrapping.
+ */
+static void measure_layout(struct ttf_reader *font, struct layout *layout,
+                           float size, struct measure *out)
+{
+    float scale = size / font->units_per_em;
+    memset(out, 0, sizeof(*out));
+    out->width = layout->width;
+    out->lines = layout->num_runs;
+
+    // the layout's y is from the top, the measure's from the first baseline
+    float top = font->ascender * scale;
+    bool any = false;
+    for (uint32_t i = 0; i < layout->num_glyphs; i++)
+    {
+        struct layout_glyph *g = &layout->glyphs[i];
+        bbox_t bbox;
+        if (!ttf_glyph_bbox(font, g->glyph, &bbox)) continue;
+
+        float x_min = g->x + bbox.x_min * scale;
+        float x_max = g->x + bbox.x_max * scale;
+        float y_min = g->y + top + bbox.y_min * scale;
+        float y_max = g->y + top + bbox.y_max * scale;
+        if (!any || x_min < out->ink_x_min) out->ink_x_min = x_min;
+        if (!any || y_min < out->ink_y_min) out->ink_y_min = y_min;
+        if (!any || x_max > out->ink_x_max) out->ink_x_max = x_max;
+        if (!any || y_max > out->ink_y_max) out->ink_y_max = y_max;
+        any = true;
+    }
+}
+
+/**
+ * Measure every text measure_texts() picks with the ink box, with the
+ * font's kerning and without, and lay each out unwrapped to compare. The
+ * shaper is left out of the layouts, since measure_text() doesn't shape.
+ * Returns whether every width, line count and ink box agreed to within
+ * BENCH_MEASURE_SLACK pixels.
+ */
+bool test_measure(struct bench *b, struct ttf_reader *font)
+{
+    const char **texts;
+    size_t *lens;
+    size_t n = measure_texts(b, &texts, &lens);
+
+    struct ttf_kerning *kerning = font->kerning;
+    struct ttf_shaper *shaper = font->shaper;
+    font->shaper = NULL;
+
+    size_t failed = 0;
+    float worst = 0;
+    for (int k = kerning ? 0 : 1; k < 2; k++)
+    {
+        font->kerning = k == 0 ? kerning : NULL;
+        for (size_t i = 0; i < n; i++)
+        {
+            struct measure measured, expected;
+            struct layout layout;
+            if (measure_text(font, texts[i], lens[i], b->size, true,
+                             &measured) != OK)
+                continue;
+            if (layout_paragraph(font, texts[i], lens[i], b->size, 0,
+                                 &layout) != OK)
+            {
+                printf("measure: text %zu measures, but won't lay out\n", i);
+                failed++;
+                continue;
+            }
+            measure_layout(font, &layout, b->size, &expected);
+            layout_free(&layout);
+
+            float off[] =
+            {
+                measured.width - expected.width,
+                measured.ink_x_min - expected.ink_x_min,
+                measured.ink_y_min - expected.ink_y_min,
+                measured.ink_x_max - expected.ink_x_max,
+                measured.ink_y_max - expected.ink_y_max,
+            };
+            float most = 0;
+            for (size_t j = 0; j < sizeof(off) / sizeof(*off); j++)
+                if (fabsf(off[j]) > most) most = fabsf(off[j]);
+            if (most > worst) worst = most;
+
+            if (measured.lines != expected.lines
+                    || most > BENCH_MEASURE_SLACK)
+            {
+                if (failed++ < 10)
+                    printf("measure: text %zu, kerning %s: %" PRIu32
+                           " lines %g wide, ink %g,%g to %g,%g, laid out "
+                           "%" PRIu32 " lines %g wide, ink %g,%g to %g,%g\n",
+                           i, k == 0 ? "on" : "off", measured.lines,
+                           measured.width, measured.ink_x_min,
+                           measured.ink_y_min, measured.ink_x_max,
+                           measured.ink_y_max, expected.lines,
+                           expected.width, expected.ink_x_min,
+                           expected.ink_y_min, expected.ink_x_max,
+                           expected.ink_y_max);
+            }
+        }
+    }
+
+    font->kerning = kerning;
+    font->shaper = shaper;
+    printf("measure: %zu texts at %g px against their layouts, kerning %s, "
+           "%zu off, at most by %g px: %s\n", n, b->size,
+           kerning ? "on and off" : "off", failed, worst,
+           failed ? "FAILED" : "ok");
+    free(texts);
+    free(lens);
+    return failed == 0;
+}
+
+/**
+ * Time measure_text() on the texts test_measure() checks, without the ink
+ * box and with it, and laying the same texts out unwrapped, which is what
+ * it saves callers that only want the size. One of each in turn, like
+ * bench_layout().
+ */
+void bench_measure(struct bench *b, struct ttf_reader *font)
+{
+    const char **texts;
+    size_t *lens;
+    size_t n = measure_texts(b, &texts, &lens);
+    size_t bytes = 0;
+    for (size_t i = 0; i < n; i++)
+        bytes += lens[i];
+    printf("%zu texts, %zu bytes at %g px, kerning %s\n", n, bytes, b->size,
+           font->kerning ? "on" : "off");
+
+    static const char *names[] = { "measure", "measure + ink", "layout" };
+    double times[3][BENCH_LAYOUT_ROUNDS];
+    for (int r = -1; r < BENCH_LAYOUT_ROUNDS; r++)
+        for (int k = 0; k < 3; k++)
+        {
+            double start = now();
+            for (size_t i = 0; i < n; i++)
+            {
+                if (k < 2)
+                {
+                    struct measure measure;
+                    measure_text(font, texts[i], lens[i], b->size, k == 1,
+                                 &measure);
+                }
+                else
+                {
+                    struct layout layout;
+                    if (layout_paragraph(font, texts[i], lens[i], b->size,
+                                         0, &layout) == OK)
+                        layout_free(&layout);
+                }
+            }
+            if (r >= 0) times[k][r] = now() - start;
+        }
+
+    for (int k = 0; k < 3; k++)
+    {
+        double seconds = median(times[k], BENCH_LAYOUT_ROUNDS);
+        printf("%-15s %8.2f ms %8.1f MB/s\n", names[k], 1e3 * seconds,
+               bytes / seconds / 1e6);
+    }
+    free(texts);
+    free(lens);
+}
+
+shortmap_t shortmap_create(uint16_t initial_cap)
+{
+    shortmap_t map;
+    map.cap = initial_cap;
+    map.len = 0;
+    map.buckets = calloc(initial_cap, sizeof(struct shortmap_bucket));
+    return map;
+}
+
+void *shortmap_get(shortmap_t *map, uint16_t key)
+{
+    uint16_t hash = key;
+    for (int i = 0; i < map->cap; i++)
+    {
+        hash &= map->cap - 1;
+        if (map->buckets[hash].value == NULL)
+            return NULL;
+        if (map->buckets[hash].key == key)
+            return map->buckets[hash].value;
+        hash += 1;
+    }
+    return NULL;
+}
+
+void *shortmap_insert(shortmap_t *map, uint16_t key, void *value)
+{
+    // resize and rehash when we reach 75% of capacity
+    if (map->len > (map->cap + map->cap / 2) / 2)
+    {
+        struct shortmap_bucket *old_buckets = map->buckets;
+        uint16_t old_cap = map->cap;
+        map->cap *= 2;
+        map->len = 0;
+        map->buckets = calloc(map->cap, sizeof(struct shortmap_bucket));
+        for (int i = 0; i < old_cap; i++)
+            if (old_buckets[i].value)
+                shortmap_insert(map, old_buckets[i].key, old_buckets[i].value);
+        free(old_buckets);
+    }
+
+    map->len++;
+
+    // round robin
+    uint16_t hash = key;
+    for (;;)
+    {
+        hash &= map->cap - 1;
+        if (map->buckets[hash].value == NULL)
+        {
+            map->buckets[hash].key = key;
+            map->buckets[hash].value = value;
+            return &map->buckets[hash];
+        }
+        hash += 1;
+    }
+}
+
+/**
+ * Nanoseconds per insert, hit and miss on hashmap_t and shortmap, with n
+ * glyph ids from 0 up as keys, inserted and looked up in a random order,
+ * and the next n ids for misses. Inserts start from an empty map of 16
+ * buckets, so they include growing it. Each is repeated until it's done
+ * at least BENCH_MAP_OPS operations.
+ */
+void bench_maps(void)
+{
+    static const uint32_t sizes[] = { 100, 10000, 65000 };
+    static const char *names[] = { "hashmap", "shortmap" };
+    printf("ns per op, random order: insert / hit / miss\n");
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(*sizes); s++)
+    {
+        uint32_t n = sizes[s];
+        uint32_t *keys = malloc(sizeof(*keys) * n);
+        for (uint32_t i = 0; i < n; i++)
+            keys[i] = i;
+        uint64_t seed = 0x9e3779b97f4a7c15;
+        for (uint32_t i = n - 1; i > 0; i--)
+        {
+            // xorshift, nothing fancy needed
+            seed ^= seed << 13;
+            seed ^= seed >> 7;
+            seed ^= seed << 17;
+            uint32_t j = seed % (i + 1), k = keys[i];
+            keys[i] = keys[j];
+            keys[j] = k;
+        }
+
+        int rounds = (BENCH_MAP_OPS + n - 1) / n;
+        printf("%6" PRIu32 " entries:", n);
+        for (int m = 0; m < 2; m++)
+        {
+            if (m == 1 && n > SHORTMAP_MAX)
+            {
+                printf("   %s can't hold that many", names[m]);
+                continue;
+            }
+
+            hashmap_t hashmap = { 0 };
+            shortmap_t shortmap = { 0 };
+            double start = now();
+            for (int r = 0; r < rounds; r++)
+            {
+                if (m == 0)
+                {
+                    hashmap_destroy(&hashmap);
+                    hashmap = hashmap_create(16);
+                    for (uint32_t i = 0; i < n; i++)
+                        hashmap_insert(&hashmap, keys[i], &keys[i]);
+                }
+                else
+                {
+                    free(shortmap.buckets);
+                    shortmap = shortmap_create(16);
+                    for (uint32_t i = 0; i < n; i++)
+                        shortmap_insert(&shortmap, keys[i], &keys[i]);
+                }
+            }
+            double insert = now() - start;
+
+            // counted, so the lookups can't be left out
+            uint64_t found = 0;
+            start = now();
+            for (int r = 0; r < rounds; r++)
+                for (uint32_t i = 0; i < n; i++)
+                    found += (m == 0 ? hashmap_get(&hashmap, keys[i])
+                                     : shortmap_get(&shortmap, keys[i]))
+                             != NULL;
+            double hit = now() - start;
+
+            start = now();
+            for (int r = 0; r < rounds; r++)
+                for (uint32_t i = 0; i < n; i++)
+                    found += (m == 0 ? hashmap_get(&hashmap, n + keys[i])
+                                     : shortmap_get(&shortmap, n + keys[i]))
+                             != NULL;
+            double miss = now() - start;
+            if (found != (uint64_t) rounds * n)
+                error(ERR, 0, "%s found %" PRIu64 " of %" PRIu64 " keys",
+                      names[m], found, (uint64_t) rounds * n);
+
+            double ops = (double) rounds * n;
+            printf("   %s %6.1f / %5.1f / %5.1f", names[m],
+                   1e9 * insert / ops, 1e9 * hit / ops, 1e9 * miss / ops);
+            hashmap_destroy(&hashmap);
+            free(shortmap.buckets);
+        }
+        printf("\n");
+        free(keys);
+    }
+}
+
+// -T's threads, each given one of these
+struct concmap_test
+{
+    concmap_t *map;
+    uint64_t *values[2]; // what writers and duplicates insert, per key
+    uint32_t num_keys;
+    int role; // 0 writes its share, 1 inserts every key again, 2 reads
+    int index, count; // among the threads with the same role
+    _Atomic int *writing; // threads still inserting
+    void **returned; // by concmap_insert(), per key, for inserters
+    uint64_t seen; // keys readers found
+    bool failed;
+};
+
+static bool valid_value(struct concmap_test *t, uint64_t key, void *value)
+{
+    return value == &t->values[0][key] || value == &t->values[1][key];
+}
+
+static void *concmap_test_thread(void *arg)
+{
+    struct concmap_test *t = arg;
+    if (t->role == 2)
+    {
+        // keep reading until the inserts are done, and once more after
+        uint64_t seed = 0x9e3779b97f4a7c15 + t->index;
+        bool last = false;
+        while (!last)
+        {
+            last = atomic_load(t->writing) == 0;
+            for (uint32_t i = 0; i < t->num_keys; i++)
+            {
+                seed ^= seed << 13;
+                seed ^= seed >> 7;
+                seed ^= seed << 17;
+                uint64_t key = seed % t->num_keys;
+                void *value = concmap_get(t->map, key);
+                if (value == NULL)
+                {
+                    // every key has been inserted by now
+                    t->failed |= last;
+                    continue;
+                }
+                t->seen++;
+                // a value never changes once it's there
+                t->failed |= !valid_value(t, key, value)
+                          || concmap_get(t->map, key) != value;
+            }
+        }
+        return NULL;
+    }
+
+    uint32_t first = 0, end = t->num_keys;
+    if (t->role == 0)
+    {
+        first = (uint64_t) t->num_keys * t->index / t->count;
+        end = (uint64_t) t->num_keys * (t->index + 1) / t->count;
+    }
+    for (uint32_t i = first; i < end; i++)
+    {
+        // duplicates go through the keys in a different order each
+        uint32_t key = t->role == 0 ? i
+            : ((uint64_t) i * 2654435761u + t->index) % t->num_keys;
+        t->returned[key] = concmap_insert(t->map, key,
+                                          &t->values[t->role][key]);
+    }
+    atomic_fetch_sub(t->writing, 1);
+    return NULL;
+}
+
+static void count_entry(void *ctx, uint64_t key, void *value)
+{
+    (*(uint32_t *) ctx)++;
+}
+
+/**
+ * Race two threads inserting half the keys each, two more inserting all of
+ * them again, and four looking them up, on a map that starts out with 8
+ * slots and grows all the way to BENCH_TEST_KEYS, BENCH_TEST_ROUNDS times.
+ * Readers check that what they find belongs to the key and stays put.
+ * Afterwards every key has to be there exactly once, with the value every
+ * insert of it returned. Returns whether it all held up.
+ */
+bool test_concmap(void)
+{
+    enum { WRITERS = 2, DUPLICATES = 2, READERS = 4 };
+    const int num_threads = WRITERS + DUPLICATES + READERS;
+    const uint32_t num_keys = BENCH_TEST_KEYS;
+    uint64_t *values[2] =
+    {
+        malloc(sizeof(uint64_t) * num_keys),
+        malloc(sizeof(uint64_t) * num_keys),
+    };
+    void **returned[WRITERS + DUPLICATES];
+    for (int i = 0; i < WRITERS + DUPLICATES; i++)
+        returned[i] = malloc(sizeof(void *) * num_keys);
+
+    bool ok = true;
+    uint64_t seen = 0;
+    double start = now();
+    for (int round = 0; round < BENCH_TEST_ROUNDS && ok; round++)
+    {
+        concmap_t map;
+        concmap_init(&map, 8);
+        _Atomic int writing = WRITERS + DUPLICATES;
+        struct concmap_test tests[num_threads];
+        pthread_t threads[num_threads];
+        for (int i = 0; i < num_threads; i++)
+        {
+            int role = i < WRITERS ? 0 : i < WRITERS + DUPLICATES ? 1 : 2;
+            static const int counts[] = { WRITERS, DUPLICATES, READERS };
+            static const int firsts[] = { 0, WRITERS, WRITERS + DUPLICATES };
+            tests[i] = (struct concmap_test)
+            {
+                .map = &map,
+                .values = { values[0], values[1] },
+                .num_keys = num_keys,
+                .role = role,
+                .index = i - firsts[role],
+                .count = counts[role],
+                .writing = &writing,
+                .returned = role < 2 ? returned[i] : NULL,
+            };
+            pthread_create(&threads[i], NULL, concmap_test_thread, &tests[i]);
+        }
+        for (int i = 0; i < num_threads; i++)
+        {
+            pthread_join(threads[i], NULL);
+            ok &= !tests[i].failed;
+            seen += tests[i].seen;
+        }
+
+        uint32_t found = 0;
+        for (uint32_t key = 0; key < num_keys; key++)
+        {
+            void *value = concmap_get(&map, key);
+            found += value != NULL;
+            ok &= valid_value(&tests[0], key, value);
+            // the writer whose share it's in, and every duplicate
+            int writer = (uint64_t) key * WRITERS / num_keys;
+            while ((uint64_t) num_keys * (writer + 1) / WRITERS <= key)
+                writer++;
+            ok &= returned[writer][key] == value;
+            for (int i = WRITERS; i < WRITERS + DUPLICATES; i++)
+                ok &= returned[i][key] == value;
+        }
+        uint32_t counted = 0;
+        concmap_for_each(&map, count_entry, &counted);
+        ok &= found == num_keys && counted == num_keys;
+        concmap_destroy(&map);
+    }
+
+    printf("concmap: %d rounds of %u keys, %d writers, %d duplicates, "
+           "%d readers, %" PRIu64 " lookups found, %.2f s: %s\n",
+           BENCH_TEST_ROUNDS, num_keys, WRITERS, DUPLICATES, READERS,
+           seen, now() - start, ok ? "ok" : "FAILED");
+    free(values[0]);
+    free(values[1]);
+    for (int i = 0; i < WRITERS + DUPLICATES; i++)
+        free(returned[i]);
+    return ok;
+}
+
+struct concmap_reader
+{
+    concmap_t *map;
+    pthread_t thread;
+    _Atomic int *waiting; // for everyone to be ready
+    uint64_t seed;
+    uint64_t found;
+};
+
+static void *concmap_read(void *arg)
+{
+    struct concmap_reader *r = arg;
+    atomic_fetch_sub(r->waiting, 1);
+    while (atomic_load(r->waiting) > 0) sched_yield();
+
+    uint64_t seed = r->seed;
+    for (int i = 0; i < BENCH_READ_LOOKUPS; i++)
+    {
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        r->found += concmap_get(r->map, seed % BENCH_READ_KEYS) != NULL;
+    }
+    return NULL;
+}
+
+/**
+ * Lookups per second on a concmap of BENCH_READ_KEYS entries from 1 up to
+ * max_readers threads at once, each doing BENCH_READ_LOOKUPS of random keys.
+ * With nobody inserting, the readers share nothing but the table's cache
+ * lines, so the total should go up with every reader until the cores run
+ * out.
+ */
+void bench_concmap(int max_readers)
+{
+    concmap_t map;
+    concmap_init(&map, BENCH_READ_KEYS);
+    static uint8_t value;
+    for (uint64_t key = 0; key < BENCH_READ_KEYS; key++)
+        concmap_insert(&map, key, &value);
+
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    printf("concmap: %d entries, %d lookups per reader, %ld core%s\n",
+           BENCH_READ_KEYS, BENCH_READ_LOOKUPS, cores, cores == 1 ? "" : "s");
+    struct concmap_reader *readers = calloc(max_readers, sizeof(*readers));
+    double single = 0;
+    for (int n = 1; n <= max_readers; n++)
+    {
+        _Atomic int waiting = n + 1;
+        for (int i = 0; i < n; i++)
+        {
+            readers[i] = (struct concmap_reader)
+            {
+                .map = &map,
+                .waiting = &waiting,
+                .seed = 0x9e3779b97f4a7c15 * (i + 1),
+            };
+            pthread_create(&readers[i].thread, NULL, concmap_read,
+                           &readers[i]);
+        }
+        while (atomic_load(&waiting) > 1) sched_yield();
+        double start = now();
+        atomic_fetch_sub(&waiting, 1);
+
+        uint64_t found = 0;
+        for (int i = 0; i < n; i++)
+        {
+            pthread_join(readers[i].thread, NULL);
+            found += readers[i].found;
+        }
+        double seconds = now() - start;
+        if (found != (uint64_t) n * BENCH_READ_LOOKUPS)
+            error(ERR, 0, "concmap lost entries");
+
+        double rate = found / seconds;
+        if (n == 1) single = rate;
+        printf("%3d reader%s %8.1f M lookups/s, %5.2fx one reader\n", n,
+               n == 1 ? ": " : "s:", rate / 1e6, rate / single);
+    }
+
+    free(readers);
+    concmap_destroy(&map);
+}
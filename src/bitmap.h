@@ -0,0 +1,32 @@
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifndef BITMAP_H
+#define BITMAP_H
+
+// An 8-bit coverage bitmap. Rows are stored bottom to top like GL textures,
+// and left/bottom place the bitmap's lower left corner relative to the pen
+// position, in whole pixels.
+struct bitmap
+{
+    int width;
+    int height;
+    int left;
+    int bottom;
+    uint8_t *pixels;
+};
+
+static inline void bitmap_alloc(struct bitmap *bitmap, int width, int height)
+{
+    bitmap->width = width;
+    bitmap->height = height;
+    bitmap->pixels = calloc((size_t) width * height, 1);
+}
+
+static inline void bitmap_free(struct bitmap *bitmap)
+{
+    free(bitmap->pixels);
+    bitmap->pixels = NULL;
+}
+
+#endif // BITMAP_H
@@ -0,0 +1,212 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include "concmap.h"
+#include "hashmap.h"
+
+#define EMPTY UINT64_MAX
+#define FROZEN (UINT64_MAX - 1)
+
+static struct concmap_table *table_create(uint32_t cap)
+{
+    struct concmap_table *table =
+        malloc(sizeof(*table) + sizeof(struct concmap_slot) * cap);
+    table->cap = cap;
+    atomic_init(&table->len, 0);
+    atomic_init(&table->next, NULL);
+    atomic_init(&table->migrated, false);
+    for (uint32_t i = 0; i < cap; i++)
+    {
+        atomic_init(&table->slots[i].key, EMPTY);
+        atomic_init(&table->slots[i].value, NULL);
+    }
+    return table;
+}
+
+static uint32_t home(struct concmap_table *table, uint64_t key)
+{
+    return hashmap_hash(key) >> (64 - __builtin_ctz(table->cap));
+}
+
+void concmap_init(concmap_t *map, uint32_t cap)
+{
+    uint32_t c = 8;
+    while (c < cap && c < 0x80000000)
+        c *= 2;
+    map->first = table_create(c);
+    atomic_init(&map->table, map->first);
+}
+
+void concmap_destroy(concmap_t *map)
+{
+    struct concmap_table *table = map->first;
+    while (table)
+    {
+        struct concmap_table *next = atomic_load(&table->next);
+        free(table);
+        table = next;
+    }
+    map->first = NULL;
+    atomic_store(&map->table, NULL);
+}
+
+void *concmap_get(concmap_t *map, uint64_t key)
+{
+    struct concmap_table *table =
+        atomic_load_explicit(&map->table, memory_order_acquire);
+
+    while (table)
+    {
+        uint32_t mask = table->cap - 1;
+        uint32_t i = home(table, key);
+        uint64_t k = EMPTY;
+        for (uint32_t n = 0; n < table->cap; n++, i = (i + 1) & mask)
+        {
+            struct concmap_slot *slot = &table->slots[i];
+            k = atomic_load_explicit(&slot->key, memory_order_acquire);
+            if (k == key)
+                // may still be NULL if the inserter hasn't stored it yet
+                return atomic_load_explicit(&slot->value,
+                                            memory_order_acquire);
+            if (k == EMPTY) return NULL;
+            if (k == FROZEN) break;
+        }
+
+        // frozen or full, either way the rest is in the next table
+        table = atomic_load_explicit(&table->next, memory_order_acquire);
+    }
+
+    return NULL;
+}
+
+static void *await_value(struct concmap_slot *slot)
+{
+    void *value;
+    while ((value = atomic_load_explicit(&slot->value,
+                                         memory_order_acquire)) == NULL)
+        sched_yield();
+    return value;
+}
+
+static void *table_insert(concmap_t *, struct concmap_table *,
+                          uint64_t, void *);
+
+static void advance_head(concmap_t *map)
+{
+    struct concmap_table *head = atomic_load(&map->table);
+    while (atomic_load(&head->migrated))
+    {
+        struct concmap_table *next = atomic_load(&head->next);
+        if (atomic_compare_exchange_weak(&map->table, &head, next))
+            head = next;
+    }
+}
+
+static void migrate(concmap_t *map, struct concmap_table *table)
+{
+    struct concmap_table *next = atomic_load(&table->next);
+
+    for (uint32_t i = 0; i < table->cap; i++)
+    {
+        struct concmap_slot *slot = &table->slots[i];
+        uint64_t k = EMPTY;
+        if (atomic_compare_exchange_strong(&slot->key, &k, FROZEN))
+            continue;
+
+        // somebody claimed it first, copy it over once they're done
+        table_insert(map, next, k, await_value(slot));
+    }
+
+    atomic_store(&table->migrated, true);
+    advance_head(map);
+}
+
+static void grow(concmap_t *map, struct concmap_table *table)
+{
+    if (atomic_load(&table->next) != NULL) return;
+
+    struct concmap_table *next = table_create(table->cap * 2), *expected = NULL;
+    if (!atomic_compare_exchange_strong(&table->next, &expected, next))
+    {
+        // somebody else beat us to it
+        free(next);
+        return;
+    }
+
+    migrate(map, table);
+}
+
+static void *table_insert(concmap_t *map, struct concmap_table *table,
+                          uint64_t key, void *value)
+{
+    for (;;)
+    {
+        uint32_t mask = table->cap - 1;
+        uint32_t i = home(table, key);
+        for (uint32_t n = 0; n < table->cap; n++, i = (i + 1) & mask)
+        {
+            struct concmap_slot *slot = &table->slots[i];
+            uint64_t k = atomic_load_explicit(&slot->key, memory_order_acquire);
+
+            if (k == EMPTY)
+            {
+                if (!atomic_compare_exchange_strong(&slot->key, &k, key))
+                {
+                    // lost the race, look at whatever got there first
+                    if (k == FROZEN) break;
+                    if (k != key) continue;
+                    return await_value(slot);
+                }
+
+                atomic_store_explicit(&slot->value, value,
+                                      memory_order_release);
+
+                uint32_t len = atomic_fetch_add(&table->len, 1) + 1;
+                if ((uint64_t) len * 4 >= (uint64_t) table->cap * 3)
+                    grow(map, table);
+                return value;
+            }
+
+            if (k == key) return await_value(slot);
+            if (k == FROZEN) break;
+        }
+
+        // the table is full or being moved, wait for its successor to exist
+        grow(map, table);
+        table = atomic_load_explicit(&table->next, memory_order_acquire);
+    }
+}
+
+/**
+ * Insert key unless it's already there. Returns the value that ended up in
+ * the map, so whoever loses an insert race gets the winner's value back and
+ * can throw its own away.
+ */
+void *concmap_insert(concmap_t *map, uint64_t key, void *value)
+{
+    struct concmap_table *table =
+        atomic_load_explicit(&map->table, memory_order_acquire);
+    return table_insert(map, table, key, value);
+}
+
+/**
+ * Call fn with every key and value. Only safe once nobody is inserting any
+ * more, it's meant for freeing the values before concmap_destroy().
+ */
+void concmap_for_each(concmap_t *map,
+                      void (*fn)(void *ctx, uint64_t key, void *value),
+                      void *ctx)
+{
+    // everything in a table that grew was copied on to the next one
+    struct concmap_table *table = atomic_load(&map->table), *next;
+    while ((next = atomic_load(&table->next)) != NULL)
+        table = next;
+
+    for (uint32_t i = 0; i < table->cap; i++)
+    {
+        uint64_t key = atomic_load(&table->slots[i].key);
+        void *value = atomic_load(&table->slots[i].value);
+        if (key != EMPTY && key != FROZEN && value != NULL)
+            fn(ctx, key, value);
+    }
+}
@@ -0,0 +1,50 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#ifndef CONCMAP_H
+#define CONCMAP_H
+
+// An insert-only hashmap that many threads can use at once. Lookups never
+// lock or wait: they walk a fixed-size table and, while it is being grown,
+// follow a link into the next one. Inserts claim an empty slot with a CAS.
+// When a table fills up, one inserter allocates a bigger one and copies
+// everything over, freezing the empty slots it passes so that nobody can
+// claim them behind its back. Old tables are not freed until
+// concmap_destroy(), which is what lets readers go without any kind of
+// epoch or hazard bookkeeping. Since each table is twice the size of the
+// last, that costs at most as much memory as the live table itself.
+//
+// UINT64_MAX and UINT64_MAX - 1 can't be used as keys, and values can't be
+// NULL.
+
+struct concmap_slot
+{
+    _Atomic uint64_t key;
+    _Atomic(void *) value;
+};
+
+struct concmap_table
+{
+    uint32_t cap;
+    _Atomic uint32_t len;
+    _Atomic(struct concmap_table *) next;
+    atomic_bool migrated;
+    struct concmap_slot slots[];
+};
+
+typedef struct
+{
+    _Atomic(struct concmap_table *) table;
+    struct concmap_table *first;
+} concmap_t;
+
+void concmap_init(concmap_t *, uint32_t cap);
+void concmap_destroy(concmap_t *);
+void *concmap_get(concmap_t *, uint64_t key);
+void *concmap_insert(concmap_t *, uint64_t key, void *value);
+void concmap_for_each(concmap_t *,
+                      void (*fn)(void *ctx, uint64_t key, void *value),
+                      void *ctx);
+
+#endif // CONCMAP_H
@@ -0,0 +1,313 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "coverage.h"
+
+typedef struct
+{
+    float x, y;
+} vec2;
+
+static vec2 lerp(vec2 a, vec2 b, float t)
+{
+    return (vec2) { a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t };
+}
+
+/**
+ * Add the area a line covers to every pixel it passes through. Pixels to
+ * the right of it get the rest of the row's height in the next cell over,
+ * which the running sum carries on across the row. At the end of a row
+ * that's one of the spare cells past it, see struct coverage_accumulator.
+ */
+void coverage_draw_line(struct coverage_accumulator *acc,
+                        float x0, float y0, float x1, float y1)
+{
+    vec2 p0 = { x0, y0 }, p1 = { x1, y1 };
+    if (p0.y == p1.y) return;
+
+    float dir = 1;
+    if (p0.y > p1.y)
+    {
+        vec2 t = p0;
+        p0 = p1;
+        p1 = t;
+        dir = -1;
+    }
+
+    float dxdy = (p1.x - p0.x) / (p1.y - p0.y);
+    float x = p0.x;
+    // stepping a line that's nearly flat can overshoot its end by a hair,
+    // which is a whole cell outside the row at its edges
+    float x_min = fminf(p0.x, p1.x), x_max = fmaxf(p0.x, p1.x);
+    int y_end = ceilf(p1.y) < acc->height ? ceilf(p1.y) : acc->height;
+    for (int y = p0.y; y < y_end; y++)
+    {
+        float *row = acc->cells + (size_t) y * acc->stride;
+        float dy = fminf(y + 1, p1.y) - fmaxf(y, p0.y);
+        float x_next = x + dxdy * dy;
+        x_next = x_next < x_min ? x_min : x_next > x_max ? x_max : x_next;
+        float d = dy * dir;
+
+        x0 = fminf(x, x_next);
+        x1 = fmaxf(x, x_next);
+        float x0_floor = floorf(x0), x1_ceil = ceilf(x1);
+        int x0i = x0_floor, x1i = x1_ceil;
+
+        if (x1i <= x0i + 1)
+        {
+            // within one pixel, it covers up to where it crosses the middle
+            float mid = 0.5 * (x + x_next) - x0_floor;
+            row[x0i] += d - d * mid;
+            row[x0i + 1] += d * mid;
+        }
+        else
+        {
+            // across several, a triangle in the first and last pixels and
+            // an even strip in between
+            float s = 1 / (x1 - x0);
+            float x0f = x0 - x0_floor;
+            float a0 = 0.5 * s * (1 - x0f) * (1 - x0f);
+            float x1f = x1 - x1_ceil + 1;
+            float am = 0.5 * s * x1f * x1f;
+
+            row[x0i] += d * a0;
+            if (x1i == x0i + 2)
+            {
+                row[x0i + 1] += d * (1 - a0 - am);
+            }
+            else
+            {
+                float a1 = s * (1.5 - x0f);
+                row[x0i + 1] += d * (a1 - a0);
+                for (int xi = x0i + 2; xi < x1i - 1; xi++)
+                    row[xi] += d * s;
+                float a2 = a1 + (x1i - x0i - 3) * s;
+                row[x1i - 1] += d * (1 - a2 - am);
+            }
+            row[x1i] += d * am;
+        }
+
+        x = x_next;
+    }
+}
+
+/**
+ * Flatten a quadratic into few enough lines that none of them is more
+ * than about a tenth of a pixel from the curve.
+ */
+struct flattener
+{
+    coverage_line_fn line;
+    void *ctx;
+};
+
+static void emit(struct flattener *f, vec2 a, vec2 b)
+{
+    f->line(f->ctx, a.x, a.y, b.x, b.y);
+}
+
+static void draw_quad(struct flattener *f, vec2 p0, vec2 p1, vec2 p2)
+{
+    float dev_x = p0.x - 2 * p1.x + p2.x;
+    float dev_y = p0.y - 2 * p1.y + p2.y;
+    float dev_sq = dev_x * dev_x + dev_y * dev_y;
+    if (dev_sq < 0.333f)
+    {
+        emit(f, p0, p2);
+        return;
+    }
+
+    int n = 1 + floorf(sqrtf(sqrtf(3 * dev_sq)));
+    vec2 p = p0;
+    for (int i = 1; i < n; i++)
+    {
+        float t = (float) i / n;
+        vec2 next = lerp(lerp(p0, p1, t), lerp(p1, p2, t), t);
+        emit(f, p, next);
+        p = next;
+    }
+    emit(f, p, p2);
+}
+
+/**
+ * Walk one contour, making up the on curve points TrueType leaves out
+ * between two off curve ones.
+ */
+static void draw_contour(struct flattener *f, const vec2 *points,
+                         const char *on_curve, int n)
+{
+    if (n < 2) return;
+
+    // start from a point on the curve, or between the first two if none are
+    int first = 0;
+    while (first < n && !on_curve[first]) first++;
+    vec2 start = first < n ? points[first]
+                           : lerp(points[0], points[1], 0.5);
+    if (first == n) first = 0;
+
+    vec2 pen = start, control = { 0, 0 };
+    bool pending = false; // whether control is waiting for its end point
+    for (int k = 1; k <= n; k++)
+    {
+        int i = (first + k) % n;
+        vec2 p = k == n ? start : points[i];
+        bool on = k == n || on_curve[i];
+
+        if (on)
+        {
+            if (pending) draw_quad(f, pen, control, p);
+            else emit(f, pen, p);
+            pen = p;
+            pending = false;
+        }
+        else if (pending)
+        {
+            vec2 mid = lerp(control, p, 0.5);
+            draw_quad(f, pen, control, mid);
+            pen = mid;
+            control = p;
+        }
+        else
+        {
+            control = p;
+            pending = true;
+        }
+    }
+}
+
+/**
+ * The running sum over the whole buffer, turned into 8-bit coverage. Four
+ * cells at a time where SSE2 is around: a prefix sum within the vector,
+ * then the total so far added to all of it.
+ */
+void coverage_accumulate(const float *cells, uint8_t *out, size_t n)
+{
+    size_t i = 0;
+    float sum = 0;
+
+#ifdef __SSE2__
+    __m128 total = _mm_setzero_ps();
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 scale = _mm_set1_ps(255.0f);
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128 x = _mm_loadu_ps(cells + i);
+        x = _mm_add_ps(x, _mm_castsi128_ps(
+                _mm_slli_si128(_mm_castps_si128(x), 4)));
+        x = _mm_add_ps(x, _mm_castsi128_ps(
+                _mm_slli_si128(_mm_castps_si128(x), 8)));
+        x = _mm_add_ps(x, total);
+
+        __m128 y = _mm_min_ps(_mm_andnot_ps(sign, x), one);
+        __m128i c = _mm_cvtps_epi32(_mm_mul_ps(y, scale));
+        c = _mm_packus_epi16(_mm_packs_epi32(c, c), c);
+        uint32_t packed = _mm_cvtsi128_si32(c);
+        memcpy(out + i, &packed, 4);
+
+        total = _mm_shuffle_ps(x, x, _MM_SHUFFLE(3, 3, 3, 3));
+    }
+    sum = _mm_cvtss_f32(total);
+#endif
+
+    for (; i < n; i++)
+    {
+        sum += cells[i];
+        float y = fminf(fabsf(sum), 1);
+        out[i] = y * 255 + 0.5;
+    }
+}
+
+/**
+ * Flatten glyph's outline into lines, scaled by scale (pixels per font
+ * unit) and shifted right by x_offset pixels, in pixels from the pen
+ * position with y pointing up.
+ */
+void coverage_flatten(struct ttf_glyph *glyph, float scale, float x_offset,
+                      coverage_line_fn line, void *ctx)
+{
+    struct flattener f = { line, ctx };
+
+    int num_points = ttf_num_points(glyph);
+    vec2 *points = malloc(sizeof(*points) * num_points);
+    char *on_curve = malloc(num_points);
+    for (int i = 0; i < num_points; i++)
+    {
+        points[i].x = glyph->points[i].c[0] * scale + x_offset;
+        points[i].y = glyph->points[i].c[1] * scale;
+        on_curve[i] = glyph->points[i].on_curve;
+    }
+
+    for (int c = 0, start = 0; c < glyph->num_contours; c++)
+    {
+        int end = glyph->contour_endpoints[c] + 1;
+        draw_contour(&f, points + start, on_curve + start, end - start);
+        start = end;
+    }
+
+    free(points);
+    free(on_curve);
+}
+
+struct bitmap_lines
+{
+    struct coverage_accumulator acc;
+    int left, bottom, width;
+};
+
+static void bitmap_line(void *ctx, float x0, float y0, float x1, float y1)
+{
+    // clamped, in case a control point strays outside the bbox
+    struct bitmap_lines *b = ctx;
+    coverage_draw_line(&b->acc,
+        fminf(fmaxf(x0 - b->left, 0), b->width),
+        fminf(fmaxf(y0 - b->bottom, 0), b->acc.height),
+        fminf(fmaxf(x1 - b->left, 0), b->width),
+        fminf(fmaxf(y1 - b->bottom, 0), b->acc.height));
+}
+
+/**
+ * Render glyph scaled by scale (pixels per font unit), shifted right by
+ * x_offset pixels, into a freshly allocated bitmap. Same arguments and
+ * placement as sdf_render_glyph().
+ */
+void coverage_render_glyph(struct ttf_glyph *glyph, float scale,
+                           float x_offset, struct bitmap *out)
+{
+    if (glyph->num_contours <= 0)
+    {
+        out->left = out->bottom = 0;
+        bitmap_alloc(out, 0, 0);
+        return;
+    }
+
+    int x0 = floorf(glyph->bbox.x_min * scale + x_offset);
+    int y0 = floorf(glyph->bbox.y_min * scale);
+    int x1 = ceilf(glyph->bbox.x_max * scale + x_offset);
+    int y1 = ceilf(glyph->bbox.y_max * scale);
+
+    out->left = x0;
+    out->bottom = y0;
+    bitmap_alloc(out, x1 - x0, y1 - y0);
+
+    // rows spill into the next, which is fine since their cells add up to
+    // zero, and the last one into a couple of spare cells
+    struct bitmap_lines lines =
+    {
+        .acc = { .stride = x1 - x0, .height = y1 - y0 },
+        .left = x0,
+        .bottom = y0,
+        .width = x1 - x0,
+    };
+    size_t n = (size_t) out->width * out->height;
+    lines.acc.cells = calloc(n + 2, sizeof(float));
+
+    coverage_flatten(glyph, scale, x_offset, bitmap_line, &lines);
+    coverage_accumulate(lines.acc.cells, out->pixels, n);
+
+    free(lines.acc.cells);
+}
@@ -0,0 +1,40 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "bitmap.h"
+#include "truetype.h"
+
+#ifndef COVERAGE_H
+#define COVERAGE_H
+
+// Exact area coverage, for small text where the SDF's rounded corners and
+// soft edges show. Every edge adds the signed area it covers in each pixel
+// it crosses, and how much it covers everything to its right, to an
+// accumulation buffer. One running sum over the buffer then gives each
+// pixel's coverage, with overlapping contours counting once. Quadratics
+// are flattened into lines first.
+
+// Where flattened outlines go, one line at a time.
+typedef void (*coverage_line_fn)(void *ctx, float x0, float y0,
+                                 float x1, float y1);
+
+// Rows of stride cells each, to draw lines into. A line may add to the two
+// cells past the right end of its row, so give every row two spare ones
+// unless spilling into the next row is fine.
+struct coverage_accumulator
+{
+    float *cells;
+    int stride;
+    int height;
+};
+
+void coverage_render_glyph(struct ttf_glyph *, float scale, float x_offset,
+                           struct bitmap *);
+
+// the pieces, for rendering many glyphs into one accumulator
+void coverage_flatten(struct ttf_glyph *, float scale, float x_offset,
+                      coverage_line_fn, void *ctx);
+void coverage_draw_line(struct coverage_accumulator *,
+                        float x0, float y0, float x1, float y1);
+void coverage_accumulate(const float *cells, uint8_t *out, size_t n);
+
+#endif // COVERAGE_H
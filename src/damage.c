@@ -0,0 +1,76 @@
+#include <limits.h>
+#include "damage.h"
+
+static struct rect rect_union(struct rect a, struct rect b)
+{
+    int x0 = a.x < b.x ? a.x : b.x;
+    int y0 = a.y < b.y ? a.y : b.y;
+    int x1 = a.x + a.width > b.x + b.width ? a.x + a.width : b.x + b.width;
+    int y1 = a.y + a.height > b.y + b.height ? a.y + a.height : b.y + b.height;
+    return (struct rect) { x0, y0, x1 - x0, y1 - y0 };
+}
+
+static long area(struct rect r)
+{
+    return (long) r.width * r.height;
+}
+
+bool rect_intersects(struct rect a, struct rect b)
+{
+    return a.x < b.x + b.width && b.x < a.x + a.width
+        && a.y < b.y + b.height && b.y < a.y + a.height;
+}
+
+bool rect_contains(struct rect outer, struct rect inner)
+{
+    return outer.x <= inner.x && outer.y <= inner.y
+        && inner.x + inner.width <= outer.x + outer.width
+        && inner.y + inner.height <= outer.y + outer.height;
+}
+
+void damage_add(struct damage *d, struct rect r)
+{
+    if (r.width <= 0 || r.height <= 0) return;
+
+    // swallow whatever the new one touches, which can make it touch more
+    for (int i = 0; i < d->num_rects;)
+    {
+        if (rect_intersects(d->rects[i], r))
+        {
+            r = rect_union(r, d->rects[i]);
+            d->rects[i] = d->rects[--d->num_rects];
+            i = 0;
+            continue;
+        }
+        i++;
+    }
+
+    if (d->num_rects < DAMAGE_MAX_RECTS)
+    {
+        d->rects[d->num_rects++] = r;
+        return;
+    }
+
+    // full, so join it with whichever one wastes the least area
+    int best = 0;
+    long best_waste = LONG_MAX;
+    for (int i = 0; i < d->num_rects; i++)
+    {
+        struct rect u = rect_union(d->rects[i], r);
+        long waste = area(u) - area(d->rects[i]) - area(r);
+        if (waste < best_waste)
+        {
+            best = i;
+            best_waste = waste;
+        }
+    }
+
+    struct rect joined = rect_union(d->rects[best], r);
+    d->rects[best] = d->rects[--d->num_rects];
+    damage_add(d, joined);
+}
+
+void damage_clear(struct damage *d)
+{
+    d->num_rects = 0;
+}
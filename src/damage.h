@@ -0,0 +1,32 @@
+#include <stdbool.h>
+
+#ifndef DAMAGE_H
+#define DAMAGE_H
+
+#ifndef DAMAGE_MAX_RECTS
+#define DAMAGE_MAX_RECTS 8
+#endif
+
+// The parts of the window that need drawing again, in pixels from the bottom
+// left like glScissor. Overlapping rectangles are merged, and once there are
+// DAMAGE_MAX_RECTS of them a new one is joined with whichever it wastes the
+// least area with.
+
+struct rect
+{
+    int x, y;
+    int width, height;
+};
+
+struct damage
+{
+    struct rect rects[DAMAGE_MAX_RECTS];
+    int num_rects;
+};
+
+void damage_add(struct damage *, struct rect);
+void damage_clear(struct damage *);
+bool rect_intersects(struct rect, struct rect);
+bool rect_contains(struct rect outer, struct rect inner);
+
+#endif // DAMAGE_H
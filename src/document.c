@@ -0,0 +1,150 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "document.h"
+
+// how much the indexer scans between telling readers about new lines
+#define PUBLISH_BYTES (1 << 20)
+
+static void *index_lines(void *arg)
+{
+    struct document *doc = arg;
+    const char *p = doc->data, *end = doc->data + doc->size;
+    size_t lines = 0;
+
+    // the first line starts at 0 unless the file is empty, and a final
+    // newline doesn't start another one
+    if (p < end)
+    {
+        doc->index[0] = 0;
+        lines = 1;
+    }
+
+    while (p < end && !atomic_load_explicit(&doc->cancel, memory_order_relaxed))
+    {
+        const char *chunk_end = end - p > PUBLISH_BYTES ? p + PUBLISH_BYTES : end;
+        while (p < chunk_end)
+        {
+            const char *nl = memchr(p, '\n', chunk_end - p);
+            if (nl == NULL)
+            {
+                p = chunk_end;
+                break;
+            }
+
+            p = nl + 1;
+            if (p == end) break;
+            if (lines % DOCUMENT_INDEX_STRIDE == 0)
+                doc->index[lines / DOCUMENT_INDEX_STRIDE] = p - doc->data;
+            lines++;
+        }
+
+        atomic_store_explicit(&doc->num_lines, lines, memory_order_release);
+    }
+
+    atomic_store_explicit(&doc->num_lines, lines, memory_order_release);
+    atomic_store_explicit(&doc->indexed, true, memory_order_release);
+    return NULL;
+}
+
+/**
+ * Map the file at path and start indexing its lines in the background.
+ */
+RESULT document_open(struct document *doc, const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return ERR;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+    {
+        close(fd);
+        return ERR;
+    }
+
+    doc->size = st.st_size;
+    doc->data = NULL;
+    if (doc->size > 0)
+    {
+        void *data = mmap(NULL, doc->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
+        {
+            close(fd);
+            return ERR;
+        }
+        madvise(data, doc->size, MADV_SEQUENTIAL);
+        doc->data = data;
+    }
+    close(fd);
+
+    // room for the worst case of a file full of newlines, the pages past
+    // what actually gets used are never touched
+    size_t max_lines = doc->size + 1;
+    doc->index = malloc(sizeof(*doc->index)
+                        * (max_lines / DOCUMENT_INDEX_STRIDE + 1));
+
+    atomic_init(&doc->num_lines, 0);
+    atomic_init(&doc->indexed, false);
+    atomic_init(&doc->cancel, false);
+    if (pthread_create(&doc->indexer, NULL, index_lines, doc) != 0)
+    {
+        free(doc->index);
+        if (doc->data) munmap((void *) doc->data, doc->size);
+        return ERR;
+    }
+
+    return OK;
+}
+
+void document_close(struct document *doc)
+{
+    atomic_store(&doc->cancel, true);
+    pthread_join(doc->indexer, NULL);
+    free(doc->index);
+    if (doc->data) munmap((void *) doc->data, doc->size);
+}
+
+/**
+ * How many lines can be read right now. Once indexed is set, that's all
+ * of them.
+ */
+size_t document_num_lines(struct document *doc, bool *indexed)
+{
+    // read the flag first, so a finished index is never missing lines
+    if (indexed)
+        *indexed = atomic_load_explicit(&doc->indexed, memory_order_acquire);
+    return atomic_load_explicit(&doc->num_lines, memory_order_acquire);
+}
+
+/**
+ * Find a line, without its line break. Returns false for lines that aren't
+ * indexed yet. Longer lines than DOCUMENT_MAX_LINE bytes are cut short at
+ * the last whole UTF-8 sequence that fits.
+ */
+bool document_line(struct document *doc, size_t line,
+                   const char **text, size_t *len)
+{
+    if (line >= document_num_lines(doc, NULL)) return false;
+
+    const char *end = doc->data + doc->size;
+    const char *p = doc->data + doc->index[line / DOCUMENT_INDEX_STRIDE];
+    for (size_t skip = line % DOCUMENT_INDEX_STRIDE; skip > 0; skip--)
+        p = (const char *) memchr(p, '\n', end - p) + 1;
+
+    const char *nl = memchr(p, '\n', end - p);
+    size_t n = (nl ? nl : end) - p;
+    if (n > 0 && p[n - 1] == '\r') n--;
+
+    if (n > DOCUMENT_MAX_LINE)
+    {
+        n = DOCUMENT_MAX_LINE;
+        while (n > 0 && (p[n] & 0xc0) == 0x80) n--;
+    }
+
+    *text = p;
+    *len = n;
+    return true;
+}
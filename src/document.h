@@ -0,0 +1,42 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "truetype.h"
+
+#ifndef DOCUMENT_H
+#define DOCUMENT_H
+
+#ifndef DOCUMENT_INDEX_STRIDE
+#define DOCUMENT_INDEX_STRIDE 64
+#endif
+
+#ifndef DOCUMENT_MAX_LINE
+#define DOCUMENT_MAX_LINE 4096
+#endif
+
+// A file mapped into memory, with a line index that a background thread
+// builds in one pass over it. Only every DOCUMENT_INDEX_STRIDE'th line start
+// is stored, finding a line in between means scanning at most that many
+// lines from the one before. That keeps the index small and a line lookup
+// cheap no matter how big the file is. Lines can be read as soon as the
+// indexer has got past them.
+
+struct document
+{
+    const char *data;
+    size_t size;
+    size_t *index; // byte offset of every DOCUMENT_INDEX_STRIDE'th line
+    _Atomic size_t num_lines; // found so far
+    _Atomic bool indexed;
+    _Atomic bool cancel;
+    pthread_t indexer;
+};
+
+RESULT document_open(struct document *, const char *path);
+void document_close(struct document *);
+size_t document_num_lines(struct document *, bool *indexed);
+bool document_line(struct document *, size_t line,
+                   const char **text, size_t *len);
+
+#endif // DOCUMENT_H
@@ -1,34 +1,388 @@
 #include <stdlib.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
 #include <error.h>
 #include <errno.h>
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 #include "truetype.h"
-#include "shortmap.h"
+#include "glyphcache.h"
+#include "atlas.h"
+#include "sdf.h"
+#include "layout.h"
+#include "kern.h"
+#include "shape.h"
+#include "document.h"
+#include "damage.h"
 
 #ifndef READALL_CHUNK
 #define READALL_CHUNK 4096
 #endif
 
+#ifndef GLYPH_CACHE_BUDGET
+#define GLYPH_CACHE_BUDGET (16 << 20)
+#endif
+
+#ifndef BLOCK_CACHE_BUDGET
+#define BLOCK_CACHE_BUDGET (8 << 20)
+#endif
+
+// retained blocks are drawn at this many subpixel offsets in each direction
+#ifndef BLOCK_PHASES
+#define BLOCK_PHASES 4
+#endif
+
+#ifndef BENCH_FRAMES
+#define BENCH_FRAMES 300
+#endif
+
+// the pixel buffer atlas uploads go through
+#ifndef UPLOAD_RING_BYTES
+#define UPLOAD_RING_BYTES (4 << 20)
+#endif
+
+// the buffer glyph instances are streamed through, three frames of a 4K
+// screen full of small text
+#ifndef INSTANCE_RING_BYTES
+#define INSTANCE_RING_BYTES (3 << 20)
+#endif
+
+// how many fenced stretches of a ring can be in flight at once
+#ifndef UPLOAD_RING_FENCES
+#define UPLOAD_RING_FENCES 8
+#endif
+
+// glad is generated for 4.3, and buffer storage came with 4.4
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#endif
+#ifndef GL_MAP_COHERENT_BIT
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+typedef void (APIENTRYP buffer_storage_fn)(GLenum target, GLsizeiptr size,
+                                           const void *data, GLbitfield flags);
+
+#define MARGIN 32
+
+// panels on the dashboard, and the labelled values down each
+#define DASHBOARD_COLS 3
+#define DASHBOARD_ROWS 4
+#define DASHBOARD_VALUES 4
+
+struct glyph_mesh
+{
+    uint16_t id;
+    struct ttf_glyph glyph;
+    unsigned vao;
+    unsigned texture; // the segments, see generate_glyph_mesh()
+    uint32_t num_segments;
+    int origin[2]; // what their coordinates are relative to
+};
+
+struct glyph_sprite
+{
+    struct atlas_rect rect;
+    int left, bottom;
+};
+
+struct sprite_source
+{
+    struct ttf_reader *fonts;
+    struct atlas *atlas;
+    struct glyph_cache *cache; // the sprites are in
+    // the frame the atlas was last found full of pinned sprites, plus one
+    uint64_t full_frame;
+};
+
+// A paragraph drawn once into a texture of its own and composited with one
+// quad from then on. The coverage ends up in alpha, and is read through red
+// like an atlas page.
+struct text_block
+{
+    unsigned texture;
+    int width, height;
+    int left, bottom; // relative to the top left of the paragraph
+};
+
+// A buffer that data for the GPU is streamed through, written by the CPU
+// and read by whatever commands come after, without the driver allocating
+// anything. Space is handed out from the front, going back to the start when
+// it gets to the end, and a fence after every frame says when the GPU is
+// done with the space that frame used.
+//
+// Where GL has buffer storage the buffer is mapped once for good, and a
+// ring that's caught up with the GPU either waits for it or, if it was
+// asked not to, says there's no room. Elsewhere each allocation maps its
+// own bit of it unsynchronized, and a ring that's caught up orphans its
+// buffer for a fresh one instead, the one allocation it makes.
+struct ring_fence
+{
+    GLsync sync;
+    uint64_t end; // of the space it covers
+};
+
+struct upload_ring
+{
+    GLenum target;
+    size_t size;
+    unsigned buffer;
+    uint8_t *mapped; // for good, or NULL
+    // bytes handed out, and known to be done with, ever: head - tail of
+    // them are in flight
+    uint64_t head, tail;
+    uint64_t fenced; // head as of the last fence
+    struct ring_fence fences[UPLOAD_RING_FENCES]; // oldest first
+    int num_fences;
+    uint64_t wraps;
+    uint64_t waits;
+    double wait_seconds;
+    uint64_t orphans;
+    uint64_t full; // allocations refused rather than waited for
+};
+
+// One glyph, or text block, drawn by atlas_quad.glsl: where on the target it
+// goes, x, y, width, height, and where on the texture it comes from.
+struct sprite_instance
+{
+    int16_t rect[4];
+    uint16_t texel[2];
+};
+
+// What the block being loaded should hold, which doesn't fit in its key
+struct block_source
+{
+    struct renderer *r;
+    int font;
+    struct layout *layout;
+    float dx, dy;
+};
+
+struct renderer
+{
+    struct ttf_reader *fonts;
+    int phases;
+    float fontsize;
+    int width, height;
+
+    unsigned shader;
+    int u_dims, u_pos, u_segments, u_num_segments, u_origin,
+        u_units_per_em, u_size, u_bbox_min, u_bbox_max;
+
+    unsigned atlas_shader;
+    int u_atlas_dims, u_atlas;
+    unsigned quad_vao; // reads struct sprite_instance from instances
+    struct upload_ring instances;
+
+    // a copy of what's on screen, since the window's back buffer is
+    // undefined after a swap. Only kept while frames are partial, copying
+    // it around costs as much as a small frame on software rasterizers.
+    unsigned fbo;
+    unsigned target;
+    bool has_copy;
+    bool on_copy; // this frame
+
+    uint32_t glyphs_drawn; // this frame
+    // atlas uploads this frame, through the ring and straight from memory,
+    // and how long they took to get off the CPU
+    size_t uploaded;
+    size_t uploaded_direct;
+    double upload_seconds;
+    struct upload_ring ring;
+    // the sprites of the layout being drawn, see draw_sprites()
+    struct glyph_sprite **layout_sprites;
+    uint32_t layout_sprites_cap;
+    uint32_t *page_counts; // of the layout being drawn, see draw_sprites()
+    int page_counts_cap;
+
+    // paragraphs that don't change, see draw_block()
+    bool retain_blocks;
+    struct glyph_cache blocks;
+    struct block_source block_source;
+    unsigned block_fbo;
+
+    struct glyph_cache meshes;
+    struct glyph_cache sprites;
+    struct atlas atlas;
+    struct sprite_source sprite_source;
+};
+
+// What's on screen and which parts of it need drawing again. A document is
+// scrolled in lines from the top, fractions scroll by less than a line.
+struct view
+{
+    int width, height;
+    struct damage damage;
+
+    struct document doc;
+    double scroll;
+    float line_height;
+    int page;
+    size_t rows_shown;
+};
+
+struct frame_stats
+{
+    uint64_t frames;
+    uint64_t idle; // wakeups with nothing to draw
+    uint64_t regions;
+    uint64_t glyphs;
+    uint64_t uploaded;
+    uint64_t uploaded_direct;
+    double upload_seconds;
+};
+
+struct bench
+{
+    double start;
+    double indexed_at;
+    int frame;
+    uint64_t seed;
+    double times[2][BENCH_FRAMES];
+};
+
 size_t readall(FILE *f, uint8_t **out);
-void bmp_to_utf8(uint16_t c, char *s);
-uint16_t utf8_codepoint(const char *c);
-bool utf8_continuation(char c);
-int utf8_codepoint_len(char c);
 int check_status(unsigned shader);
 unsigned compile_shader(const char *path, GLenum type);
 unsigned shader_program(const char *vert_source, const char *frag_source);
 void debug_callback(GLenum source, GLenum type, GLuint id, GLenum severity,
                     GLsizei length, const GLchar *message, const void *param);
-unsigned generate_glyph_mesh(struct ttf_glyph *glyph, unsigned textures[2]);
-void destroy_glyph_mesh(unsigned vao);
+RESULT generate_glyph_mesh(struct glyph_mesh *mesh);
+void destroy_glyph_mesh(struct glyph_mesh *mesh);
+RESULT load_glyph_mesh(void *fonts, uint64_t key, void **data, size_t *bytes);
+void unload_glyph_mesh(void *fonts, uint64_t key, void *data);
+RESULT load_glyph_sprite(void *source, uint64_t key, void **data, size_t *bytes);
+RESULT reserve_sprite(struct sprite_source *src, int width, int height,
+                      struct atlas_rect *rect);
+bool sprite_on_page(void *page, uint64_t key, void *data);
+void unload_glyph_sprite(void *source, uint64_t key, void *data);
+RESULT load_text_block(void *source, uint64_t key, void **data, size_t *bytes);
+void unload_text_block(void *source, uint64_t key, void *data);
+void upload_ring_init(struct upload_ring *ring, GLenum target, size_t size);
+void upload_ring_destroy(struct upload_ring *ring);
+void upload_ring_fence(struct upload_ring *ring);
+bool upload_ring_retire(struct upload_ring *ring, bool wait);
+void *upload_ring_alloc(struct upload_ring *ring, size_t bytes, size_t align,
+                        bool wait, size_t *offset);
+void upload_ring_unmap(struct upload_ring *ring);
+void upload_ring_print_stats(struct upload_ring *ring, const char *name,
+                             FILE *f);
+void upload_atlas_page(struct renderer *r, struct atlas_page *page);
+void renderer_init(struct renderer *r, struct ttf_reader *fonts, int phases,
+                   int width, int height);
+void renderer_destroy(struct renderer *r);
+void use_programs(struct renderer *r);
+void begin_frame(struct renderer *r, bool partial);
+void end_frame(struct renderer *r);
+void draw_layout(struct renderer *r, int font, struct layout *layout,
+                 float left, float top);
+void load_sprites(struct renderer *r, int font, struct layout *layout,
+                  float left);
+void draw_sprites(struct renderer *r, int font, struct layout *layout,
+                  float left, float top);
+struct sprite_instance *alloc_instances(struct renderer *r, uint32_t count,
+                                        uint32_t *base);
+void draw_block(struct renderer *r, int font, struct layout *layout,
+                uint64_t key, float left, float top);
+void draw_message(struct renderer *r, struct layout_cache *layouts,
+                  const char *message, int num_fonts, struct rect clip);
+void draw_document(struct renderer *r, struct layout_cache *layouts,
+                   struct view *view, struct rect clip);
+void draw_dashboard(struct renderer *r, struct layout_cache *layouts,
+                    uint64_t tick, struct rect clip);
+void damage_all(struct view *view);
+void damage_dashboard_values(struct view *view, struct renderer *r);
+struct rect row_rect(struct view *view, size_t row);
+size_t rows_fitting(struct view *view);
+bool update_document(struct view *view);
+void scroll_to(struct view *view, double line);
+void refresh_callback(GLFWwindow *window);
+void key_callback(GLFWwindow *window, int key, int scancode, int action,
+                  int mods);
+void scroll_callback(GLFWwindow *window, double dx, double dy);
+bool bench_frame(struct bench *bench, struct view *view, double seconds);
+bool bench_dashboard_frame(struct bench *bench, struct view *view,
+                           double seconds);
+int compare_doubles(const void *a, const void *b);
+void print_frame_times(const char *what, double *times);
 
 
 int main(int argc, char *argv[])
 {
+    // -p N: draw from an atlas holding N subpixel variants of every glyph,
+    //       instead of evaluating the outlines for every fragment
+    // -k:   turn kerning off
+    // -s:   turn shaping off, one glyph per character straight from the cmap
+    // -d F: show the file F instead, scrolling with the keyboard or wheel
+    // -D:   show a dashboard of mostly static labels instead, with a few
+    //       values changing twice a second
+    // -r:   draw paragraphs that don't change into textures once, and only
+    //       composite them after that
+    // -b:   scroll through the document, or redraw the dashboard, as fast
+    //       as possible and print how long frames took
+    // -v:   print how many regions and glyphs every frame drew, and how
+    //       much of the atlas it uploaded
+    // -m S: show S instead of the default message
+    int phases = 0;
+    bool kerning = true, shaping = true, benchmark = false, verbose = false;
+    bool dashboard = false, retained = false;
+    const char *document_path = NULL;
+    const char *message = "बकवास";
+    for (int opt; (opt = getopt(argc, argv, "p:ksd:Drbvm:")) != -1;)
+    {
+        switch (opt)
+        {
+            case 'p': phases = atoi(optarg); break;
+            case 'k': kerning = false; break;
+            case 's': shaping = false; break;
+            case 'd': document_path = optarg; break;
+            case 'D': dashboard = true; break;
+            case 'r': retained = true; break;
+            case 'b': benchmark = true; break;
+            case 'v': verbose = true; break;
+            case 'm': message = optarg; break;
+            default:
+                error(ERR, 0, "usage: %s [-bkrsvD] [-p phases] [-d file] "
+                      "[-m message] [font.ttf...]", argv[0]);
+        }
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
+
+    if (argc < 2)
+    {
+        argc = 2;
+        argv[1] = "/usr/share/fonts/noto/NotoSerifDevanagari-Regular.ttf";
+    }
+
+    // every font on the command line gets a line of its own, all of them
+    // sharing one glyph cache
+    int num_fonts = argc - 1;
+    struct ttf_reader *fonts = malloc(sizeof(*fonts) * num_fonts);
+    for (int f = 0; f < num_fonts; f++)
+    {
+        if (ttf_load(argv[f + 1], &fonts[f]) == ERR)
+            error(ERR, errno, "Failed to load %s", argv[f + 1]);
+
+        printf("%s: num glyphs: %d\n", argv[f + 1], fonts[f].num_glyphs);
+
+        if (!kerning)
+        {
+            ttf_kerning_free(fonts[f].kerning);
+            fonts[f].kerning = NULL;
+        }
+        if (!shaping)
+        {
+            ttf_shaper_free(fonts[f].shaper);
+            fonts[f].shaper = NULL;
+        }
+    }
+
     GLFWwindow *window;
     if (!glfwInit()) error(ERR, 0, "Failed to init GLFW");
 
@@ -51,136 +405,860 @@ int main(int argc, char *argv[])
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     glClearColor(1.0, 1.0, 1.0, 1.0);
 
-    if (argc < 2)
+    struct renderer renderer;
+    renderer_init(&renderer, fonts, phases, width, height);
+    renderer.retain_blocks = retained;
+
+    struct layout_cache layouts;
+    layout_cache_init(&layouts);
+
+    struct view view = { .width = width, .height = height };
+    glfwSetWindowUserPointer(window, &view);
+    glfwSetWindowRefreshCallback(window, refresh_callback);
+    if (document_path != NULL)
     {
-        argc = 2;
-        argv[1] = "/usr/share/fonts/noto/NotoSerifDevanagari-Regular.ttf";
+        if (document_open(&view.doc, document_path) != OK)
+            error(ERR, errno, "Failed to open %s", document_path);
+
+        struct ttf_reader *reader = &fonts[0];
+        view.line_height = (reader->ascender - reader->descender
+                            + reader->line_gap)
+                         * renderer.fontsize / reader->units_per_em;
+        view.page = (height - 2 * MARGIN) / view.line_height;
+
+        glfwSetKeyCallback(window, key_callback);
+        glfwSetScrollCallback(window, scroll_callback);
+    }
+
+    struct bench bench = { 0 };
+    if (benchmark)
+    {
+        if (document_path == NULL && !dashboard)
+            error(ERR, 0, "-b needs a document or the dashboard, see -d "
+                  "and -D");
+        bench.start = glfwGetTime();
     }
 
-    struct ttf_reader reader;
+    struct frame_stats totals = { 0 };
+    damage_all(&view);
+    while (!glfwWindowShouldClose(window))
     {
-        FILE *fontfile = fopen(argv[1], "rb");
-        if (readall(fontfile, (uint8_t **)&reader.data) == ERR)
-            error(ERR, errno, "Failed to read %s", argv[1]);
-        fclose(fontfile);
+        // keep checking while lines are still turning up
+        bool indexed = true;
+        if (document_path != NULL) indexed = update_document(&view);
 
-        reader.cursor = reader.data;
-        if (ttf_parse(&reader) == ERR)
-            error(ERR, 0, "Failed to parse ttf %s", argv[1]);
+        if (view.damage.num_rects > 0)
+        {
+            double start = glfwGetTime();
+
+            // without a copy of the last frame, there's nothing to draw a
+            // partial one on top of
+            struct rect screen = { 0, 0, width, height };
+            bool partial = view.damage.num_rects > 1
+                        || !rect_contains(view.damage.rects[0], screen);
+            if (partial && !renderer.has_copy) damage_all(&view);
+
+            layout_cache_begin_frame(&layouts);
+            begin_frame(&renderer, partial);
+
+            for (int i = 0; i < view.damage.num_rects; i++)
+            {
+                struct rect clip = view.damage.rects[i];
+                glScissor(clip.x, clip.y, clip.width, clip.height);
+                glClear(GL_COLOR_BUFFER_BIT);
+
+                if (document_path != NULL)
+                    draw_document(&renderer, &layouts, &view, clip);
+                else if (dashboard)
+                    draw_dashboard(&renderer, &layouts, totals.frames, clip);
+                else
+                    draw_message(&renderer, &layouts, message, num_fonts, clip);
+            }
 
-        printf("num glyphs: %d\n", reader.num_glyphs);
+            end_frame(&renderer);
+
+            totals.frames++;
+            totals.regions += view.damage.num_rects;
+            totals.glyphs += renderer.glyphs_drawn;
+            totals.uploaded += renderer.uploaded;
+            totals.uploaded_direct += renderer.uploaded_direct;
+            totals.upload_seconds += renderer.upload_seconds;
+            if (verbose)
+                printf("frame %" PRIu64 ": %d region%s, %u glyphs, "
+                       "%zu + %zu bytes uploaded in %.3f ms\n",
+                       totals.frames, view.damage.num_rects,
+                       view.damage.num_rects == 1 ? "" : "s",
+                       renderer.glyphs_drawn, renderer.uploaded,
+                       renderer.uploaded_direct,
+                       renderer.upload_seconds * 1000);
+            damage_clear(&view.damage);
+
+            if (benchmark)
+            {
+                glFinish();
+                double seconds = glfwGetTime() - start;
+                if (document_path != NULL
+                        ? bench_frame(&bench, &view, seconds)
+                        : bench_dashboard_frame(&bench, &view, seconds))
+                    break;
+            }
+
+            glfwSwapBuffers(window);
+        }
+        else
+        {
+            totals.idle++;
+        }
+
+        if (benchmark) continue;
+        else if (!indexed) glfwWaitEventsTimeout(0.1);
+        else if (dashboard && document_path == NULL)
+        {
+            glfwWaitEventsTimeout(0.5);
+            damage_dashboard_values(&view, &renderer);
+        }
+        else glfwWaitEvents();
     }
 
-    // FIXME devanagari support: uint16_t c = utf8_codepoint("अ");
-    // FIXME wtf:                uint16_t c = utf8_codepoint("h");
-    // FIXME wtf:                uint16_t c = utf8_codepoint("k");
-    // uint16_t c = utf8_codepoint("g");
+    printf("frames: %" PRIu64 " drawn, %" PRIu64 " idle wakeups, "
+           "%" PRIu64 " regions, %" PRIu64 " glyphs\n",
+           totals.frames, totals.idle, totals.regions, totals.glyphs);
+    if (renderer.phases > 0 && totals.frames > 0)
+        printf("atlas uploads: %" PRIu64 " bytes through the ring, %" PRIu64
+               " straight, %.0f per frame, %.3f ms per frame\n",
+               totals.uploaded, totals.uploaded_direct,
+               (double) (totals.uploaded + totals.uploaded_direct)
+                   / totals.frames,
+               totals.upload_seconds * 1000 / totals.frames);
+    renderer_destroy(&renderer);
+    layout_cache_destroy(&layouts);
+    for (int f = 0; f < num_fonts; f++)
+        if (fonts[f].shaper) shape_print_stats(fonts[f].shaper, stdout);
+    if (document_path != NULL) document_close(&view.doc);
 
-    unsigned shader = shader_program("quad.glsl", "sdf.glsl");
+    return 0;
+}
 
-    int u_dims = glGetUniformLocation(shader, "u_dims");
-    int u_pos = glGetUniformLocation(shader, "u_pos");
-    int u_points = glGetUniformLocation(shader, "u_points");
-    int u_endpoints = glGetUniformLocation(shader, "endpoints");
-    int u_num_contours = glGetUniformLocation(shader, "num_contours");
-    int u_num_points = glGetUniformLocation(shader, "num_points");
-    int u_units_per_em = glGetUniformLocation(shader, "units_per_em");
-    int u_size = glGetUniformLocation(shader, "u_size");
-    int u_bbox_min = glGetUniformLocation(shader, "u_bbox_min");
-    int u_bbox_max = glGetUniformLocation(shader, "u_bbox_max");
+void renderer_init(struct renderer *r, struct ttf_reader *fonts, int phases,
+                   int width, int height)
+{
+    r->fonts = fonts;
+    r->phases = phases;
+    r->fontsize = 24.0;
+    r->width = width;
+    r->height = height;
+
+    r->shader = shader_program("quad.glsl", "sdf.glsl");
+    r->atlas_shader = shader_program("atlas_quad.glsl", "atlas.glsl");
+
+    r->u_dims = glGetUniformLocation(r->shader, "u_dims");
+    r->u_pos = glGetUniformLocation(r->shader, "u_pos");
+    r->u_segments = glGetUniformLocation(r->shader, "u_segments");
+    r->u_num_segments = glGetUniformLocation(r->shader, "num_segments");
+    r->u_origin = glGetUniformLocation(r->shader, "u_origin");
+    r->u_units_per_em = glGetUniformLocation(r->shader, "units_per_em");
+    r->u_size = glGetUniformLocation(r->shader, "u_size");
+    r->u_bbox_min = glGetUniformLocation(r->shader, "u_bbox_min");
+    r->u_bbox_max = glGetUniformLocation(r->shader, "u_bbox_max");
+
+    r->u_atlas_dims = glGetUniformLocation(r->atlas_shader, "u_dims");
+    r->u_atlas = glGetUniformLocation(r->atlas_shader, "u_atlas");
+
+    glyph_cache_init(&r->meshes, GLYPH_CACHE_BUDGET,
+                     load_glyph_mesh, unload_glyph_mesh, fonts);
+
+    atlas_init(&r->atlas, phases);
+    upload_ring_init(&r->ring, GL_PIXEL_UNPACK_BUFFER, UPLOAD_RING_BYTES);
+    r->layout_sprites = NULL;
+    r->layout_sprites_cap = 0;
+    r->page_counts = NULL;
+    r->page_counts_cap = 0;
+    r->sprite_source.fonts = fonts;
+    r->sprite_source.atlas = &r->atlas;
+    r->sprite_source.cache = &r->sprites;
+    r->sprite_source.full_frame = 0;
+    // keep some slack so that shelf fragmentation doesn't fill the atlas
+    glyph_cache_init(&r->sprites,
+                     (size_t) ATLAS_PAGE_SIZE * ATLAS_PAGE_SIZE * ATLAS_MAX_PAGES / 2,
+                     load_glyph_sprite, unload_glyph_sprite, &r->sprite_source);
+
+    upload_ring_init(&r->instances, GL_ARRAY_BUFFER, INSTANCE_RING_BYTES);
+    glGenVertexArrays(1, &r->quad_vao);
+    glBindVertexArray(r->quad_vao);
+    glBindBuffer(GL_ARRAY_BUFFER, r->instances.buffer);
+    glVertexAttribIPointer(0, 4, GL_SHORT, sizeof(struct sprite_instance),
+                           (void *) offsetof(struct sprite_instance, rect));
+    glVertexAttribIPointer(1, 2, GL_UNSIGNED_SHORT,
+                           sizeof(struct sprite_instance),
+                           (void *) offsetof(struct sprite_instance, texel));
+    for (int i = 0; i < 2; i++)
+    {
+        glVertexAttribDivisor(i, 1);
+        glEnableVertexAttribArray(i);
+    }
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    r->retain_blocks = false;
+    r->block_source.r = r;
+    glyph_cache_init(&r->blocks, BLOCK_CACHE_BUDGET,
+                     load_text_block, unload_text_block, &r->block_source);
+    glGenFramebuffers(1, &r->block_fbo);
+
+    glGenTextures(1, &r->target);
+    glBindTexture(GL_TEXTURE_2D, r->target);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0,
+                 GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glGenFramebuffers(1, &r->fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, r->fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                           GL_TEXTURE_2D, r->target, 0);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        error(ERR, 0, "Failed to create framebuffer");
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
 
-    const char message[] = "बकवास";
+void renderer_destroy(struct renderer *r)
+{
+    glyph_cache_print_stats(&r->meshes, stdout);
+    glyph_cache_destroy(&r->meshes);
+    if (r->phases > 0)
+    {
+        glyph_cache_print_stats(&r->sprites, stdout);
+        atlas_print_stats(&r->atlas, stdout);
+        upload_ring_print_stats(&r->ring, "atlas upload", stdout);
+    }
+    if (r->phases > 0 || r->retain_blocks)
+        upload_ring_print_stats(&r->instances, "instance", stdout);
+    glyph_cache_destroy(&r->sprites);
+    atlas_destroy(&r->atlas);
+    upload_ring_destroy(&r->ring);
+    free(r->layout_sprites);
+    free(r->page_counts);
+    if (r->retain_blocks)
+    {
+        struct glyph_cache_stats *s = &r->blocks.stats;
+        printf("text blocks: %u entries, %zu/%zu bytes, %" PRIu64 " hits, "
+               "%" PRIu64 " misses, %" PRIu64 " evictions\n",
+               s->entries, s->bytes_resident, r->blocks.budget,
+               s->hits, s->misses, s->evictions);
+    }
+    glyph_cache_destroy(&r->blocks);
+    glDeleteFramebuffers(1, &r->block_fbo);
+    glDeleteVertexArrays(1, &r->quad_vao);
+    upload_ring_destroy(&r->instances);
+    glDeleteFramebuffers(1, &r->fbo);
+    glDeleteTextures(1, &r->target);
+}
 
-    struct glyph_mesh
+/**
+ * Start drawing a frame. A partial one is drawn on top of the copy of the
+ * last frame, or if there is none, everything has to be damaged and it's
+ * drawn to the window and copied afterwards. Whole frames go straight to
+ * the window and drop the copy.
+ */
+void begin_frame(struct renderer *r, bool partial)
+{
+    glyph_cache_begin_frame(&r->meshes);
+    glyph_cache_begin_frame(&r->sprites);
+    glyph_cache_begin_frame(&r->blocks);
+    r->glyphs_drawn = 0;
+    r->uploaded = r->uploaded_direct = 0;
+    r->upload_seconds = 0;
+
+    r->on_copy = partial && r->has_copy;
+    r->has_copy = partial;
+    glBindFramebuffer(GL_FRAMEBUFFER, r->on_copy ? r->fbo : 0);
+    glEnable(GL_SCISSOR_TEST);
+    use_programs(r);
+}
+
+/**
+ * Point both programs at a target of r's size, and leave the one glyphs are
+ * drawn with in use.
+ */
+void use_programs(struct renderer *r)
+{
+    glUseProgram(r->atlas_shader);
+    glUniform2i(r->u_atlas_dims, r->width, r->height);
+    glUniform1i(r->u_atlas, 0);
+
+    glUseProgram(r->shader);
+    glUniform1f(r->u_size, r->fontsize);
+    glUniform2i(r->u_dims, r->width, r->height);
+
+    if (r->phases > 0)
     {
-        uint16_t id;
-        struct ttf_glyph glyph;
-        unsigned vao;
-        unsigned textures[2];
-    };
+        glUseProgram(r->atlas_shader);
+        glActiveTexture(GL_TEXTURE0);
+        glBindVertexArray(r->quad_vao);
+    }
+}
 
-    shortmap_t meshes = shortmap_create(16);
+void end_frame(struct renderer *r)
+{
+    upload_ring_fence(&r->ring);
+    upload_ring_fence(&r->instances);
+    glBindVertexArray(0);
+    glUseProgram(0);
+    glDisable(GL_SCISSOR_TEST);
 
-    for (int i = 0, n; n = utf8_codepoint_len(message[i]), message[i] != 0; i += n)
+    if (r->has_copy)
     {
-        char s[5] = {};
-        for (int j = 0; j < n; j++)
-            s[j] = message[i + j];
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, r->on_copy ? r->fbo : 0);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, r->on_copy ? 0 : r->fbo);
+        glBlitFramebuffer(0, 0, r->width, r->height, 0, 0, r->width, r->height,
+                          GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+}
 
-        uint16_t c = utf8_codepoint(&message[i]);
-        uint16_t glyph_id = ttf_lookup_index(reader.cmap, c);
+/**
+ * Draw a layout with its top left corner at left, top, in pixels from the
+ * bottom left of the window. Glyphs off the right edge are skipped.
+ */
+void draw_layout(struct renderer *r, int font, struct layout *layout,
+                 float left, float top)
+{
+    struct ttf_reader *reader = &r->fonts[font];
+    float scale = r->fontsize / reader->units_per_em;
+    if (r->phases > 0)
+    {
+        draw_sprites(r, font, layout, left, top);
+        return;
+    }
+    glUniform1f(r->u_units_per_em, (float)reader->units_per_em);
 
-        // skip if we've already generated this mesh
-        if (shortmap_get(&meshes, glyph_id) != NULL) continue;
+    for (uint32_t i = 0; i < layout->num_glyphs; i++)
+    {
+        uint16_t glyph_id = layout->glyphs[i].glyph;
+        float xpos = left + layout->glyphs[i].x,
+              ypos = top + layout->glyphs[i].y;
+        if (xpos > r->width) continue;
+
+        // meshes are drawn straight from the outlines, so they
+        // don't depend on size or subpixel position
+        uint64_t key = glyph_key(font, glyph_id, 0, 0, 0);
+        struct glyph_mesh *mesh = glyph_cache_get(&r->meshes, key);
+        if (mesh == NULL)
+            error(1, 0, "failed to load glyph %d", glyph_id);
+
+        if (mesh->glyph.num_contours > 0)
+        {
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_BUFFER, mesh->texture);
+            glUniform1i(r->u_segments, 0);
+
+            glBindVertexArray(mesh->vao);
+            glUniform2f(r->u_pos, xpos / scale, ypos / scale);
+            glUniform1ui(r->u_num_segments, mesh->num_segments);
+            glUniform2i(r->u_origin, mesh->origin[0], mesh->origin[1]);
+            glUniform2i(r->u_bbox_min, mesh->glyph.bbox.x_min, mesh->glyph.bbox.y_min);
+            glUniform2i(r->u_bbox_max, mesh->glyph.bbox.x_max, mesh->glyph.bbox.y_max);
+
+            glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+            r->glyphs_drawn++;
+        }
+    }
+}
 
-        struct glyph_mesh *mesh = malloc(sizeof(*mesh));
-        mesh->id = glyph_id;
-        if (ttf_parse_glyf(&reader, glyph_id, &mesh->glyph) != OK)
-            error(1, 0, "failed to parse glyf %d (%s)", glyph_id, s);
+/**
+ * Look up the sprite of every glyph of layout draw_sprites() is going to
+ * draw, into r->layout_sprites, and upload whatever pages the new ones went
+ * onto. Uploading in between draws would make the driver finish every
+ * draw before it that reads the page first.
+ */
+void load_sprites(struct renderer *r, int font, struct layout *layout,
+                  float left)
+{
+    if (layout->num_glyphs > r->layout_sprites_cap)
+    {
+        r->layout_sprites_cap = layout->num_glyphs;
+        r->layout_sprites = realloc(r->layout_sprites,
+                sizeof(*r->layout_sprites) * r->layout_sprites_cap);
+    }
 
-        mesh->vao = generate_glyph_mesh(&mesh->glyph, mesh->textures);
+    for (uint32_t i = 0; i < layout->num_glyphs; i++)
+    {
+        float x, xpos = left + layout->glyphs[i].x;
+        r->layout_sprites[i] = NULL;
+        if (xpos > r->width) continue;
+
+        // snapped like draw_sprites() does
+        int phase = atlas_phase(&r->atlas, xpos, &x);
+        uint64_t key = glyph_key(font, layout->glyphs[i].glyph,
+                                 glyph_size_bucket(r->fontsize), phase, 0);
+        r->layout_sprites[i] = glyph_cache_get(&r->sprites, key);
+    }
 
-        shortmap_insert(&meshes, glyph_id, mesh);
+    for (int p = 0; p < r->atlas.num_pages; p++)
+        if (r->atlas.pages[p].dirty.num_rects > 0)
+            upload_atlas_page(r, &r->atlas.pages[p]);
+}
+
+/**
+ * Draw layout from the atlas, with one instanced draw per page its glyphs
+ * are on. Glyphs are drawn black over whatever's there, so it doesn't
+ * matter that they go in page order rather than the layout's.
+ */
+void draw_sprites(struct renderer *r, int font, struct layout *layout,
+                  float left, float top)
+{
+    load_sprites(r, font, layout, left);
+
+    if (r->atlas.num_pages > r->page_counts_cap)
+    {
+        r->page_counts_cap = r->atlas.num_pages;
+        r->page_counts = realloc(r->page_counts,
+                sizeof(*r->page_counts) * r->page_counts_cap);
     }
+    memset(r->page_counts, 0, sizeof(*r->page_counts) * r->atlas.num_pages);
 
-    bool has_drawn = false;
-    while (!glfwWindowShouldClose(window))
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < layout->num_glyphs; i++)
+    {
+        struct glyph_sprite *sprite = r->layout_sprites[i];
+        if (sprite == NULL || sprite->rect.width == 0) continue;
+        r->page_counts[sprite->rect.page]++;
+        count++;
+    }
+    if (count == 0) return;
+
+    // where each page's instances start
+    uint32_t first = 0;
+    for (int p = 0; p < r->atlas.num_pages; p++)
+    {
+        uint32_t n = r->page_counts[p];
+        r->page_counts[p] = first;
+        first += n;
+    }
+
+    uint32_t base;
+    struct sprite_instance *instances = alloc_instances(r, count, &base);
+    for (uint32_t i = 0; i < layout->num_glyphs; i++)
+    {
+        struct glyph_sprite *sprite = r->layout_sprites[i];
+        if (sprite == NULL || sprite->rect.width == 0) continue;
+
+        // snap to whole pixels, and pick the variant that was
+        // rendered closest to where we actually are
+        float x;
+        atlas_phase(&r->atlas, left + layout->glyphs[i].x, &x);
+        struct sprite_instance *instance =
+            &instances[r->page_counts[sprite->rect.page]++];
+        instance->rect[0] = x + sprite->left;
+        instance->rect[1] = roundf(top + layout->glyphs[i].y)
+                          + sprite->bottom;
+        instance->rect[2] = sprite->rect.width;
+        instance->rect[3] = sprite->rect.height;
+        instance->texel[0] = sprite->rect.x;
+        instance->texel[1] = sprite->rect.y;
+    }
+    upload_ring_unmap(&r->instances);
+
+    // page_counts now holds where each page's instances end
+    first = 0;
+    for (int p = 0; p < r->atlas.num_pages; p++)
+    {
+        uint32_t end = r->page_counts[p];
+        if (end == first) continue;
+        glBindTexture(GL_TEXTURE_2D, r->atlas.pages[p].texture);
+        glDrawArraysInstancedBaseInstance(GL_TRIANGLE_STRIP, 0, 4,
+                                          end - first, base + first);
+        first = end;
+    }
+    r->glyphs_drawn += count;
+}
+
+/**
+ * Room for count sprite instances in the instance ring, the first of which
+ * is instance number *base of the buffer. Waits for the GPU if it has to.
+ */
+struct sprite_instance *alloc_instances(struct renderer *r, uint32_t count,
+                                        uint32_t *base)
+{
+    size_t offset;
+    struct sprite_instance *instances = upload_ring_alloc(&r->instances,
+            sizeof(*instances) * count, sizeof(*instances), true, &offset);
+    if (instances == NULL)
+        error(1, 0, "%u glyphs don't fit in the instance ring", count);
+    *base = offset / sizeof(*instances);
+    return instances;
+}
+
+/**
+ * Draw a paragraph that probably looks the same next frame. The first time
+ * it's drawn into a texture of its own, and after that the texture is
+ * composited as one quad, until it falls out of the block cache. Whatever
+ * changes how it looks has to change key: the text, font and size through
+ * layout_key(), and the subpixel offset is added here. Without
+ * retain_blocks, or if the block is too big to keep, it's just
+ * draw_layout().
+ */
+void draw_block(struct renderer *r, int font, struct layout *layout,
+                uint64_t key, float left, float top)
+{
+    if (!r->retain_blocks)
+    {
+        draw_layout(r, font, layout, left, top);
+        return;
+    }
+
+    // composited at whole pixels, with the rest baked into the texture
+    float x = floorf(left), y = floorf(top);
+    int dx = (left - x) * BLOCK_PHASES, dy = (top - y) * BLOCK_PHASES;
+    r->block_source.font = font;
+    r->block_source.layout = layout;
+    r->block_source.dx = (float) dx / BLOCK_PHASES;
+    r->block_source.dy = (float) dy / BLOCK_PHASES;
+
+    key = hashmap_hash(key ^ (dx * BLOCK_PHASES + dy));
+    struct text_block *block = glyph_cache_get(&r->blocks, key);
+    if (block == NULL)
     {
-        if (!has_drawn)
+        draw_layout(r, font, layout, left, top);
+        return;
+    }
+
+    glUseProgram(r->atlas_shader);
+    glBindVertexArray(r->quad_vao);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, block->texture);
+    uint32_t base;
+    struct sprite_instance *instance = alloc_instances(r, 1, &base);
+    *instance = (struct sprite_instance) {
+        { x + block->left, y + block->bottom, block->width, block->height },
+        { 0, 0 },
+    };
+    upload_ring_unmap(&r->instances);
+    glDrawArraysInstancedBaseInstance(GL_TRIANGLE_STRIP, 0, 4, 1, base);
+
+    if (r->phases == 0) glUseProgram(r->shader);
+}
+
+/**
+ * The message in every font, one paragraph each. Only the paragraphs that
+ * reach into clip are drawn.
+ */
+void draw_message(struct renderer *r, struct layout_cache *layouts,
+                  const char *message, int num_fonts, struct rect clip)
+{
+    float top = r->height - MARGIN;
+    for (int f = 0; f < num_fonts; f++)
+    {
+        struct layout *layout =
+            layout_cache_get(layouts, &r->fonts[f], f, message, strlen(message),
+                             r->fontsize, r->width - 2 * MARGIN);
+        if (layout == NULL)
+            error(ERR, 0, "invalid UTF-8 in message");
+
+        // with some room for ink that pokes out of the line boxes
+        struct rect box = { 0, top - layout->height - MARGIN / 2,
+                            r->width, layout->height + MARGIN };
+        uint64_t key = layout_key(f, message, strlen(message),
+                                  r->fontsize, r->width - 2 * MARGIN);
+        if (rect_intersects(box, clip))
+            draw_block(r, f, layout, key, MARGIN, top);
+        top -= layout->height + MARGIN / 2;
+    }
+}
+
+/**
+ * Panels of labels that never change, each with a value next to it that
+ * does. The labels are drawn with draw_block(), the values as they are.
+ * Only the ones near clip are drawn.
+ */
+void draw_dashboard(struct renderer *r, struct layout_cache *layouts,
+                    uint64_t tick, struct rect clip)
+{
+    static const char *labels[DASHBOARD_VALUES] = {
+        "requests/s", "errors/min", "p99 ms", "sessions",
+    };
+    int cols = DASHBOARD_COLS, rows = DASHBOARD_ROWS;
+    float panel_width = (r->width - 2 * MARGIN) / cols,
+          panel_height = (r->height - 2 * MARGIN) / rows;
+
+    struct ttf_reader *reader = &r->fonts[0];
+    float line_height = (reader->ascender - reader->descender
+                         + reader->line_gap)
+                      * r->fontsize / reader->units_per_em;
+
+    // with room for ink that pokes out of the line boxes
+    int slack = line_height;
+    struct rect near = { clip.x, clip.y - slack,
+                         clip.width, clip.height + 2 * slack };
+
+    for (int p = 0; p < cols * rows; p++)
+    {
+        float left = MARGIN + p % cols * panel_width,
+              top = r->height - MARGIN - p / cols * panel_height;
+        struct rect box = { left, top - panel_height,
+                            panel_width, panel_height };
+        if (!rect_intersects(box, near)) continue;
+
+        char text[32];
+        for (int i = -1; i < DASHBOARD_VALUES; i++)
         {
-            glClear(GL_COLOR_BUFFER_BIT);
+            // the title first, then a label and its value on every line
+            if (i < 0)
+                snprintf(text, sizeof(text), "node-%02d eu-west", p + 1);
+            else
+                snprintf(text, sizeof(text), "%s", labels[i]);
+
+            float y = top - (i + 1) * line_height;
+            struct layout *layout =
+                layout_cache_get(layouts, reader, 0, text, strlen(text),
+                                 r->fontsize, 0);
+            uint64_t key = layout_key(0, text, strlen(text), r->fontsize, 0);
+            if (layout != NULL && rect_intersects((struct rect) {
+                    left, y - layout->height, ceilf(layout->width),
+                    layout->height }, near))
+                draw_block(r, 0, layout, key, left, y);
+
+            if (i < 0) continue;
+            uint32_t value = hashmap_hash(tick * 16 + p * 4 + i) % 10000;
+            snprintf(text, sizeof(text), "%u", value);
+            layout = layout_cache_get(layouts, reader, 0, text, strlen(text),
+                                      r->fontsize, 0);
+            float x = left + panel_width * 0.6;
+            if (layout != NULL && rect_intersects((struct rect) {
+                    x, y - layout->height, ceilf(layout->width),
+                    layout->height }, near))
+                draw_layout(r, 0, layout, x, y);
+        }
+    }
+}
 
-            float fontsize = 24.0;
-            glUseProgram(shader);
-            glUniform1f(u_units_per_em, (float)reader.units_per_em);
-            glUniform1f(u_size, fontsize);
-            glUniform2i(u_dims, width, height);
+/**
+ * Only the lines that are on screen get looked up, laid out and drawn, so
+ * this costs the same wherever in the document we are. Of those, only the
+ * ones near clip are drawn.
+ */
+void draw_document(struct renderer *r, struct layout_cache *layouts,
+                   struct view *view, struct rect clip)
+{
+    size_t first = view->scroll;
+    int slack = view->line_height;
+    struct rect near = { clip.x, clip.y - slack,
+                         clip.width, clip.height + 2 * slack };
 
-            float xpos = reader.units_per_em,
-                  ypos = 26900 / 2;
+    for (size_t row = 0, rows = rows_fitting(view); row < rows; row++)
+    {
+        struct rect box = row_rect(view, row);
+        if (!rect_intersects(box, near)) continue;
+
+        const char *text;
+        size_t len;
+        if (!document_line(&view->doc, first + row, &text, &len)) break;
+
+        // lines that aren't UTF-8 are left blank rather than guessed at
+        struct layout *layout =
+            layout_cache_get(layouts, &r->fonts[0], 0, text, len,
+                             r->fontsize, 0);
+        if (layout != NULL)
+            draw_layout(r, 0, layout, MARGIN, box.y + box.height);
+    }
+}
 
-            for (int i = 0, n; n = utf8_codepoint_len(message[i]), message[i] != 0; i += n)
-            {
-                uint16_t c = utf8_codepoint(&message[i]);
-                uint16_t glyph_id = ttf_lookup_index(reader.cmap, c);
+void damage_all(struct view *view)
+{
+    damage_add(&view->damage,
+               (struct rect) { 0, 0, view->width, view->height });
+}
 
-                struct glyph_mesh *mesh = shortmap_get(&meshes, glyph_id);
+/**
+ * Only the values on the dashboard change, so damage the column of them in
+ * each panel, where draw_dashboard() puts them, with a couple of pixels to
+ * spare for ink. They stop short of the next panel's labels.
+ */
+void damage_dashboard_values(struct view *view, struct renderer *r)
+{
+    float panel_width = (r->width - 2 * MARGIN) / DASHBOARD_COLS,
+          panel_height = (r->height - 2 * MARGIN) / DASHBOARD_ROWS;
 
-                if (mesh->glyph.num_contours > 0)
-                {
-                    for (int t = 0; t < 2; t++)
-                    {
-                        glActiveTexture(GL_TEXTURE0 + t);
-                        glBindTexture(GL_TEXTURE_BUFFER, mesh->textures[t]);
-                    }
-                    glUniform1i(u_points, 0);
-                    glUniform1i(u_endpoints, 1);
-
-                    glBindVertexArray(mesh->vao);
-                    glUniform2f(u_pos, xpos, ypos);
-                    glUniform1ui(u_num_contours, mesh->glyph.num_contours);
-                    glUniform1ui(u_num_points, ttf_num_points(&mesh->glyph));
-                    glUniform2i(u_bbox_min, mesh->glyph.bbox.x_min, mesh->glyph.bbox.y_min);
-                    glUniform2i(u_bbox_max, mesh->glyph.bbox.x_max, mesh->glyph.bbox.y_max);
-
-                    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-                }
+    struct ttf_reader *reader = &r->fonts[0];
+    float line_height = (reader->ascender - reader->descender
+                         + reader->line_gap)
+                      * r->fontsize / reader->units_per_em;
 
-                float advance = reader.hmetrics[mesh->id].advance_width;
-                xpos += advance;
-            }
+    for (int p = 0; p < DASHBOARD_COLS * DASHBOARD_ROWS; p++)
+    {
+        float left = MARGIN + p % DASHBOARD_COLS * panel_width,
+              top = r->height - MARGIN - p / DASHBOARD_COLS * panel_height;
+        int x0 = floorf(left + panel_width * 0.6) - 2,
+            x1 = left + panel_width,
+            y0 = floorf(top - (DASHBOARD_VALUES + 1) * line_height) - 2,
+            y1 = ceilf(top - line_height) + 2;
+        damage_add(&view->damage, (struct rect) { x0, y0, x1 - x0, y1 - y0 });
+    }
+}
 
-            glBindVertexArray(0);
-            glUseProgram(0);
+/**
+ * Where a row of the document is on screen, the first row being the line
+ * scrolled to.
+ */
+struct rect row_rect(struct view *view, size_t row)
+{
+    float top = view->height - MARGIN
+              + (view->scroll - (size_t) view->scroll) * view->line_height
+              - row * view->line_height;
+    int y = floorf(top - view->line_height);
+    return (struct rect) { 0, y, view->width, ceilf(top) - y };
+}
 
-            glfwSwapBuffers(window);
-            // has_drawn = true;
+/**
+ * How many rows are at least partly on screen.
+ */
+size_t rows_fitting(struct view *view)
+{
+    size_t rows = 0;
+    for (struct rect box; (box = row_rect(view, rows)).y + box.height > 0;)
+        rows++;
+    return rows;
+}
+
+/**
+ * Damage the rows whose lines the indexer has only just found. Returns
+ * whether the indexer is done, after which nothing changes unless we
+ * scroll.
+ */
+bool update_document(struct view *view)
+{
+    bool indexed;
+    size_t num_lines = document_num_lines(&view->doc, &indexed);
+    size_t first = view->scroll;
+    size_t rows = rows_fitting(view);
+    size_t shown = num_lines > first ? num_lines - first : 0;
+    if (shown > rows) shown = rows;
+
+    for (size_t row = view->rows_shown; row < shown; row++)
+        damage_add(&view->damage, row_rect(view, row));
+    view->rows_shown = shown;
+    return indexed;
+}
+
+void scroll_to(struct view *view, double line)
+{
+    size_t num_lines = document_num_lines(&view->doc, NULL);
+    double last = num_lines > 0 ? num_lines - 1 : 0;
+    double scroll = line < 0 ? 0 : line > last ? last : line;
+    if (scroll == view->scroll) return;
+
+    view->scroll = scroll;
+    damage_all(view);
+}
+
+void refresh_callback(GLFWwindow *window)
+{
+    damage_all(glfwGetWindowUserPointer(window));
+}
+
+void key_callback(GLFWwindow *window, int key, int scancode, int action,
+                  int mods)
+{
+    struct view *view = glfwGetWindowUserPointer(window);
+    if (action != GLFW_PRESS && action != GLFW_REPEAT) return;
+
+    switch (key)
+    {
+        case GLFW_KEY_UP: scroll_to(view, view->scroll - 1); break;
+        case GLFW_KEY_DOWN: scroll_to(view, view->scroll + 1); break;
+        case GLFW_KEY_PAGE_UP: scroll_to(view, view->scroll - view->page); break;
+        case GLFW_KEY_PAGE_DOWN: scroll_to(view, view->scroll + view->page); break;
+        case GLFW_KEY_HOME: scroll_to(view, 0); break;
+        case GLFW_KEY_END: scroll_to(view, SIZE_MAX); break;
+    }
+}
+
+void scroll_callback(GLFWwindow *window, double dx, double dy)
+{
+    struct view *view = glfwGetWindowUserPointer(window);
+    scroll_to(view, view->scroll - 3 * dy);
+}
+
+/**
+ * Redraw the whole dashboard every frame, which is what it costs to show
+ * once the values change everywhere. Returns true when finished.
+ */
+bool bench_dashboard_frame(struct bench *bench, struct view *view,
+                           double seconds)
+{
+    bench->times[0][bench->frame++] = seconds;
+    if (bench->frame < BENCH_FRAMES)
+    {
+        damage_all(view);
+        return false;
+    }
+
+    print_frame_times("dashboard", bench->times[0]);
+    return true;
+}
+
+int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+void print_frame_times(const char *what, double *times)
+{
+    qsort(times, BENCH_FRAMES, sizeof(*times), compare_doubles);
+    printf("%s: %d frames, median %.2f ms, p99 %.2f ms, max %.2f ms\n",
+           what, BENCH_FRAMES, times[BENCH_FRAMES / 2] * 1000,
+           times[BENCH_FRAMES * 99 / 100] * 1000,
+           times[BENCH_FRAMES - 1] * 1000);
+}
+
+/**
+ * Record how long a frame took and pick where the next one is scrolled to.
+ * The first BENCH_FRAMES frames scroll smoothly down from the top while the
+ * index is still being built, the next BENCH_FRAMES jump to random lines
+ * anywhere in the document once it's done. Returns true when finished.
+ */
+bool bench_frame(struct bench *bench, struct view *view, double seconds)
+{
+    int phase = bench->frame / BENCH_FRAMES;
+    bench->times[phase][bench->frame % BENCH_FRAMES] = seconds;
+    bench->frame++;
+
+    bool indexed;
+    size_t num_lines = document_num_lines(&view->doc, &indexed);
+    if (indexed && bench->indexed_at == 0) bench->indexed_at = glfwGetTime();
+
+    if (bench->frame < BENCH_FRAMES)
+    {
+        scroll_to(view, view->scroll + 2.5);
+        return false;
+    }
+
+    if (bench->frame == BENCH_FRAMES)
+    {
+        while (!indexed)
+        {
+            usleep(1000);
+            num_lines = document_num_lines(&view->doc, &indexed);
         }
+        if (bench->indexed_at == 0) bench->indexed_at = glfwGetTime();
+        bench->seed = 0x9e3779b97f4a7c15;
+    }
 
-        glfwWaitEvents();
+    if (bench->frame < 2 * BENCH_FRAMES)
+    {
+        // xorshift, nothing fancy needed
+        bench->seed ^= bench->seed << 13;
+        bench->seed ^= bench->seed >> 7;
+        bench->seed ^= bench->seed << 17;
+        scroll_to(view, num_lines ? bench->seed % num_lines : 0);
+        return false;
     }
 
-    return 0;
+    double index_time = bench->indexed_at - bench->start;
+    printf("%zu lines, %zu bytes indexed in %.2f s (%.0f MB/s)\n",
+           num_lines, view->doc.size, index_time,
+           view->doc.size / index_time / 1e6);
+    print_frame_times("scrolling", bench->times[0]);
+    print_frame_times("jumping", bench->times[1]);
+    return true;
 }
 
 size_t readall(FILE *f, uint8_t **out)
@@ -239,77 +1317,6 @@ size_t readall(FILE *f, uint8_t **out)
     return used;
 }
 
-void bmp_to_utf8(uint16_t c, char *s)
-{
-    if (c <= 0x7F) {
-        // 1-byte UTF-8
-        s[0] = (char)c;
-        s[1] = '\0';
-    } else if (c <= 0x7FF) {
-        // 2-byte UTF-8
-        s[0] = (char)((c >> 6) | 0xC0);
-        s[1] = (char)((c & 0x3F) | 0x80);
-        s[2] = '\0';
-    } else {
-        // 3-byte UTF-8
-        s[0] = (char)((c >> 12) | 0xE0);
-        s[1] = (char)(((c >> 6) & 0x3F) | 0x80);
-        s[2] = (char)((c & 0x3F) | 0x80);
-        s[3] = '\0';
-    }
-}
-
-uint16_t utf8_codepoint(const char *c)
-{
-    uint16_t codepoint = c[0];
-
-    if ((c[0] & 0x80) == 0)
-        return codepoint;
-
-    if ((c[0] & 0xe0) == 0xc0)
-    {
-        codepoint &= 0x1f;
-        codepoint <<= 6;
-        codepoint |= c[1] & 0x3f;
-        // if (codepoint < 0x80) return 0xfffd;
-        return codepoint;
-    }
-
-    if ((c[0] & 0xf0) == 0xe0)
-    {
-        codepoint &= 0x0f;
-        codepoint <<= 6; codepoint |= c[1] & 0x3f;
-        codepoint <<= 6; codepoint |= c[2] & 0x3f;
-        // if (codepoint < 0x800) return 0xfffd;
-        return codepoint;
-    }
-
-    if ((c[0] & 0xf8) == 0xf0)
-    {
-        codepoint &= 0x07;
-        codepoint <<= 6; codepoint |= c[1] & 0x3f;
-        codepoint <<= 6; codepoint |= c[2] & 0x3f;
-        codepoint <<= 6; codepoint |= c[3] & 0x3f;
-        return 0xfffd;
-    }
-
-    return 0xfffd;
-}
-
-bool utf8_continuation(char c)
-{
-    return (c & 0xc0) == 0x80;
-}
-
-int utf8_codepoint_len(char c)
-{
-    if ((c & 0x80) == 0x00) return 1;
-    if ((c & 0xe0) == 0xc0) return 2;
-    if ((c & 0xf0) == 0xe0) return 3;
-    if ((c & 0xf8) == 0xf0) return 4;
-    return 1;
-}
-
 int check_status(unsigned shader)
 {
     int success, size = 0;
@@ -355,9 +1362,9 @@ unsigned compile_shader(const char *path, GLenum type)
 
 unsigned shader_program(const char *vert_source, const char *frag_source)
 {
-    unsigned vs = compile_shader("quad.glsl", GL_VERTEX_SHADER);
+    unsigned vs = compile_shader(vert_source, GL_VERTEX_SHADER);
     if (vs == 0) return ERR;
-    unsigned fs = compile_shader("sdf.glsl", GL_FRAGMENT_SHADER);
+    unsigned fs = compile_shader(frag_source, GL_FRAGMENT_SHADER);
     if (fs == 0) return ERR;
 
     unsigned program = glCreateProgram();
@@ -379,62 +1386,528 @@ void debug_callback(GLenum source, GLenum type, GLuint id, GLenum severity,
     error(0, 0, "%s", message);
 }
 
-unsigned generate_glyph_mesh(struct ttf_glyph *glyph,
-                             unsigned textures[2])
+/**
+ * Upload a glyph's segments for sdf.glsl, one RGBA32UI texel each: the
+ * three points packed as two 16 bit coordinates, in half font units from
+ * mesh->origin, and the type. Fails on a glyph too big to fit that.
+ */
+RESULT generate_glyph_mesh(struct glyph_mesh *mesh)
 {
-    unsigned points = 0, endpoints = 0, vao = 0;
-    glGenVertexArrays(1, &vao);
-    glBindVertexArray(vao);
+    struct sdf_segment *segments;
+    mesh->num_segments = sdf_segments(&mesh->glyph, &segments);
 
-    // FIXME why is this necessary???
-    // NOTE: it might have something to do with certain control points being on
-    // top of others, probably creating singularities. But why?
-    for (int i = 0, n = ttf_num_points(glyph); i < n; i++)
+    int32_t lo[2] = { INT32_MAX, INT32_MAX }, hi[2] = { INT32_MIN, INT32_MIN };
+    for (uint32_t i = 0; i < mesh->num_segments; i++)
     {
-        glyph->points[i].c[0] += i % 2;
-        glyph->points[i].c[1] += (i / 2) % 2;
+        for (int j = 0; j < 3; j++)
+        {
+            for (int k = 0; k < 2; k++)
+            {
+                if (segments[i].p[j][k] < lo[k]) lo[k] = segments[i].p[j][k];
+                if (segments[i].p[j][k] > hi[k]) hi[k] = segments[i].p[j][k];
+            }
+        }
     }
 
-    glGenBuffers(1, &points);
-    glBindBuffer(GL_TEXTURE_BUFFER, points);
-    glBufferData(GL_TEXTURE_BUFFER,
-                 sizeof(contour_point_t) * ttf_num_points(glyph),
-                 glyph->points,
-                 GL_STREAM_DRAW);
+    uint32_t (*texels)[4] = malloc(sizeof(*texels) * mesh->num_segments);
+    for (int k = 0; k < 2; k++)
+    {
+        // whole units, so that it goes in as ints
+        mesh->origin[k] = lo[k] >> 1;
+        if (mesh->num_segments > 0 && hi[k] - 2 * mesh->origin[k] > UINT16_MAX)
+        {
+            free(segments);
+            free(texels);
+            return ERR;
+        }
+    }
+    for (uint32_t i = 0; i < mesh->num_segments; i++)
+    {
+        for (int j = 0; j < 3; j++)
+        {
+            uint32_t x = segments[i].p[j][0] - 2 * mesh->origin[0];
+            uint32_t y = segments[i].p[j][1] - 2 * mesh->origin[1];
+            texels[i][j] = x | y << 16;
+        }
+        texels[i][3] = segments[i].type;
+    }
+    free(segments);
 
-    glGenBuffers(1, &endpoints);
-    glBindBuffer(GL_TEXTURE_BUFFER, endpoints);
+    unsigned buffer = 0;
+    glGenVertexArrays(1, &mesh->vao);
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_TEXTURE_BUFFER, buffer);
     glBufferData(GL_TEXTURE_BUFFER,
-                 sizeof(uint16_t) * glyph->num_contours,
-                 glyph->contour_endpoints,
+                 sizeof(*texels) * mesh->num_segments,
+                 texels,
                  GL_STREAM_DRAW);
     glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    free(texels);
 
-    glGenTextures(2, textures);
+    glGenTextures(1, &mesh->texture);
     glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_BUFFER, textures[0]);
-    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGB32I, points);
+    glBindTexture(GL_TEXTURE_BUFFER, mesh->texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32UI, buffer);
 
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_BUFFER, textures[1]);
-    glTexBuffer(GL_TEXTURE_BUFFER, GL_R16UI, endpoints);
+    // the texture holds on to the buffer, no need to keep track of it
+    glDeleteBuffers(1, &buffer);
+    return OK;
+}
 
-    glBindVertexArray(0);
+void destroy_glyph_mesh(struct glyph_mesh *mesh)
+{
+    // the buffer was orphaned in generate_glyph_mesh(), so it goes away
+    // together with the texture
+    glDeleteTextures(1, &mesh->texture);
+    glDeleteVertexArrays(1, &mesh->vao);
+}
+
+RESULT load_glyph_mesh(void *fonts, uint64_t key, void **data, size_t *bytes)
+{
+    struct ttf_reader *reader = (struct ttf_reader *)fonts + glyph_key_font(key);
+    uint16_t glyph_id = glyph_key_glyph(key);
+    struct glyph_mesh *mesh = malloc(sizeof(*mesh));
+    mesh->id = glyph_id;
+    if (ttf_parse_glyf(reader, glyph_id, &mesh->glyph) != OK)
+    {
+        free(mesh);
+        return ERR;
+    }
+
+    // the segments are all the shader needs, the bbox and contour count
+    // are kept for drawing
+    RESULT result = generate_glyph_mesh(mesh);
+    free(mesh->glyph.points);
+    free(mesh->glyph.contour_endpoints);
+    mesh->glyph.points = NULL;
+    mesh->glyph.contour_endpoints = NULL;
+    if (result != OK)
+    {
+        free(mesh);
+        return ERR;
+    }
 
-    return vao;
+    *bytes = sizeof(*mesh) + sizeof(uint32_t[4]) * mesh->num_segments;
+    *data = mesh;
+    return OK;
 }
 
-void destroy_glyph_mesh(unsigned vao)
+void unload_glyph_mesh(void *fonts, uint64_t key, void *data)
 {
-    glBindVertexArray(vao);
+    struct glyph_mesh *mesh = data;
+    destroy_glyph_mesh(mesh);
+    free(mesh);
+}
 
-    int tex[2];
-    glActiveTexture(GL_TEXTURE0);
-    glGetIntegerv(GL_TEXTURE_BINDING_BUFFER, &tex[0]);
-    glActiveTexture(GL_TEXTURE1);
-    glGetIntegerv(GL_TEXTURE_BINDING_BUFFER, &tex[1]);
-    glDeleteTextures(2, (unsigned *)tex);
+RESULT load_glyph_sprite(void *source, uint64_t key, void **data, size_t *bytes)
+{
+    struct sprite_source *src = source;
+    struct ttf_reader *reader = &src->fonts[glyph_key_font(key)];
 
-    glBindVertexArray(0);
-    glDeleteVertexArrays(1, &vao);
+    struct ttf_glyph glyph;
+    if (ttf_parse_glyf(reader, glyph_key_glyph(key), &glyph) != OK)
+        return ERR;
+
+    float scale = glyph_key_size(key) / 4.0 / reader->units_per_em;
+    float offset = atlas_phase_offset(src->atlas, glyph_key_phase(key));
+
+    // don't render what there's no room for
+    struct bitmap bitmap;
+    struct atlas_rect rect;
+    sdf_glyph_box(&glyph, scale, offset, &bitmap);
+    if (reserve_sprite(src, bitmap.width, bitmap.height, &rect) != OK)
+    {
+        free(glyph.points);
+        free(glyph.contour_endpoints);
+        return ERR;
+    }
+
+    sdf_render_glyph(&glyph, scale, offset, &bitmap, NULL);
+    free(glyph.points);
+    free(glyph.contour_endpoints);
+    atlas_copy(src->atlas, &bitmap, &rect);
+
+    struct glyph_sprite *sprite = malloc(sizeof(*sprite));
+    sprite->rect = rect;
+    sprite->left = bitmap.left;
+    sprite->bottom = bitmap.bottom;
+    bitmap_free(&bitmap);
+
+    *bytes = sizeof(*sprite) + (size_t) sprite->rect.width * sprite->rect.height;
+    *data = sprite;
+    return OK;
+}
+
+/**
+ * Find room in the atlas for a sprite. If every page is full, the page with
+ * the fewest sprites drawn this frame has every other sprite evicted from
+ * the cache and what's left repacked, and so on until one has room. Those
+ * drawn this frame have to stay, as they may still be about to be drawn.
+ * If even that doesn't make room, the atlas stays full until the next
+ * frame, and the sprites that don't fit aren't drawn.
+ */
+RESULT reserve_sprite(struct sprite_source *src, int width, int height,
+                      struct atlas_rect *rect)
+{
+    if (atlas_alloc(src->atlas, width, height, rect) == OK) return OK;
+    struct glyph_cache *cache = src->cache;
+    if (width > ATLAS_PAGE_SIZE || height > ATLAS_PAGE_SIZE
+            || src->full_frame == cache->frame + 1)
+        return ERR;
+
+    size_t pinned[ATLAS_MAX_PAGES] = { 0 };
+    bool tried[ATLAS_MAX_PAGES] = { false };
+    for (struct glyph_entry *e = cache->head; e != NULL; e = e->next)
+    {
+        if (e->frame != cache->frame) break; // the rest are older
+        struct glyph_sprite *sprite = e->data;
+        pinned[sprite->rect.page] += e->bytes;
+    }
+
+    for (int i = 0; i < src->atlas->num_pages; i++)
+    {
+        int page = -1;
+        for (int p = 0; p < src->atlas->num_pages; p++)
+            if (!tried[p] && (page < 0 || pinned[p] < pinned[page]))
+                page = p;
+        tried[page] = true;
+
+        glyph_cache_evict_if(cache, sprite_on_page, &page);
+        if (src->atlas->pages[page].used > 0)
+        {
+            struct atlas_rect **rects = NULL;
+            int count = 0, cap = 0;
+            for (struct glyph_entry *e = cache->head; e != NULL; e = e->next)
+            {
+                struct glyph_sprite *sprite = e->data;
+                if (sprite->rect.page != page) continue;
+                if (count == cap)
+                {
+                    cap = cap ? cap * 2 : 64;
+                    rects = realloc(rects, sizeof(*rects) * cap);
+                }
+                rects[count++] = &sprite->rect;
+            }
+            atlas_repack(src->atlas, page, rects, count);
+            free(rects);
+        }
+
+        if (atlas_alloc(src->atlas, width, height, rect) == OK) return OK;
+    }
+
+    src->full_frame = cache->frame + 1;
+    return ERR;
+}
+
+bool sprite_on_page(void *page, uint64_t key, void *data)
+{
+    struct glyph_sprite *sprite = data;
+    return sprite->rect.page == *(int *) page;
+}
+
+void unload_glyph_sprite(void *source, uint64_t key, void *data)
+{
+    struct sprite_source *src = source;
+    struct glyph_sprite *sprite = data;
+    atlas_remove(src->atlas, &sprite->rect);
+    free(sprite);
+}
+
+RESULT load_text_block(void *source, uint64_t key, void **data, size_t *bytes)
+{
+    struct block_source *src = source;
+    struct renderer *r = src->r;
+    struct layout *layout = src->layout;
+
+    // room for ink that pokes out of the line boxes
+    int pad = ceilf(r->fontsize / 4);
+    int text_height = ceilf(layout->height);
+    int width = ceilf(layout->width) + 2 * pad, height = text_height + 2 * pad;
+
+    // a few huge blocks would push everything else out
+    *bytes = sizeof(struct text_block) + (size_t) width * height * 4;
+    if (*bytes > r->blocks.budget / 4) return ERR;
+
+    struct text_block *block = malloc(sizeof(*block));
+    block->width = width;
+    block->height = height;
+    block->left = -pad;
+    block->bottom = -text_height - pad;
+
+    glGenTextures(1, &block->texture);
+    glBindTexture(GL_TEXTURE_2D, block->texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0,
+                 GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_R, GL_ALPHA);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, r->block_fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                           GL_TEXTURE_2D, block->texture, 0);
+    glViewport(0, 0, width, height);
+    glDisable(GL_SCISSOR_TEST);
+    glClearColor(0.0, 0.0, 0.0, 0.0);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    // alpha has to add up like it would on the window, where it's 1 - the
+    // product of what every glyph lets through
+    glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA,
+                        GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
+    // for now the block is the window
+    int window_width = r->width, window_height = r->height;
+    r->width = width;
+    r->height = height;
+    use_programs(r);
+    draw_layout(r, src->font, layout, pad + src->dx,
+                pad + text_height + src->dy);
+    r->width = window_width;
+    r->height = window_height;
+    use_programs(r);
+
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glClearColor(1.0, 1.0, 1.0, 1.0);
+    glViewport(0, 0, r->width, r->height);
+    glEnable(GL_SCISSOR_TEST);
+    glBindFramebuffer(GL_FRAMEBUFFER, r->on_copy ? r->fbo : 0);
+
+    *data = block;
+    return OK;
+}
+
+void unload_text_block(void *source, uint64_t key, void *data)
+{
+    struct text_block *block = data;
+    glDeleteTextures(1, &block->texture);
+    free(block);
+}
+
+void upload_ring_init(struct upload_ring *ring, GLenum target, size_t size)
+{
+    memset(ring, 0, sizeof(*ring));
+    ring->target = target;
+    ring->size = size;
+    if (size == 0) return;
+
+    GLint major, minor, num_extensions;
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+    glGetIntegerv(GL_NUM_EXTENSIONS, &num_extensions);
+    bool storage = major > 4 || (major == 4 && minor >= 4);
+    for (int i = 0; i < num_extensions && !storage; i++)
+        storage = strcmp((const char *) glGetStringi(GL_EXTENSIONS, i),
+                         "GL_ARB_buffer_storage") == 0;
+    buffer_storage_fn buffer_storage = storage
+        ? (buffer_storage_fn) glfwGetProcAddress("glBufferStorage") : NULL;
+
+    glGenBuffers(1, &ring->buffer);
+    glBindBuffer(target, ring->buffer);
+    if (buffer_storage != NULL)
+    {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT
+                         | GL_MAP_COHERENT_BIT;
+        buffer_storage(target, size, NULL, flags);
+        ring->mapped = glMapBufferRange(target, 0, size, flags);
+    }
+    else
+    {
+        glBufferData(target, size, NULL, GL_STREAM_DRAW);
+    }
+    glBindBuffer(target, 0);
+}
+
+void upload_ring_destroy(struct upload_ring *ring)
+{
+    for (int i = 0; i < ring->num_fences; i++)
+        glDeleteSync(ring->fences[i].sync);
+    if (ring->mapped != NULL)
+    {
+        glBindBuffer(ring->target, ring->buffer);
+        glUnmapBuffer(ring->target);
+        glBindBuffer(ring->target, 0);
+    }
+    glDeleteBuffers(1, &ring->buffer);
+}
+
+/**
+ * Fence whatever's been handed out since the last fence, once the commands
+ * reading it have been issued, at the end of a frame say. Fences the GPU is
+ * already past are let go of first, and it's only waited for if there
+ * are UPLOAD_RING_FENCES of them still in flight.
+ */
+void upload_ring_fence(struct upload_ring *ring)
+{
+    while (upload_ring_retire(ring, false));
+    if (ring->head == ring->fenced) return;
+    if (ring->num_fences == UPLOAD_RING_FENCES)
+        upload_ring_retire(ring, true);
+
+    struct ring_fence *fence = &ring->fences[ring->num_fences++];
+    fence->sync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    fence->end = ring->head;
+    ring->fenced = ring->head;
+}
+
+/**
+ * Free up the space behind the oldest fence, if the GPU is past it. With
+ * wait, the fence is waited for if it has to be, and false only means
+ * there was no fence.
+ */
+bool upload_ring_retire(struct upload_ring *ring, bool wait)
+{
+    if (ring->num_fences == 0) return false;
+
+    GLsync sync = ring->fences[0].sync;
+    if (glClientWaitSync(sync, 0, 0) == GL_TIMEOUT_EXPIRED)
+    {
+        if (!wait) return false;
+
+        double start = glfwGetTime();
+        while (glClientWaitSync(sync, GL_SYNC_FLUSH_COMMANDS_BIT,
+                                1000000000) == GL_TIMEOUT_EXPIRED);
+        ring->wait_seconds += glfwGetTime() - start;
+        ring->waits++;
+    }
+    glDeleteSync(sync);
+
+    ring->tail = ring->fences[0].end;
+    ring->num_fences--;
+    memmove(ring->fences, ring->fences + 1,
+            sizeof(*ring->fences) * ring->num_fences);
+    return true;
+}
+
+/**
+ * Room for bytes in the ring, aligned to align, at *offset into the buffer.
+ * Space the GPU may still be reading is waited for if wait is set, and
+ * otherwise it's NULL, as it is for more than the whole ring. Unless the
+ * ring is mapped for good, the buffer is left bound and mapped until
+ * upload_ring_unmap().
+ */
+void *upload_ring_alloc(struct upload_ring *ring, size_t bytes, size_t align,
+                        bool wait, size_t *offset)
+{
+    if (bytes > ring->size)
+    {
+        ring->full++;
+        return NULL;
+    }
+
+    // whatever's skipped at the end to wrap around counts as used
+    size_t pos = ring->head % ring->size;
+    *offset = (pos + align - 1) / align * align;
+    if (*offset + bytes > ring->size)
+    {
+        *offset = 0;
+        ring->wraps++;
+    }
+    ring->head += *offset + (*offset < pos ? ring->size : 0) - pos;
+    uint64_t end = ring->head + bytes;
+
+    while (end - ring->tail > ring->size)
+    {
+        if (upload_ring_retire(ring, false)) continue;
+        if (ring->mapped == NULL)
+        {
+            // the driver hands us a fresh buffer and keeps the old one
+            // around for as long as the GPU's using it
+            glBindBuffer(ring->target, ring->buffer);
+            glBufferData(ring->target, ring->size, NULL, GL_STREAM_DRAW);
+            for (int i = 0; i < ring->num_fences; i++)
+                glDeleteSync(ring->fences[i].sync);
+            ring->num_fences = 0;
+            ring->tail = ring->fenced = ring->head - *offset;
+            ring->orphans++;
+            break;
+        }
+        if (!wait)
+        {
+            ring->full++;
+            return NULL;
+        }
+        if (ring->num_fences == 0) upload_ring_fence(ring);
+        upload_ring_retire(ring, true);
+    }
+    ring->head = end;
+
+    if (ring->mapped != NULL) return ring->mapped + *offset;
+    glBindBuffer(ring->target, ring->buffer);
+    return glMapBufferRange(ring->target, *offset, bytes,
+                            GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT
+                            | GL_MAP_INVALIDATE_RANGE_BIT);
+}
+
+/**
+ * Done writing what upload_ring_alloc() handed out. Leaves the buffer bound.
+ */
+void upload_ring_unmap(struct upload_ring *ring)
+{
+    glBindBuffer(ring->target, ring->buffer);
+    if (ring->mapped == NULL) glUnmapBuffer(ring->target);
+}
+
+void upload_ring_print_stats(struct upload_ring *ring, const char *name,
+                             FILE *f)
+{
+    fprintf(f, "%s ring: %zu bytes, %s, %" PRIu64 " bytes through, "
+            "%" PRIu64 " wraps, %" PRIu64 " fence waits (%.3f ms), "
+            "%" PRIu64 " orphaned, %" PRIu64 " refused\n",
+            name, ring->size, ring->mapped != NULL ? "persistent" : "mapped",
+            ring->head, ring->wraps, ring->waits, ring->wait_seconds * 1000,
+            ring->orphans, ring->full);
+}
+
+/**
+ * Upload the parts of page glyphs went into since last time, through the
+ * ring where there's room. A new page's texture starts out empty, the
+ * shader never reads outside a glyph anyway.
+ */
+void upload_atlas_page(struct renderer *r, struct atlas_page *page)
+{
+    double start = glfwGetTime();
+    if (page->texture == 0)
+    {
+        glGenTextures(1, &page->texture);
+        glBindTexture(GL_TEXTURE_2D, page->texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, ATLAS_PAGE_SIZE, ATLAS_PAGE_SIZE,
+                     0, GL_RED, GL_UNSIGNED_BYTE, NULL);
+    }
+    else
+    {
+        glBindTexture(GL_TEXTURE_2D, page->texture);
+    }
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (int i = 0; i < page->dirty.num_rects; i++)
+    {
+        struct rect d = page->dirty.rects[i];
+        const uint8_t *src = page->pixels + d.y * ATLAS_PAGE_SIZE + d.x;
+        size_t bytes = (size_t) d.width * d.height;
+        size_t offset;
+        uint8_t *dst = upload_ring_alloc(&r->ring, bytes, 1, false, &offset);
+        if (dst == NULL)
+        {
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, ATLAS_PAGE_SIZE);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, d.x, d.y, d.width, d.height,
+                            GL_RED, GL_UNSIGNED_BYTE, src);
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+            r->uploaded_direct += bytes;
+            continue;
+        }
+
+        for (int y = 0; y < d.height; y++)
+            memcpy(dst + y * d.width, src + y * ATLAS_PAGE_SIZE, d.width);
+        upload_ring_unmap(&r->ring);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, d.x, d.y, d.width, d.height,
+                        GL_RED, GL_UNSIGNED_BYTE, (void *) offset);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        r->uploaded += bytes;
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    damage_clear(&page->dirty);
+    r->upload_seconds += glfwGetTime() - start;
 }
@@ -0,0 +1,146 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include "glyphcache.h"
+
+void glyph_cache_init(struct glyph_cache *cache, size_t budget,
+                      glyph_load_fn load, glyph_unload_fn unload, void *ctx)
+{
+    cache->index = hashmap_create(64);
+    cache->head = NULL;
+    cache->tail = NULL;
+    cache->budget = budget;
+    cache->frame = 0;
+    cache->load = load;
+    cache->unload = unload;
+    cache->ctx = ctx;
+    cache->stats = (struct glyph_cache_stats) {};
+}
+
+static void unlink_entry(struct glyph_cache *cache, struct glyph_entry *entry)
+{
+    if (entry->prev) entry->prev->next = entry->next;
+    else cache->head = entry->next;
+
+    if (entry->next) entry->next->prev = entry->prev;
+    else cache->tail = entry->prev;
+
+    entry->prev = entry->next = NULL;
+}
+
+static void push_front(struct glyph_cache *cache, struct glyph_entry *entry)
+{
+    entry->prev = NULL;
+    entry->next = cache->head;
+    if (cache->head) cache->head->prev = entry;
+    else cache->tail = entry;
+    cache->head = entry;
+}
+
+static void drop_entry(struct glyph_cache *cache, struct glyph_entry *entry)
+{
+    unlink_entry(cache, entry);
+    hashmap_remove(&cache->index, entry->key);
+    cache->unload(cache->ctx, entry->key, entry->data);
+    cache->stats.bytes_resident -= entry->bytes;
+    cache->stats.entries--;
+    free(entry);
+}
+
+static void evict(struct glyph_cache *cache)
+{
+    // everything behind a pinned entry was used longer ago, so if the tail is
+    // pinned, the whole list is, and we have to go over budget for a while
+    while (cache->stats.bytes_resident > cache->budget
+            && cache->tail != NULL
+            && cache->tail->frame != cache->frame)
+    {
+        drop_entry(cache, cache->tail);
+        cache->stats.evictions++;
+    }
+}
+
+void glyph_cache_destroy(struct glyph_cache *cache)
+{
+    while (cache->head)
+        drop_entry(cache, cache->head);
+    hashmap_destroy(&cache->index);
+}
+
+void glyph_cache_begin_frame(struct glyph_cache *cache)
+{
+    cache->frame++;
+    evict(cache);
+}
+
+/**
+ * Look up key, loading it on a miss. The entry stays pinned for the rest of
+ * the frame, so the returned pointer is valid until the next
+ * glyph_cache_begin_frame(). Returns NULL if loading failed.
+ */
+void *glyph_cache_get(struct glyph_cache *cache, uint64_t key)
+{
+    struct glyph_entry *entry = hashmap_get(&cache->index, key);
+    if (entry != NULL)
+    {
+        cache->stats.hits++;
+        entry->frame = cache->frame;
+        if (entry != cache->head)
+        {
+            unlink_entry(cache, entry);
+            push_front(cache, entry);
+        }
+        return entry->data;
+    }
+
+    cache->stats.misses++;
+
+    entry = malloc(sizeof(*entry));
+    entry->key = key;
+    entry->frame = cache->frame;
+    if (cache->load(cache->ctx, key, &entry->data, &entry->bytes) != OK)
+    {
+        free(entry);
+        return NULL;
+    }
+
+    hashmap_insert(&cache->index, key, entry);
+    push_front(cache, entry);
+    cache->stats.bytes_resident += entry->bytes;
+    cache->stats.entries++;
+
+    evict(cache);
+    return entry->data;
+}
+
+/**
+ * Evict every entry pick says yes to, other than those pinned by the current
+ * frame, however much room there is. Safe to call from a load function.
+ * Returns how many went.
+ */
+uint32_t glyph_cache_evict_if(struct glyph_cache *cache, glyph_pick_fn pick,
+                              void *ctx)
+{
+    uint32_t evicted = 0;
+    struct glyph_entry *entry = cache->head, *next;
+    for (; entry != NULL; entry = next)
+    {
+        next = entry->next;
+        if (entry->frame == cache->frame
+                || !pick(ctx, entry->key, entry->data))
+            continue;
+        drop_entry(cache, entry);
+        cache->stats.evictions++;
+        evicted++;
+    }
+    return evicted;
+}
+
+void glyph_cache_print_stats(struct glyph_cache *cache, FILE *f)
+{
+    struct glyph_cache_stats *s = &cache->stats;
+    fprintf(f, "glyph cache: %u entries, %zu/%zu bytes, "
+            "%" PRIu64 " hits, %" PRIu64 " misses, %" PRIu64 " evictions\n",
+            s->entries, s->bytes_resident, cache->budget,
+            s->hits, s->misses, s->evictions);
+}
@@ -0,0 +1,96 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdint.h>
+#include "hashmap.h"
+#include "truetype.h"
+
+#ifndef GLYPHCACHE_H
+#define GLYPHCACHE_H
+
+// A glyph cache with a byte budget. Entries are kept in least recently used
+// order and evicted from the cold end whenever the budget is exceeded, except
+// for entries that have been used during the current frame, which stay pinned
+// until glyph_cache_begin_frame() is called again.
+
+// Everything that tells two cached glyphs apart, packed into the 64-bit key
+// the cache is indexed by, so that one cache can serve several fonts, sizes
+// and subpixel phases at once:
+//
+//   bits  0-15  glyph id
+//   bits 16-31  font id
+//   bits 32-47  size bucket, see glyph_size_bucket()
+//   bits 48-51  subpixel phase
+//   bits 52-59  style flags
+//
+// The top bits are always zero, which keeps packed keys clear of the
+// values concmap reserves.
+
+static inline uint64_t glyph_key(uint16_t font, uint16_t glyph,
+                                 uint16_t size, uint8_t phase, uint8_t style)
+{
+    return (uint64_t) glyph
+         | (uint64_t) font << 16
+         | (uint64_t) size << 32
+         | (uint64_t) (phase & 0xf) << 48
+         | (uint64_t) style << 52;
+}
+
+static inline uint16_t glyph_key_glyph(uint64_t key) { return key; }
+static inline uint16_t glyph_key_font(uint64_t key) { return key >> 16; }
+static inline uint16_t glyph_key_size(uint64_t key) { return key >> 32; }
+static inline uint8_t glyph_key_phase(uint64_t key) { return (key >> 48) & 0xf; }
+static inline uint8_t glyph_key_style(uint64_t key) { return key >> 52; }
+
+// sizes are bucketed to quarter pixels, bucket 0 means size independent
+static inline uint16_t glyph_size_bucket(float px)
+{
+    return (uint16_t) (px * 4 + 0.5);
+}
+
+typedef RESULT (*glyph_load_fn)(void *ctx, uint64_t key,
+                                void **data, size_t *bytes);
+typedef void (*glyph_unload_fn)(void *ctx, uint64_t key, void *data);
+typedef bool (*glyph_pick_fn)(void *ctx, uint64_t key, void *data);
+
+struct glyph_entry
+{
+    uint64_t key;
+    void *data;
+    size_t bytes;
+    uint64_t frame; // last frame this entry was used in
+    struct glyph_entry *prev; // towards most recently used
+    struct glyph_entry *next; // towards least recently used
+};
+
+struct glyph_cache_stats
+{
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    size_t bytes_resident;
+    uint32_t entries;
+};
+
+struct glyph_cache
+{
+    hashmap_t index;
+    struct glyph_entry *head;
+    struct glyph_entry *tail;
+    size_t budget;
+    uint64_t frame;
+    glyph_load_fn load;
+    glyph_unload_fn unload;
+    void *ctx;
+    struct glyph_cache_stats stats;
+};
+
+void glyph_cache_init(struct glyph_cache *, size_t budget,
+                      glyph_load_fn, glyph_unload_fn, void *ctx);
+void glyph_cache_destroy(struct glyph_cache *);
+void glyph_cache_begin_frame(struct glyph_cache *);
+void *glyph_cache_get(struct glyph_cache *, uint64_t key);
+uint32_t glyph_cache_evict_if(struct glyph_cache *, glyph_pick_fn, void *ctx);
+void glyph_cache_print_stats(struct glyph_cache *, FILE *);
+
+#endif // GLYPHCACHE_H
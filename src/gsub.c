@@ -0,0 +1,801 @@
+#include <stdlib.h>
+#include <string.h>
+#include "gsub.h"
+
+#define MAX_NESTING 8
+#define MAX_CONTEXT 64
+
+enum
+{
+    LOOKUP_SINGLE       = 1,
+    LOOKUP_MULTIPLE     = 2,
+    LOOKUP_ALTERNATE    = 3,
+    LOOKUP_LIGATURE     = 4,
+    LOOKUP_CONTEXT      = 5,
+    LOOKUP_CHAIN        = 6,
+    LOOKUP_EXTENSION    = 7,
+};
+
+enum
+{
+    IGNORE_BASE_GLYPHS  = 0x0002,
+    IGNORE_LIGATURES    = 0x0004,
+    IGNORE_MARKS        = 0x0008,
+    MARK_ATTACHMENT     = 0xff00,
+};
+
+enum
+{
+    CLASS_BASE      = 1,
+    CLASS_LIGATURE  = 2,
+    CLASS_MARK      = 3,
+};
+
+static uint16_t u16(const uint8_t *p)
+{
+    return p[0] << 8 | p[1];
+}
+
+static uint32_t u32(const uint8_t *p)
+{
+    return (uint32_t) u16(p) << 16 | u16(p + 2);
+}
+
+/**
+ * The coverage table subtable s of lookup checks the first glyph against,
+ * or NULL if it's of a type that never applies.
+ */
+static const uint8_t *subtable_coverage(const uint8_t *lookup, int s)
+{
+    uint16_t type = u16(lookup);
+    const uint8_t *st = lookup + u16(lookup + 6 + 2 * s);
+    if (type == LOOKUP_EXTENSION)
+    {
+        type = u16(st + 2);
+        st += u32(st + 4);
+    }
+
+    uint16_t format = u16(st);
+    if (type == LOOKUP_CONTEXT && format == 3)
+        return st + u16(st + 6);
+    if (type == LOOKUP_CHAIN && format == 3)
+    {
+        const uint8_t *input = st + 4 + 2 * u16(st + 2);
+        return u16(input) ? st + u16(input + 2) : NULL;
+    }
+    if (type >= LOOKUP_SINGLE && type <= LOOKUP_CHAIN)
+        return st + u16(st + 2);
+    return NULL;
+}
+
+/**
+ * Call covered for every glyph in a coverage table, with ctx. Returns the
+ * highest one, or -1 if there are none.
+ */
+static int32_t each_covered(const uint8_t *coverage,
+                            void (*covered)(void *, uint16_t), void *ctx)
+{
+    uint16_t format = u16(coverage), count = u16(coverage + 2);
+    int32_t last = -1;
+    for (int i = 0; i < count; i++)
+    {
+        uint16_t start, end;
+        if (format == 1)
+            start = end = u16(coverage + 4 + 2 * i);
+        else if (format == 2)
+        {
+            start = u16(coverage + 4 + 6 * i);
+            end = u16(coverage + 4 + 6 * i + 2);
+        }
+        else
+            break;
+
+        if (covered != NULL)
+            for (uint32_t g = start; g <= end; g++)
+                covered(ctx, g);
+        if (end > last) last = end;
+    }
+    return last;
+}
+
+static void set_covered(void *ctx, uint16_t glyph)
+{
+    uint64_t *bits = ctx;
+    bits[glyph / 64] |= (uint64_t) 1 << glyph % 64;
+}
+
+static const uint8_t *get_lookup(struct ttf_gsub *gsub, uint16_t index)
+{
+    return gsub->lookup_list + u16(gsub->lookup_list + 2 + 2 * index);
+}
+
+RESULT ttf_parse_gsub(struct ttf_gsub *gsub, void *table, void *gdef)
+{
+    const uint8_t *t = table;
+    if (u16(t) != 1) return ERR; // major version
+
+    gsub->table = t;
+    gsub->script_list = t + u16(t + 4);
+    gsub->feature_list = t + u16(t + 6);
+    gsub->lookup_list = t + u16(t + 8);
+    gsub->lookup_count = u16(gsub->lookup_list);
+
+    gsub->glyph_classes = NULL;
+    gsub->mark_classes = NULL;
+    if (gdef != NULL)
+    {
+        const uint8_t *g = gdef;
+        if (u16(g + 4)) gsub->glyph_classes = g + u16(g + 4);
+        if (u16(g + 10)) gsub->mark_classes = g + u16(g + 10);
+    }
+
+    // every glyph each lookup could start at, one bit each up to the
+    // highest, so the others can skip the lookup without a look at any of
+    // its subtables
+    uint16_t n = gsub->lookup_count;
+    gsub->coverage_offsets = malloc(sizeof(*gsub->coverage_offsets) * (n + 1));
+    uint32_t words = 0;
+    for (uint16_t l = 0; l < n; l++)
+    {
+        const uint8_t *lookup = get_lookup(gsub, l);
+        int32_t last = -1;
+        for (int s = 0; s < u16(lookup + 4); s++)
+        {
+            const uint8_t *coverage = subtable_coverage(lookup, s);
+            if (coverage == NULL) continue;
+            int32_t covered = each_covered(coverage, NULL, NULL);
+            if (covered > last) last = covered;
+        }
+        gsub->coverage_offsets[l] = words;
+        words += (last + 64) / 64;
+    }
+    gsub->coverage_offsets[n] = words;
+
+    gsub->coverage_bits = calloc(words ? words : 1,
+                                 sizeof(*gsub->coverage_bits));
+    for (uint16_t l = 0; l < n; l++)
+    {
+        const uint8_t *lookup = get_lookup(gsub, l);
+        uint64_t *bits = gsub->coverage_bits + gsub->coverage_offsets[l];
+        for (int s = 0; s < u16(lookup + 4); s++)
+        {
+            const uint8_t *coverage = subtable_coverage(lookup, s);
+            if (coverage != NULL) each_covered(coverage, set_covered, bits);
+        }
+    }
+
+    return OK;
+}
+
+void ttf_gsub_free(struct ttf_gsub *gsub)
+{
+    free(gsub->coverage_offsets);
+    free(gsub->coverage_bits);
+}
+
+static int coverage_index(const uint8_t *coverage, uint16_t glyph)
+{
+    uint16_t format = u16(coverage);
+    int a = 0, b = u16(coverage + 2);
+
+    while (a < b)
+    {
+        int mid = (a + b) / 2;
+        if (format == 1)
+        {
+            uint16_t g = u16(coverage + 4 + 2 * mid);
+            if (g == glyph) return mid;
+            if (g < glyph) a = mid + 1;
+            else b = mid;
+        }
+        else if (format == 2)
+        {
+            const uint8_t *range = coverage + 4 + 6 * mid;
+            if (glyph < u16(range)) b = mid;
+            else if (glyph > u16(range + 2)) a = mid + 1;
+            else return u16(range + 4) + glyph - u16(range);
+        }
+        else
+        {
+            return -1;
+        }
+    }
+
+    return -1;
+}
+
+static uint16_t class_of(const uint8_t *class_def, uint16_t glyph)
+{
+    if (class_def == NULL) return 0;
+
+    uint16_t format = u16(class_def);
+    if (format == 1)
+    {
+        uint16_t start = u16(class_def + 2);
+        uint16_t count = u16(class_def + 4);
+        if (glyph < start || glyph >= start + count) return 0;
+        return u16(class_def + 6 + 2 * (glyph - start));
+    }
+
+    if (format == 2)
+    {
+        int a = 0, b = u16(class_def + 2);
+        while (a < b)
+        {
+            int mid = (a + b) / 2;
+            const uint8_t *range = class_def + 4 + 6 * mid;
+            if (glyph < u16(range)) b = mid;
+            else if (glyph > u16(range + 2)) a = mid + 1;
+            else return u16(range + 4);
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Find the default LangSys of script, or NULL if the font doesn't have it.
+ */
+static const uint8_t *find_langsys(struct ttf_gsub *gsub, uint32_t script)
+{
+    const uint8_t *list = gsub->script_list;
+    uint16_t count = u16(list);
+    for (int i = 0; i < count; i++)
+    {
+        const uint8_t *record = list + 2 + 6 * i;
+        if (u32(record) != script) continue;
+
+        const uint8_t *table = list + u16(record + 4);
+        uint16_t offset = u16(table);
+        return offset ? table + offset : NULL;
+    }
+    return NULL;
+}
+
+bool gsub_has_script(struct ttf_gsub *gsub, uint32_t script)
+{
+    return find_langsys(gsub, script) != NULL;
+}
+
+/**
+ * Collect the lookups feature uses under script, in lookup list order.
+ * Returns how many were written to lookups.
+ */
+int gsub_feature_lookups(struct ttf_gsub *gsub, uint32_t script,
+                         uint32_t feature, uint16_t *lookups, int max)
+{
+    const uint8_t *langsys = find_langsys(gsub, script);
+    if (langsys == NULL) return 0;
+
+    int n = 0;
+    uint16_t required = u16(langsys + 2);
+    uint16_t count = u16(langsys + 4);
+    for (int i = -1; i < count; i++)
+    {
+        uint16_t index = i < 0 ? required : u16(langsys + 6 + 2 * i);
+        if (index == 0xffff || index >= u16(gsub->feature_list)) continue;
+
+        const uint8_t *record = gsub->feature_list + 2 + 6 * index;
+        if (u32(record) != feature) continue;
+
+        const uint8_t *table = gsub->feature_list + u16(record + 4);
+        uint16_t lookup_count = u16(table + 2);
+        for (int j = 0; j < lookup_count && n < max; j++)
+            lookups[n++] = u16(table + 4 + 2 * j);
+    }
+
+    // insertion sort, these lists are tiny
+    for (int i = 1; i < n; i++)
+        for (int j = i; j > 0 && lookups[j - 1] > lookups[j]; j--)
+        {
+            uint16_t tmp = lookups[j];
+            lookups[j] = lookups[j - 1];
+            lookups[j - 1] = tmp;
+        }
+
+    return n;
+}
+
+void gsub_buffer_push(struct gsub_buffer *buf, struct gsub_glyph glyph)
+{
+    if (buf->len >= buf->cap)
+    {
+        buf->cap = buf->cap ? buf->cap * 2 : 16;
+        buf->glyphs = realloc(buf->glyphs, sizeof(*buf->glyphs) * buf->cap);
+    }
+    buf->glyphs[buf->len++] = glyph;
+}
+
+void gsub_buffer_free(struct gsub_buffer *buf)
+{
+    free(buf->glyphs);
+    buf->glyphs = NULL;
+    buf->len = buf->cap = 0;
+}
+
+/**
+ * Replace the glyph at i with count glyphs, all inheriting its properties.
+ */
+static void buffer_replace(struct gsub_buffer *buf, uint32_t i,
+                           const uint8_t *glyphs, uint16_t count)
+{
+    struct gsub_glyph proto = buf->glyphs[i];
+    proto.substituted = true;
+
+    if (buf->len + count > buf->cap)
+    {
+        while (buf->len + count > buf->cap) buf->cap *= 2;
+        buf->glyphs = realloc(buf->glyphs, sizeof(*buf->glyphs) * buf->cap);
+    }
+
+    memmove(&buf->glyphs[i + count], &buf->glyphs[i + 1],
+            sizeof(*buf->glyphs) * (buf->len - i - 1));
+    buf->len += count - 1;
+
+    for (int k = 0; k < count; k++)
+    {
+        buf->glyphs[i + k] = proto;
+        buf->glyphs[i + k].glyph = u16(glyphs + 2 * k);
+    }
+}
+
+static void buffer_remove(struct gsub_buffer *buf, uint32_t i)
+{
+    memmove(&buf->glyphs[i], &buf->glyphs[i + 1],
+            sizeof(*buf->glyphs) * (buf->len - i - 1));
+    buf->len--;
+}
+
+static bool ignored(struct ttf_gsub *gsub, uint16_t flag, uint16_t glyph)
+{
+    if (gsub->glyph_classes == NULL) return false;
+
+    uint16_t c = class_of(gsub->glyph_classes, glyph);
+    if (c == CLASS_BASE && (flag & IGNORE_BASE_GLYPHS)) return true;
+    if (c == CLASS_LIGATURE && (flag & IGNORE_LIGATURES)) return true;
+    if (c == CLASS_MARK)
+    {
+        if (flag & IGNORE_MARKS) return true;
+        if ((flag & MARK_ATTACHMENT)
+                && class_of(gsub->mark_classes, glyph) != flag >> 8)
+            return true;
+    }
+    return false;
+}
+
+static int64_t next_pos(struct ttf_gsub *gsub, struct gsub_buffer *buf,
+                        uint16_t flag, int64_t i)
+{
+    while (++i < buf->len)
+        if (!ignored(gsub, flag, buf->glyphs[i].glyph)) return i;
+    return -1;
+}
+
+static int64_t prev_pos(struct ttf_gsub *gsub, struct gsub_buffer *buf,
+                        uint16_t flag, int64_t i)
+{
+    while (--i >= 0)
+        if (!ignored(gsub, flag, buf->glyphs[i].glyph)) return i;
+    return -1;
+}
+
+// What the entries of a context rule's sequences are compared against.
+enum { MATCH_GLYPH, MATCH_CLASS, MATCH_COVERAGE };
+
+struct sequence
+{
+    int kind;
+    const uint8_t *values; // big endian u16s
+    const uint8_t *base;   // what coverage offsets are relative to
+    const uint8_t *class_def;
+};
+
+static bool match_one(struct sequence *seq, int index, uint16_t glyph)
+{
+    uint16_t value = u16(seq->values + 2 * index);
+    switch (seq->kind)
+    {
+        case MATCH_GLYPH: return value == glyph;
+        case MATCH_CLASS: return value == class_of(seq->class_def, glyph);
+        default: return coverage_index(seq->base + value, glyph) >= 0;
+    }
+}
+
+/**
+ * Match count input glyphs starting at i, filling in their positions. If
+ * skip_first, the sequence doesn't have an entry for the first glyph since
+ * the coverage table already checked it.
+ */
+static bool match_input(struct ttf_gsub *gsub, struct gsub_buffer *buf,
+                        uint16_t flag, uint32_t i, int count,
+                        struct sequence *seq, bool skip_first,
+                        uint32_t *positions)
+{
+    if (count > MAX_CONTEXT) return false;
+    if (!skip_first && !match_one(seq, 0, buf->glyphs[i].glyph)) return false;
+
+    positions[0] = i;
+    int64_t p = i;
+    for (int k = 1; k < count; k++)
+    {
+        p = next_pos(gsub, buf, flag, p);
+        if (p < 0) return false;
+        if (!match_one(seq, skip_first ? k - 1 : k, buf->glyphs[p].glyph))
+            return false;
+        positions[k] = p;
+    }
+    return true;
+}
+
+static bool match_backtrack(struct ttf_gsub *gsub, struct gsub_buffer *buf,
+                            uint16_t flag, uint32_t i, int count,
+                            struct sequence *seq)
+{
+    int64_t p = i;
+    for (int k = 0; k < count; k++)
+    {
+        p = prev_pos(gsub, buf, flag, p);
+        if (p < 0 || !match_one(seq, k, buf->glyphs[p].glyph)) return false;
+    }
+    return true;
+}
+
+static bool match_lookahead(struct ttf_gsub *gsub, struct gsub_buffer *buf,
+                            uint16_t flag, uint32_t last, int count,
+                            struct sequence *seq)
+{
+    int64_t p = last;
+    for (int k = 0; k < count; k++)
+    {
+        p = next_pos(gsub, buf, flag, p);
+        if (p < 0 || !match_one(seq, k, buf->glyphs[p].glyph)) return false;
+    }
+    return true;
+}
+
+static bool apply_lookup_at(struct ttf_gsub *, uint16_t lookup,
+                            struct gsub_buffer *, uint32_t i,
+                            uint32_t *next, int depth);
+
+/**
+ * Run the nested lookups of a matched context rule, keeping the matched
+ * positions up to date as the buffer grows or shrinks under them.
+ */
+static void apply_records(struct ttf_gsub *gsub, struct gsub_buffer *buf,
+                          uint32_t *positions, int count,
+                          const uint8_t *records, uint16_t num_records,
+                          uint32_t *next, int depth)
+{
+    uint32_t end = positions[count - 1] + 1;
+
+    for (int r = 0; r < num_records; r++)
+    {
+        uint16_t index = u16(records + 4 * r);
+        uint16_t lookup = u16(records + 4 * r + 2);
+        if (index >= count) continue;
+
+        uint32_t old_len = buf->len, ignore;
+        apply_lookup_at(gsub, lookup, buf, positions[index], &ignore, depth + 1);
+
+        int64_t delta = (int64_t) buf->len - old_len;
+        if (delta == 0) continue;
+        for (int k = index + 1; k < count; k++)
+            positions[k] += delta;
+        end += delta;
+    }
+
+    *next = end;
+}
+
+static bool apply_context(struct ttf_gsub *gsub, uint16_t flag,
+                          const uint8_t *st, struct gsub_buffer *buf,
+                          uint32_t i, uint32_t *next, int depth)
+{
+    uint16_t format = u16(st);
+    uint16_t glyph = buf->glyphs[i].glyph;
+    uint32_t positions[MAX_CONTEXT];
+
+    if (format == 1 || format == 2)
+    {
+        int index = coverage_index(st + u16(st + 2), glyph);
+        if (index < 0) return false;
+
+        struct sequence seq = { MATCH_GLYPH, NULL, NULL, NULL };
+        const uint8_t *sets = st + 4;
+        if (format == 2)
+        {
+            seq.kind = MATCH_CLASS;
+            seq.class_def = st + u16(st + 4);
+            index = class_of(seq.class_def, glyph);
+            sets = st + 6;
+        }
+
+        if (index >= u16(sets)) return false;
+        uint16_t set_offset = u16(sets + 2 + 2 * index);
+        if (set_offset == 0) return false;
+        const uint8_t *set = st + set_offset;
+
+        for (int r = 0; r < u16(set); r++)
+        {
+            const uint8_t *rule = set + u16(set + 2 + 2 * r);
+            uint16_t count = u16(rule);
+            uint16_t num_records = u16(rule + 2);
+            seq.values = rule + 4;
+            if (!match_input(gsub, buf, flag, i, count, &seq, true, positions))
+                continue;
+
+            apply_records(gsub, buf, positions, count,
+                          rule + 4 + 2 * (count - 1), num_records, next, depth);
+            return true;
+        }
+        return false;
+    }
+
+    if (format == 3)
+    {
+        uint16_t count = u16(st + 2);
+        uint16_t num_records = u16(st + 4);
+        struct sequence seq = { MATCH_COVERAGE, st + 6, st, NULL };
+        if (count == 0) return false;
+        if (!match_input(gsub, buf, flag, i, count, &seq, false, positions))
+            return false;
+
+        apply_records(gsub, buf, positions, count, st + 6 + 2 * count,
+                      num_records, next, depth);
+        return true;
+    }
+
+    return false;
+}
+
+static bool apply_chain(struct ttf_gsub *gsub, uint16_t flag,
+                        const uint8_t *st, struct gsub_buffer *buf,
+                        uint32_t i, uint32_t *next, int depth)
+{
+    uint16_t format = u16(st);
+    uint16_t glyph = buf->glyphs[i].glyph;
+    uint32_t positions[MAX_CONTEXT];
+
+    if (format == 1 || format == 2)
+    {
+        int index = coverage_index(st + u16(st + 2), glyph);
+        if (index < 0) return false;
+
+        struct sequence back = { MATCH_GLYPH, NULL, NULL, NULL };
+        struct sequence input = back, ahead = back;
+        const uint8_t *sets = st + 4;
+        if (format == 2)
+        {
+            back.kind = input.kind = ahead.kind = MATCH_CLASS;
+            back.class_def = st + u16(st + 4);
+            input.class_def = st + u16(st + 6);
+            ahead.class_def = st + u16(st + 8);
+            index = class_of(input.class_def, glyph);
+            sets = st + 10;
+        }
+
+        if (index >= u16(sets)) return false;
+        uint16_t set_offset = u16(sets + 2 + 2 * index);
+        if (set_offset == 0) return false;
+        const uint8_t *set = st + set_offset;
+
+        for (int r = 0; r < u16(set); r++)
+        {
+            const uint8_t *rule = set + u16(set + 2 + 2 * r);
+
+            uint16_t back_count = u16(rule);
+            back.values = rule + 2;
+            rule += 2 + 2 * back_count;
+
+            uint16_t input_count = u16(rule);
+            input.values = rule + 2;
+            if (input_count == 0) continue;
+            rule += 2 + 2 * (input_count - 1);
+
+            uint16_t ahead_count = u16(rule);
+            ahead.values = rule + 2;
+            rule += 2 + 2 * ahead_count;
+
+            if (!match_input(gsub, buf, flag, i, input_count, &input, true, positions))
+                continue;
+            if (!match_backtrack(gsub, buf, flag, i, back_count, &back))
+                continue;
+            if (!match_lookahead(gsub, buf, flag, positions[input_count - 1],
+                                 ahead_count, &ahead))
+                continue;
+
+            apply_records(gsub, buf, positions, input_count, rule + 2,
+                          u16(rule), next, depth);
+            return true;
+        }
+        return false;
+    }
+
+    if (format == 3)
+    {
+        const uint8_t *p = st + 2;
+        struct sequence back = { MATCH_COVERAGE, p + 2, st, NULL };
+        uint16_t back_count = u16(p);
+        p += 2 + 2 * back_count;
+
+        struct sequence input = { MATCH_COVERAGE, p + 2, st, NULL };
+        uint16_t input_count = u16(p);
+        p += 2 + 2 * input_count;
+
+        struct sequence ahead = { MATCH_COVERAGE, p + 2, st, NULL };
+        uint16_t ahead_count = u16(p);
+        p += 2 + 2 * ahead_count;
+
+        if (input_count == 0) return false;
+        if (!match_input(gsub, buf, flag, i, input_count, &input, false, positions))
+            return false;
+        if (!match_backtrack(gsub, buf, flag, i, back_count, &back))
+            return false;
+        if (!match_lookahead(gsub, buf, flag, positions[input_count - 1],
+                             ahead_count, &ahead))
+            return false;
+
+        apply_records(gsub, buf, positions, input_count, p + 2, u16(p),
+                      next, depth);
+        return true;
+    }
+
+    return false;
+}
+
+static bool apply_ligature(struct ttf_gsub *gsub, uint16_t flag,
+                           const uint8_t *st, struct gsub_buffer *buf,
+                           uint32_t i, uint32_t *next)
+{
+    int index = coverage_index(st + u16(st + 2), buf->glyphs[i].glyph);
+    if (index < 0 || index >= u16(st + 4)) return false;
+
+    const uint8_t *set = st + u16(st + 6 + 2 * index);
+    uint32_t positions[MAX_CONTEXT];
+
+    // ligatures are listed in order of preference
+    for (int l = 0; l < u16(set); l++)
+    {
+        const uint8_t *lig = set + u16(set + 2 + 2 * l);
+        uint16_t count = u16(lig + 2);
+        struct sequence seq = { MATCH_GLYPH, lig + 4, NULL, NULL };
+        if (count == 0 || !match_input(gsub, buf, flag, i, count, &seq, true, positions))
+            continue;
+
+        buf->glyphs[i].glyph = u16(lig);
+        buf->glyphs[i].substituted = true;
+
+        // back to front so the positions stay valid
+        for (int k = count - 1; k > 0; k--)
+            buffer_remove(buf, positions[k]);
+
+        *next = i + 1;
+        return true;
+    }
+
+    return false;
+}
+
+static bool apply_subtable(struct ttf_gsub *gsub, uint16_t type, uint16_t flag,
+                           const uint8_t *st, struct gsub_buffer *buf,
+                           uint32_t i, uint32_t *next, int depth)
+{
+    struct gsub_glyph *g = &buf->glyphs[i];
+
+    switch (type)
+    {
+        case LOOKUP_SINGLE:
+        {
+            int index = coverage_index(st + u16(st + 2), g->glyph);
+            if (index < 0) return false;
+            if (u16(st) == 1)
+                g->glyph += u16(st + 4);
+            else if (index < u16(st + 4))
+                g->glyph = u16(st + 6 + 2 * index);
+            else
+                return false;
+            g->substituted = true;
+            *next = i + 1;
+            return true;
+        }
+
+        case LOOKUP_MULTIPLE:
+        case LOOKUP_ALTERNATE:
+        {
+            int index = coverage_index(st + u16(st + 2), g->glyph);
+            if (index < 0 || index >= u16(st + 4)) return false;
+
+            const uint8_t *seq = st + u16(st + 6 + 2 * index);
+            uint16_t count = u16(seq);
+            // without a way to pick, the first alternate is as good as any
+            if (type == LOOKUP_ALTERNATE && count > 1) count = 1;
+            if (count == 0 && buf->len == 1) return false;
+
+            if (count == 0)
+                buffer_remove(buf, i);
+            else
+                buffer_replace(buf, i, seq + 2, count);
+            *next = i + count;
+            return true;
+        }
+
+        case LOOKUP_LIGATURE:
+            return apply_ligature(gsub, flag, st, buf, i, next);
+
+        case LOOKUP_CONTEXT:
+            return apply_context(gsub, flag, st, buf, i, next, depth);
+
+        case LOOKUP_CHAIN:
+            return apply_chain(gsub, flag, st, buf, i, next, depth);
+    }
+
+    return false;
+}
+
+static bool apply_lookup_at(struct ttf_gsub *gsub, uint16_t index,
+                            struct gsub_buffer *buf, uint32_t i,
+                            uint32_t *next, int depth)
+{
+    if (depth > MAX_NESTING || i >= buf->len
+            || !gsub_lookup_covers(gsub, index, buf->glyphs[i].glyph))
+        return false;
+
+    const uint8_t *lookup = get_lookup(gsub, index);
+    uint16_t type = u16(lookup);
+    uint16_t flag = u16(lookup + 2);
+    uint16_t count = u16(lookup + 4);
+
+    if (ignored(gsub, flag, buf->glyphs[i].glyph)) return false;
+
+    for (int s = 0; s < count; s++)
+    {
+        const uint8_t *st = lookup + u16(lookup + 6 + 2 * s);
+        uint16_t st_type = type;
+        if (type == LOOKUP_EXTENSION)
+        {
+            st_type = u16(st + 2);
+            st += u32(st + 4);
+        }
+
+        if (apply_subtable(gsub, st_type, flag, st, buf, i, next, depth))
+            return true;
+    }
+
+    return false;
+}
+
+/**
+ * Whether lookup could start matching at glyph, from the coverage
+ * ttf_parse_gsub() collected. Every subtable checks the first glyph against
+ * a coverage table before anything else, so a run of glyphs none of which
+ * are covered passes through the lookup untouched.
+ */
+bool gsub_lookup_covers(struct ttf_gsub *gsub, uint16_t index, uint16_t glyph)
+{
+    if (index >= gsub->lookup_count) return false;
+
+    uint32_t first = gsub->coverage_offsets[index];
+    uint32_t words = gsub->coverage_offsets[index + 1] - first;
+    if (glyph / 64u >= words) return false;
+    return gsub->coverage_bits[first + glyph / 64] >> glyph % 64 & 1;
+}
+
+/**
+ * Apply a lookup once across the buffer, to glyphs whose mask shares a bit
+ * with mask.
+ */
+void gsub_apply_lookup(struct ttf_gsub *gsub, uint16_t lookup, uint32_t mask,
+                       struct gsub_buffer *buf)
+{
+    uint32_t i = 0;
+    while (i < buf->len)
+    {
+        uint32_t next, len = buf->len;
+        if ((buf->glyphs[i].mask & mask)
+                && apply_lookup_at(gsub, lookup, buf, i, &next, 0)
+                && (next > i || buf->len < len))
+            i = next;
+        else
+            i++;
+    }
+}
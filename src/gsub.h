@@ -0,0 +1,57 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include "truetype.h"
+
+#ifndef GSUB_H
+#define GSUB_H
+
+// Glyph substitution: single, multiple, alternate, ligature, contextual and
+// chained contextual lookups, applied straight from the font data. Lookups
+// only touch glyphs whose mask has one of the bits asked for, which is how
+// features get restricted to parts of a syllable.
+
+struct gsub_glyph
+{
+    uint16_t glyph;
+    bool substituted;
+    // for whoever fills the buffer, gsub just copies them along
+    uint8_t category;
+    uint16_t syllable;
+    uint32_t mask;
+};
+
+struct gsub_buffer
+{
+    struct gsub_glyph *glyphs;
+    uint32_t len;
+    uint32_t cap;
+};
+
+struct ttf_gsub
+{
+    const uint8_t *table;
+    const uint8_t *script_list;
+    const uint8_t *feature_list;
+    const uint8_t *lookup_list;
+    uint16_t lookup_count;
+    const uint8_t *glyph_classes; // from GDEF, may be NULL
+    const uint8_t *mark_classes;  // from GDEF, may be NULL
+    // per lookup, a bit for every glyph it could start matching at, see
+    // gsub_lookup_covers(); lookup i's are words offsets[i] to offsets[i + 1]
+    uint32_t *coverage_offsets;
+    uint64_t *coverage_bits;
+};
+
+RESULT ttf_parse_gsub(struct ttf_gsub *, void *gsub, void *gdef);
+void ttf_gsub_free(struct ttf_gsub *);
+bool gsub_has_script(struct ttf_gsub *, uint32_t script);
+int gsub_feature_lookups(struct ttf_gsub *, uint32_t script, uint32_t feature,
+                         uint16_t *lookups, int max);
+bool gsub_lookup_covers(struct ttf_gsub *, uint16_t lookup, uint16_t glyph);
+void gsub_apply_lookup(struct ttf_gsub *, uint16_t lookup, uint32_t mask,
+                       struct gsub_buffer *);
+
+void gsub_buffer_push(struct gsub_buffer *, struct gsub_glyph);
+void gsub_buffer_free(struct gsub_buffer *);
+
+#endif // GSUB_H
@@ -0,0 +1,144 @@
+#include <stdlib.h>
+#include "hashmap.h"
+
+// grow once the map is 80% full
+#define HASHMAP_FULL(len, cap) ((uint64_t) (len) * 5 >= (uint64_t) (cap) * 4)
+
+uint64_t hashmap_hash(uint64_t key)
+{
+    // fibonacci hashing: one multiply, and the high bits (which are the ones
+    // that end up picking the bucket) depend on every bit of the key
+    key ^= key >> 32;
+    return key * 0x9e3779b97f4a7c15;
+}
+
+static uint32_t hashmap_home(hashmap_t *map, uint64_t key)
+{
+    return hashmap_hash(key) >> (64 - __builtin_ctz(map->cap));
+}
+
+hashmap_t hashmap_create(uint32_t initial_cap)
+{
+    hashmap_t map;
+    map.cap = 8;
+    while (map.cap < initial_cap && map.cap < 0x80000000)
+        map.cap *= 2;
+    map.len = 0;
+    map.buckets = calloc(map.cap, sizeof(struct hashmap_bucket));
+    return map;
+}
+
+void hashmap_destroy(hashmap_t *map)
+{
+    free(map->buckets);
+    map->buckets = NULL;
+    map->cap = 0;
+    map->len = 0;
+}
+
+static struct hashmap_bucket *hashmap_find(hashmap_t *map, uint64_t key)
+{
+    uint32_t mask = map->cap - 1;
+    uint32_t i = hashmap_home(map, key);
+    for (uint32_t dist = 1; ; dist++, i = (i + 1) & mask)
+    {
+        struct hashmap_bucket *bucket = &map->buckets[i];
+        // a richer bucket means our key would have displaced it
+        if (bucket->dist < dist) return NULL;
+        if (bucket->key == key) return bucket;
+    }
+}
+
+static void *hashmap_place(hashmap_t *map, struct hashmap_bucket cur)
+{
+    uint32_t mask = map->cap - 1;
+    uint32_t i = hashmap_home(map, cur.key);
+    for (cur.dist = 1; ; cur.dist++, i = (i + 1) & mask)
+    {
+        struct hashmap_bucket *bucket = &map->buckets[i];
+        if (bucket->dist == 0)
+        {
+            *bucket = cur;
+            map->len++;
+            return NULL;
+        }
+
+        if (bucket->dist == cur.dist && bucket->key == cur.key)
+        {
+            void *old = bucket->value;
+            bucket->value = cur.value;
+            return old;
+        }
+
+        // take from the rich, give to the poor
+        if (bucket->dist < cur.dist)
+        {
+            struct hashmap_bucket tmp = *bucket;
+            *bucket = cur;
+            cur = tmp;
+        }
+    }
+}
+
+static void hashmap_grow(hashmap_t *map)
+{
+    struct hashmap_bucket *old_buckets = map->buckets;
+    uint32_t old_cap = map->cap;
+
+    map->cap *= 2;
+    map->len = 0;
+    map->buckets = calloc(map->cap, sizeof(struct hashmap_bucket));
+
+    for (uint32_t i = 0; i < old_cap; i++)
+        if (old_buckets[i].dist)
+            hashmap_place(map, old_buckets[i]);
+
+    free(old_buckets);
+}
+
+/**
+ * Insert or replace the value stored under key.
+ * Returns the previous value, or NULL if the key was not present.
+ */
+void *hashmap_insert(hashmap_t *map, uint64_t key, void *value)
+{
+    if (HASHMAP_FULL(map->len + 1, map->cap) && map->cap < 0x80000000)
+        hashmap_grow(map);
+
+    struct hashmap_bucket bucket = { key, value, 0 };
+    return hashmap_place(map, bucket);
+}
+
+void *hashmap_get(hashmap_t *map, uint64_t key)
+{
+    struct hashmap_bucket *bucket = hashmap_find(map, key);
+    return bucket ? bucket->value : NULL;
+}
+
+/**
+ * Remove key from the map, returning the value it had.
+ */
+void *hashmap_remove(hashmap_t *map, uint64_t key)
+{
+    struct hashmap_bucket *bucket = hashmap_find(map, key);
+    if (bucket == NULL) return NULL;
+
+    void *value = bucket->value;
+    uint32_t mask = map->cap - 1;
+    uint32_t i = bucket - map->buckets;
+
+    // backward shift: pull the rest of the run one step closer to home
+    for (;;)
+    {
+        uint32_t next = (i + 1) & mask;
+        if (map->buckets[next].dist <= 1) break;
+        map->buckets[i] = map->buckets[next];
+        map->buckets[i].dist--;
+        i = next;
+    }
+    map->buckets[i].dist = 0;
+    map->buckets[i].value = NULL;
+
+    map->len--;
+    return value;
+}
@@ -0,0 +1,31 @@
+#include <stdint.h>
+
+#ifndef HASHMAP_H
+#define HASHMAP_H
+
+// Open addressing with robin hood probing. Buckets remember how far they are
+// from their home slot, so lookups can stop early on a miss and removal can
+// shift the following run back instead of leaving tombstones behind.
+
+struct hashmap_bucket
+{
+    uint64_t key;
+    void *value;
+    uint32_t dist; // probe distance + 1, 0 marks an empty bucket
+};
+
+typedef struct
+{
+    struct hashmap_bucket *buckets;
+    uint32_t cap;
+    uint32_t len;
+} hashmap_t;
+
+hashmap_t hashmap_create(uint32_t);
+void hashmap_destroy(hashmap_t *);
+void *hashmap_insert(hashmap_t *, uint64_t, void *);
+void *hashmap_get(hashmap_t *, uint64_t);
+void *hashmap_remove(hashmap_t *, uint64_t);
+uint64_t hashmap_hash(uint64_t);
+
+#endif // HASHMAP_H
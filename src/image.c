@@ -0,0 +1,291 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include "image.h"
+
+void image_alloc(struct image *image, int width, int height)
+{
+    image->width = width;
+    image->height = height;
+    image->pixels = malloc((size_t) width * height);
+    image_clear(image);
+}
+
+void image_free(struct image *image)
+{
+    free(image->pixels);
+    image->pixels = NULL;
+}
+
+void image_clear(struct image *image)
+{
+    memset(image->pixels, 255, (size_t) image->width * image->height);
+}
+
+// crc_table[k][n] is the CRC of byte n followed by k zero bytes, which is
+// what lets crc32_update() take eight bytes per step instead of one
+static uint32_t crc_table[8][256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static void make_crc_table(void)
+{
+    for (uint32_t n = 0; n < 256; n++)
+    {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++)
+            c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+        crc_table[0][n] = c;
+    }
+    for (int k = 1; k < 8; k++)
+        for (int n = 0; n < 256; n++)
+        {
+            uint32_t c = crc_table[k - 1][n];
+            crc_table[k][n] = crc_table[0][c & 0xff] ^ (c >> 8);
+        }
+}
+
+static uint32_t get_le32(const uint8_t *in)
+{
+    return in[0] | in[1] << 8 | in[2] << 16 | (uint32_t) in[3] << 24;
+}
+
+/**
+ * The CRC PNG chunks end with. Start from 0.
+ */
+uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t len)
+{
+    pthread_once(&crc_once, make_crc_table);
+    crc = ~crc;
+    for (; len >= 8; data += 8, len -= 8)
+    {
+        uint32_t lo = get_le32(data) ^ crc, hi = get_le32(data + 4);
+        crc = crc_table[7][lo & 0xff] ^ crc_table[6][lo >> 8 & 0xff]
+            ^ crc_table[5][lo >> 16 & 0xff] ^ crc_table[4][lo >> 24]
+            ^ crc_table[3][hi & 0xff] ^ crc_table[2][hi >> 8 & 0xff]
+            ^ crc_table[1][hi >> 16 & 0xff] ^ crc_table[0][hi >> 24];
+    }
+    for (size_t i = 0; i < len; i++)
+        crc = crc_table[0][(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+/**
+ * The checksum at the end of a zlib stream. Start from 1.
+ */
+uint32_t adler32_update(uint32_t adler, const uint8_t *data, size_t len)
+{
+    uint32_t a = adler & 0xffff, b = adler >> 16;
+    while (len > 0)
+    {
+        // the most bytes before b can overflow 32 bits
+        size_t n = len < 5552 ? len : 5552;
+        for (size_t i = 0; i < n; i++)
+        {
+            a += data[i];
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+        data += n;
+        len -= n;
+    }
+    return b << 16 | a;
+}
+
+static void put_be32(uint8_t *out, uint32_t value)
+{
+    out[0] = value >> 24;
+    out[1] = value >> 16;
+    out[2] = value >> 8;
+    out[3] = value;
+}
+
+/**
+ * One PNG chunk, with its data in two parts so headers don't have to be
+ * copied in front of what they head.
+ */
+static RESULT write_chunk(FILE *file, const char *type,
+                          const uint8_t *head, size_t head_len,
+                          const uint8_t *data, size_t data_len)
+{
+    uint8_t buf[8];
+    put_be32(buf, head_len + data_len);
+    memcpy(buf + 4, type, 4);
+
+    uint32_t crc = crc32_update(0, buf + 4, 4);
+    crc = crc32_update(crc, head, head_len);
+    crc = crc32_update(crc, data, data_len);
+
+    uint8_t tail[4];
+    put_be32(tail, crc);
+
+    if (fwrite(buf, 1, 8, file) != 8
+            || fwrite(head, 1, head_len, file) != head_len
+            || fwrite(data, 1, data_len, file) != data_len
+            || fwrite(tail, 1, 4, file) != 4)
+        return ERR;
+    return OK;
+}
+
+/**
+ * Write out the stored block filled so far, in an IDAT chunk of its own.
+ * The last one carries the end of the zlib stream too.
+ */
+static RESULT flush_block(struct image_writer *w, bool last)
+{
+    uint16_t len = w->block_len;
+    uint8_t head[5] = { last, len, len >> 8, ~len, ~len >> 8 };
+    w->adler = adler32_update(w->adler, w->block, w->block_len);
+
+    if (last)
+    {
+        // the checksum follows the data, and it's simplest to make room
+        put_be32(w->block + w->block_len, w->adler);
+        w->block_len += 4;
+    }
+
+    RESULT result = write_chunk(w->file, "IDAT", head, sizeof(head),
+                                w->block, w->block_len);
+    w->block_len = 0;
+    return result;
+}
+
+static RESULT push_bytes(struct image_writer *w, const uint8_t *data,
+                         size_t len)
+{
+    while (len > 0)
+    {
+        size_t n = IMAGE_PNG_BLOCK - w->block_len;
+        if (n > len) n = len;
+        memcpy(w->block + w->block_len, data, n);
+        w->block_len += n;
+        data += n;
+        len -= n;
+
+        if (w->block_len == IMAGE_PNG_BLOCK && flush_block(w, false) != OK)
+            return ERR;
+    }
+    return OK;
+}
+
+enum image_format image_format_for(const char *path)
+{
+    const char *dot = strrchr(path, '.');
+    return dot && strcmp(dot, ".png") == 0 ? IMAGE_PNG : IMAGE_PPM;
+}
+
+RESULT image_writer_begin(struct image_writer *w, FILE *file,
+                          enum image_format format, int width, int height)
+{
+    w->file = file;
+    w->format = format;
+    w->width = width;
+    w->height = height;
+    w->rows = 0;
+    w->row = NULL;
+    w->block = NULL;
+    w->block_len = 0;
+    w->adler = 1;
+
+    if (format == IMAGE_PPM)
+    {
+        w->row = malloc((size_t) width * 3);
+        return fprintf(file, "P6\n%d %d\n255\n", width, height) < 0
+            ? ERR : OK;
+    }
+
+    static const uint8_t signature[8] = { 137, 'P', 'N', 'G', 13, 10, 26, 10 };
+    // 8 bits of gray, and zeros for deflate, adaptive filtering and no
+    // interlacing
+    uint8_t ihdr[13] = { 0 };
+    put_be32(ihdr, width);
+    put_be32(ihdr + 4, height);
+    ihdr[8] = 8;
+    // no compression wanted, so say the fastest was used
+    static const uint8_t zlib_header[2] = { 0x78, 0x01 };
+
+    w->block = malloc(IMAGE_PNG_BLOCK + 4);
+    if (fwrite(signature, 1, sizeof(signature), file) != sizeof(signature)
+            || write_chunk(file, "IHDR", ihdr, sizeof(ihdr), NULL, 0) != OK
+            || write_chunk(file, "IDAT", zlib_header, sizeof(zlib_header),
+                           NULL, 0) != OK)
+        return ERR;
+    return OK;
+}
+
+/**
+ * Append count rows of width pixels each.
+ */
+RESULT image_writer_rows(struct image_writer *w, const uint8_t *rows,
+                         int count)
+{
+    if (w->rows + count > w->height) return ERR;
+
+    for (int y = 0; y < count; y++, rows += w->width)
+    {
+        if (w->format == IMAGE_PPM)
+        {
+            for (int x = 0; x < w->width; x++)
+                memset(w->row + x * 3, rows[x], 3);
+            if (fwrite(w->row, 3, w->width, w->file) != (size_t) w->width)
+                return ERR;
+            continue;
+        }
+
+        static const uint8_t filter = 0;
+        if (push_bytes(w, &filter, 1) != OK
+                || push_bytes(w, rows, w->width) != OK)
+            return ERR;
+    }
+
+    w->rows += count;
+    return OK;
+}
+
+/**
+ * Finish the file, which fails if fewer rows were written than promised.
+ * The writer is done with either way, and the file is left open.
+ */
+RESULT image_writer_end(struct image_writer *w)
+{
+    RESULT result = w->rows == w->height ? OK : ERR;
+    if (w->format == IMAGE_PNG && result == OK)
+    {
+        if (flush_block(w, true) != OK
+                || write_chunk(w->file, "IEND", NULL, 0, NULL, 0) != OK)
+            result = ERR;
+    }
+
+    free(w->row);
+    free(w->block);
+    return result;
+}
+
+/**
+ * Write image to path, as PNG if the name ends in .png and PPM otherwise.
+ */
+RESULT image_write(struct image *image, const char *path)
+{
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) return ERR;
+
+    RESULT result = image_write_file(image, file, image_format_for(path));
+    if (fclose(file) != 0) result = ERR;
+    return result;
+}
+
+/**
+ * Write image to an open file, which is left open.
+ */
+RESULT image_write_file(struct image *image, FILE *file,
+                        enum image_format format)
+{
+    struct image_writer w;
+    RESULT result = image_writer_begin(&w, file, format,
+                                       image->width, image->height);
+    if (result == OK)
+        result = image_writer_rows(&w, image->pixels, image->height);
+    if (image_writer_end(&w) != OK) result = ERR;
+    return result;
+}
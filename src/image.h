@@ -0,0 +1,56 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "truetype.h"
+
+#ifndef IMAGE_H
+#define IMAGE_H
+
+// bytes of pixel data per stored deflate block, and so per IDAT chunk
+#ifndef IMAGE_PNG_BLOCK
+#define IMAGE_PNG_BLOCK 65535
+#endif
+
+// 8-bit gray, rows top to bottom like image files, 255 is white.
+struct image
+{
+    int width;
+    int height;
+    uint8_t *pixels;
+};
+
+enum image_format { IMAGE_PPM, IMAGE_PNG };
+
+// Writes an image out a few rows at a time, so that it never has to be in
+// memory whole. PNGs are stored uncompressed inside their deflate stream:
+// text compresses well, but that's a job for whoever archives them, and
+// this way every byte of output costs next to nothing to produce.
+struct image_writer
+{
+    FILE *file;
+    enum image_format format;
+    int width, height;
+    int rows; // written so far
+    uint8_t *row; // ppm only, one row of RGB
+    uint8_t *block; // png only, the stored block being filled
+    size_t block_len;
+    uint32_t adler;
+};
+
+void image_alloc(struct image *, int width, int height);
+void image_free(struct image *);
+void image_clear(struct image *);
+
+enum image_format image_format_for(const char *path);
+RESULT image_writer_begin(struct image_writer *, FILE *, enum image_format,
+                          int width, int height);
+RESULT image_writer_rows(struct image_writer *, const uint8_t *rows,
+                         int count);
+RESULT image_writer_end(struct image_writer *);
+RESULT image_write(struct image *, const char *path);
+RESULT image_write_file(struct image *, FILE *, enum image_format);
+
+uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t len);
+uint32_t adler32_update(uint32_t adler, const uint8_t *data, size_t len);
+
+#endif // IMAGE_H
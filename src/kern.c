@@ -0,0 +1,492 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "kern.h"
+#include "hashmap.h"
+
+#define NO_PAIR UINT32_MAX
+#define NOT_COVERED 0xffff
+
+enum
+{
+    TAG_kern_feature = 0x6b65726e,
+};
+
+enum
+{
+    LOOKUP_PAIR      = 2,
+    LOOKUP_EXTENSION = 9,
+};
+
+enum
+{
+    X_PLACEMENT = 0x01,
+    Y_PLACEMENT = 0x02,
+    X_ADVANCE   = 0x04,
+};
+
+static uint32_t pair_key(uint16_t left, uint16_t right)
+{
+    return (uint32_t) left << 16 | right;
+}
+
+static uint32_t pair_home(struct ttf_kerning *k, uint32_t key)
+{
+    return hashmap_hash(key) >> (64 - __builtin_ctz(k->pair_cap));
+}
+
+static void pair_grow(struct ttf_kerning *k);
+
+/**
+ * Earlier subtables take precedence, so an existing pair is never replaced.
+ * order is that of the subtable the pair is from.
+ */
+static void pair_insert(struct ttf_kerning *k, uint16_t left, uint16_t right,
+                        int16_t value, uint16_t order)
+{
+    if ((k->num_pairs + 1) * 2 > k->pair_cap) pair_grow(k);
+
+    uint32_t key = pair_key(left, right), mask = k->pair_cap - 1;
+    for (uint32_t i = pair_home(k, key); ; i = (i + 1) & mask)
+    {
+        if (k->pair_keys[i] == key) return;
+        if (k->pair_keys[i] == NO_PAIR)
+        {
+            k->pair_keys[i] = key;
+            k->pair_values[i] = value;
+            k->pair_orders[i] = order;
+            k->num_pairs++;
+            return;
+        }
+    }
+}
+
+static void pair_grow(struct ttf_kerning *k)
+{
+    uint32_t *old_keys = k->pair_keys;
+    int16_t *old_values = k->pair_values;
+    uint16_t *old_orders = k->pair_orders;
+    uint32_t old_cap = k->pair_cap;
+
+    k->pair_cap = old_cap ? old_cap * 2 : 256;
+    k->pair_keys = malloc(sizeof(*k->pair_keys) * k->pair_cap);
+    k->pair_values = malloc(sizeof(*k->pair_values) * k->pair_cap);
+    k->pair_orders = malloc(sizeof(*k->pair_orders) * k->pair_cap);
+    memset(k->pair_keys, 0xff, sizeof(*k->pair_keys) * k->pair_cap);
+    k->num_pairs = 0;
+
+    for (uint32_t i = 0; i < old_cap; i++)
+        if (old_keys[i] != NO_PAIR)
+            pair_insert(k, old_keys[i] >> 16, old_keys[i] & 0xffff,
+                        old_values[i], old_orders[i]);
+
+    free(old_keys);
+    free(old_values);
+    free(old_orders);
+}
+
+/**
+ * Read a ValueRecord, keeping only what moves the pen horizontally.
+ */
+static int16_t read_value(struct ttf_reader *reader, uint16_t format)
+{
+    int16_t advance = 0;
+    for (uint16_t bit = 1; bit <= 0x80; bit <<= 1)
+    {
+        if (!(format & bit)) continue;
+        int16_t v = read_16(reader);
+        if (bit == X_ADVANCE) advance = v;
+    }
+    return advance;
+}
+
+static int value_size(uint16_t format)
+{
+    return 2 * __builtin_popcount(format & 0xff);
+}
+
+/**
+ * Call fn for every glyph in a coverage table, with its coverage index.
+ */
+static void read_coverage(struct ttf_reader *reader, void *coverage,
+                          void (*fn)(void *, uint16_t, uint16_t), void *ctx)
+{
+    void *old_cursor = reader->cursor;
+    reader->cursor = coverage;
+
+    uint16_t format = read_16(reader);
+    uint16_t count = read_16(reader);
+    for (int i = 0; i < count; i++)
+    {
+        if (format == 1)
+        {
+            fn(ctx, read_16(reader), i);
+        }
+        else if (format == 2)
+        {
+            uint16_t start = read_16(reader);
+            uint16_t end = read_16(reader);
+            uint16_t index = read_16(reader);
+            for (uint32_t g = start; g <= end; g++)
+                fn(ctx, g, index + g - start);
+        }
+    }
+
+    reader->cursor = old_cursor;
+}
+
+/**
+ * Expand a ClassDef table into a class per glyph id, 0 by default. Classes
+ * past count would index past the end of the value matrix, so they're taken
+ * as 0 too.
+ */
+static uint16_t *read_class_def(struct ttf_reader *reader, void *class_def,
+                                uint16_t count)
+{
+    uint16_t *classes = calloc(reader->num_glyphs, sizeof(*classes));
+
+    void *old_cursor = reader->cursor;
+    reader->cursor = class_def;
+
+    uint16_t format = read_16(reader);
+    if (format == 1)
+    {
+        uint16_t start = read_16(reader);
+        uint16_t glyph_count = read_16(reader);
+        for (uint32_t g = start; g < (uint32_t) start + glyph_count; g++)
+        {
+            uint16_t c = read_16(reader);
+            if (g < reader->num_glyphs && c < count) classes[g] = c;
+        }
+    }
+    else if (format == 2)
+    {
+        uint16_t range_count = read_16(reader);
+        for (int i = 0; i < range_count; i++)
+        {
+            uint16_t start = read_16(reader);
+            uint16_t end = read_16(reader);
+            uint16_t c = read_16(reader);
+            if (c >= count) c = 0;
+            for (uint32_t g = start; g <= end && g < reader->num_glyphs; g++)
+                classes[g] = c;
+        }
+    }
+
+    reader->cursor = old_cursor;
+    return classes;
+}
+
+struct pair_set_ctx
+{
+    struct ttf_reader *reader;
+    struct ttf_kerning *kerning;
+    void *subtable;
+    uint16_t *pair_set_offsets;
+    uint16_t pair_set_count;
+    uint16_t format1, format2;
+    uint16_t order;
+};
+
+static void read_pair_set(void *ctx, uint16_t first, uint16_t index)
+{
+    struct pair_set_ctx *p = ctx;
+    struct ttf_reader *reader = p->reader;
+    if (index >= p->pair_set_count) return;
+
+    void *old_cursor = reader->cursor;
+    reader->cursor = p->subtable + p->pair_set_offsets[index];
+
+    uint16_t count = read_16(reader);
+    for (int i = 0; i < count; i++)
+    {
+        uint16_t second = read_16(reader);
+        int16_t value = read_value(reader, p->format1);
+        reader->cursor += value_size(p->format2);
+        pair_insert(p->kerning, first, second, value, p->order);
+    }
+
+    reader->cursor = old_cursor;
+}
+
+struct coverage_ctx
+{
+    uint16_t *class1;
+    uint16_t *covered;
+    uint16_t num_glyphs;
+};
+
+static void mark_covered(void *ctx, uint16_t glyph, uint16_t index)
+{
+    struct coverage_ctx *c = ctx;
+    if (glyph < c->num_glyphs) c->covered[glyph] = c->class1[glyph];
+}
+
+static void parse_pair_pos(struct ttf_reader *reader, struct ttf_kerning *k,
+                           void *subtable)
+{
+    reader->cursor = subtable;
+    uint16_t format = read_16(reader);
+    void *coverage = subtable + read_16(reader);
+    uint16_t format1 = read_16(reader);
+    uint16_t format2 = read_16(reader);
+
+    if (format == 1)
+    {
+        struct pair_set_ctx ctx = { reader, k, subtable, NULL, 0,
+                                    format1, format2, k->num_subtables++ };
+        ctx.pair_set_count = read_16(reader);
+        ctx.pair_set_offsets = malloc(sizeof(uint16_t) * ctx.pair_set_count);
+        for (int i = 0; i < ctx.pair_set_count; i++)
+            ctx.pair_set_offsets[i] = read_16(reader);
+
+        read_coverage(reader, coverage, read_pair_set, &ctx);
+        free(ctx.pair_set_offsets);
+    }
+    else if (format == 2)
+    {
+        void *class_def1 = subtable + read_16(reader);
+        void *class_def2 = subtable + read_16(reader);
+        uint16_t class1_count = read_16(reader);
+        uint16_t class2_count = read_16(reader);
+
+        struct kern_class_table table;
+        table.order = k->num_subtables++;
+        table.class2_count = class2_count;
+        table.values = malloc(sizeof(*table.values) * class1_count * class2_count);
+
+        // even if it's all zeroes, it still keeps later subtables from
+        // applying to the glyphs it covers
+        for (int i = 0; i < class1_count * class2_count; i++)
+        {
+            table.values[i] = read_value(reader, format1);
+            reader->cursor += value_size(format2);
+        }
+
+        // glyphs outside the coverage table don't get class 0, they don't
+        // take part at all
+        uint16_t *class1 = read_class_def(reader, class_def1, class1_count);
+        table.class1 = malloc(sizeof(*table.class1) * reader->num_glyphs);
+        for (int g = 0; g < reader->num_glyphs; g++)
+            table.class1[g] = NOT_COVERED;
+        struct coverage_ctx ctx = { class1, table.class1, reader->num_glyphs };
+        read_coverage(reader, coverage, mark_covered, &ctx);
+        free(class1);
+
+        table.class2 = read_class_def(reader, class_def2, class2_count);
+
+        k->classes = realloc(k->classes, sizeof(*k->classes) * (k->num_classes + 1));
+        k->classes[k->num_classes++] = table;
+    }
+}
+
+static void parse_gpos(struct ttf_reader *reader, struct ttf_kerning *k,
+                       void *gpos)
+{
+    reader->cursor = gpos;
+    if (read_16(reader) != 1) return; // major version
+    read_16(reader); // skip minor version
+    read_16(reader); // skip script list, every script gets the same kerning
+    void *feature_list = gpos + read_16(reader);
+    void *lookup_list = gpos + read_16(reader);
+
+    reader->cursor = lookup_list;
+    uint16_t lookup_count = read_16(reader);
+    bool *wanted = calloc(lookup_count, sizeof(*wanted));
+
+    reader->cursor = feature_list;
+    uint16_t feature_count = read_16(reader);
+    for (int i = 0; i < feature_count; i++)
+    {
+        uint32_t tag = read_32(reader);
+        void *feature = feature_list + read_16(reader);
+        if (tag != TAG_kern_feature) continue;
+
+        void *old_cursor = reader->cursor;
+        reader->cursor = feature;
+        read_16(reader); // skip feature params
+        uint16_t index_count = read_16(reader);
+        for (int j = 0; j < index_count; j++)
+        {
+            uint16_t index = read_16(reader);
+            if (index < lookup_count) wanted[index] = true;
+        }
+        reader->cursor = old_cursor;
+    }
+
+    for (int i = 0; i < lookup_count; i++)
+    {
+        if (!wanted[i]) continue;
+
+        reader->cursor = lookup_list + 2 + 2 * i;
+        void *lookup = lookup_list + read_16(reader);
+
+        reader->cursor = lookup;
+        uint16_t type = read_16(reader);
+        read_16(reader); // skip lookup flag
+        uint16_t subtable_count = read_16(reader);
+
+        for (int j = 0; j < subtable_count; j++)
+        {
+            reader->cursor = lookup + 6 + 2 * j;
+            void *subtable = lookup + read_16(reader);
+            uint16_t subtable_type = type;
+
+            if (type == LOOKUP_EXTENSION)
+            {
+                reader->cursor = subtable;
+                read_16(reader); // skip format
+                subtable_type = read_16(reader);
+                subtable += read_32(reader);
+            }
+
+            if (subtable_type == LOOKUP_PAIR)
+                parse_pair_pos(reader, k, subtable);
+        }
+    }
+
+    free(wanted);
+}
+
+static void parse_kern(struct ttf_reader *reader, struct ttf_kerning *k,
+                       void *kern)
+{
+    reader->cursor = kern;
+    if (read_16(reader) != 0) return; // apple's version 1 table
+    uint16_t num_tables = read_16(reader);
+
+    void *subtable = kern + 4;
+    for (int i = 0; i < num_tables; i++)
+    {
+        reader->cursor = subtable;
+        read_16(reader); // skip version
+        uint16_t length = read_16(reader);
+        uint16_t coverage = read_16(reader);
+        subtable += length;
+
+        // format 0, horizontal, not cross stream or minimum values
+        if ((coverage >> 8) != 0 || (coverage & 0x0f) != 0x01) continue;
+        uint16_t order = k->num_subtables++;
+
+        uint16_t num_pairs = read_16(reader);
+        read_16(reader); // skip search range
+        read_16(reader); // skip entry selector
+        read_16(reader); // skip range shift
+        for (int j = 0; j < num_pairs; j++)
+        {
+            uint16_t left = read_16(reader);
+            uint16_t right = read_16(reader);
+            pair_insert(k, left, right, read_16(reader), order);
+        }
+    }
+}
+
+/**
+ * Collect pair kerning from GPOS if there is one, otherwise from kern.
+ * Either table may be NULL. Returns NULL if the font has no kerning.
+ */
+struct ttf_kerning *ttf_parse_kerning(struct ttf_reader *reader,
+                                      void *gpos, void *kern)
+{
+    struct ttf_kerning *k = calloc(1, sizeof(*k));
+    k->num_glyphs = reader->num_glyphs;
+    void *old_cursor = reader->cursor;
+
+    if (gpos) parse_gpos(reader, k, gpos);
+    if (kern && k->num_pairs == 0 && k->num_classes == 0)
+        parse_kern(reader, k, kern);
+
+    reader->cursor = old_cursor;
+
+    if (k->num_pairs == 0 && k->num_classes == 0)
+    {
+        ttf_kerning_free(k);
+        return NULL;
+    }
+    return k;
+}
+
+void ttf_kerning_free(struct ttf_kerning *k)
+{
+    if (k == NULL) return;
+    for (int i = 0; i < k->num_classes; i++)
+    {
+        free(k->classes[i].class1);
+        free(k->classes[i].class2);
+        free(k->classes[i].values);
+    }
+    free(k->classes);
+    free(k->pair_keys);
+    free(k->pair_values);
+    free(k->pair_orders);
+    free(k->latin1_pairs);
+    free(k);
+}
+
+/**
+ * Horizontal adjustment in font units between left and right, from the first
+ * subtable that has anything to say about them.
+ */
+int16_t ttf_kerning(struct ttf_kerning *k, uint16_t left, uint16_t right)
+{
+    if (left >= k->num_glyphs || right >= k->num_glyphs) return 0;
+
+    int16_t value = 0;
+    uint16_t order = UINT16_MAX;
+    if (k->num_pairs > 0)
+    {
+        uint32_t key = pair_key(left, right), mask = k->pair_cap - 1;
+        for (uint32_t i = pair_home(k, key); k->pair_keys[i] != NO_PAIR;
+             i = (i + 1) & mask)
+            if (k->pair_keys[i] == key)
+            {
+                value = k->pair_values[i];
+                order = k->pair_orders[i];
+                break;
+            }
+    }
+
+    // a class subtable only wins if it comes before the pair's
+    for (int i = 0; i < k->num_classes && k->classes[i].order < order; i++)
+    {
+        struct kern_class_table *t = &k->classes[i];
+        uint16_t c1 = t->class1[left];
+        if (c1 == NOT_COVERED) continue;
+        return t->values[c1 * t->class2_count + t->class2[right]];
+    }
+
+    return value;
+}
+
+/**
+ * Look up every pair of Latin-1 characters' glyphs in table once, for
+ * ttf_kerning_latin1(). Characters that kern with none of the others share
+ * index 0, a row and column of zeroes, so the table only grows with the
+ * ones that do.
+ */
+void ttf_kerning_build_latin1(struct ttf_kerning *k,
+                              const struct latin1_glyph table[256])
+{
+    free(k->latin1_pairs);
+    int16_t *all = malloc(sizeof(*all) * 256 * 256);
+    bool kerns[256] = { false };
+    for (int l = 0; l < 256; l++)
+        for (int r = 0; r < 256; r++)
+        {
+            int16_t value = ttf_kerning(k, table[l].glyph, table[r].glyph);
+            all[l * 256 + r] = value;
+            if (value != 0) kerns[l] = kerns[r] = true;
+        }
+
+    uint16_t n = 1;
+    for (int c = 0; c < 256; c++)
+        k->latin1_index[c] = kerns[c] ? n++ : 0;
+
+    k->latin1_stride = n;
+    k->latin1_pairs = calloc((size_t) n * n, sizeof(*k->latin1_pairs));
+    for (int l = 0; l < 256; l++)
+        for (int r = 0; r < 256; r++)
+            k->latin1_pairs[k->latin1_index[l] * n + k->latin1_index[r]]
+                = kerns[l] && kerns[r] ? all[l * 256 + r] : 0;
+    free(all);
+}
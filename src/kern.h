@@ -0,0 +1,58 @@
+#include <stdint.h>
+#include "truetype.h"
+
+#ifndef KERN_H
+#define KERN_H
+
+// Pair adjustments from GPOS PairPos lookups, or from the legacy kern table
+// for fonts without one. Individual pairs (kern format 0 and PairPos format
+// 1) go into a single open addressing table. Class based pairs (PairPos
+// format 2) keep a dense class per glyph id for either side and a flattened
+// class1 x class2 matrix, so a lookup is two array loads and a multiply.
+// Every subtable is numbered in the order it comes in, and the first one
+// that applies to a pair wins, whichever kind it is. Pairs of Latin-1
+// characters are looked up once more into a dense table of their own, for
+// layout to kern Latin text without any of that.
+
+struct kern_class_table
+{
+    uint16_t *class1; // 0xffff where the first glyph isn't covered
+    uint16_t *class2;
+    uint16_t class2_count;
+    uint16_t order; // of the subtable
+    int16_t *values;
+};
+
+struct ttf_kerning
+{
+    uint32_t *pair_keys;
+    int16_t *pair_values;
+    uint16_t *pair_orders; // of the subtable each pair is from
+    uint32_t pair_cap;
+    uint32_t num_pairs;
+    struct kern_class_table *classes;
+    int num_classes;
+    uint16_t num_subtables;
+    uint16_t num_glyphs;
+    // see ttf_kerning_build_latin1()
+    uint16_t latin1_index[256];
+    uint16_t latin1_stride;
+    int16_t *latin1_pairs;
+};
+
+struct ttf_kerning *ttf_parse_kerning(struct ttf_reader *,
+                                      void *gpos, void *kern);
+void ttf_kerning_free(struct ttf_kerning *);
+int16_t ttf_kerning(struct ttf_kerning *, uint16_t left, uint16_t right);
+void ttf_kerning_build_latin1(struct ttf_kerning *,
+                              const struct latin1_glyph table[256]);
+
+// ttf_kerning() between two Latin-1 characters' glyphs
+static inline int16_t ttf_kerning_latin1(struct ttf_kerning *k,
+                                         uint8_t left, uint8_t right)
+{
+    return k->latin1_pairs[k->latin1_index[left] * k->latin1_stride
+                           + k->latin1_index[right]];
+}
+
+#endif // KERN_H
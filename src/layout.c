@@ -0,0 +1,454 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "layout.h"
+#include "utf8.h"
+#include "kern.h"
+#include "shape.h"
+
+struct layout_entry
+{
+    uint64_t frame;
+    uint16_t font;
+    float size;
+    float max_width;
+    size_t len;
+    char *text;
+    struct layout layout;
+};
+
+static uint16_t lookup_glyph(struct ttf_reader *reader, uint32_t c)
+{
+    // the cmap we read only covers the BMP
+    return c > 0xffff ? 0 : ttf_lookup_index(reader->cmap, c);
+}
+
+// Where the line being filled is at.
+struct line
+{
+    float scale;
+    float max_width;
+    float height;
+    float x;
+    float baseline;
+    uint32_t start;
+    int64_t last_space; // glyph index of the last break opportunity
+    int32_t prev; // previous glyph on the line, for kerning
+    int16_t prev_latin1; // the character prev is, if it's from that table
+    uint32_t glyph_cap;
+    uint32_t run_cap;
+};
+
+static void push_run(struct layout *layout, struct line *line,
+                     uint32_t end, float width)
+{
+    if (layout->num_runs == line->run_cap)
+    {
+        line->run_cap *= 2;
+        layout->runs = realloc(layout->runs,
+                               sizeof(*layout->runs) * line->run_cap);
+    }
+
+    struct layout_run *run = &layout->runs[layout->num_runs++];
+    run->first = line->start;
+    run->count = end - line->start;
+    run->width = width;
+    run->baseline = line->baseline;
+    if (width > layout->width) layout->width = width;
+}
+
+static void new_line(struct layout *out, struct line *line)
+{
+    push_run(out, line, out->num_glyphs, line->x);
+    line->start = out->num_glyphs;
+    line->last_space = -1;
+    line->x = 0;
+    line->prev = -1;
+    line->baseline -= line->height;
+}
+
+static void reserve_glyphs(struct layout *out, struct line *line,
+                           uint32_t count)
+{
+    if (out->num_glyphs + count <= line->glyph_cap) return;
+
+    while (out->num_glyphs + count > line->glyph_cap) line->glyph_cap *= 2;
+    out->glyphs = realloc(out->glyphs, sizeof(*out->glyphs) * line->glyph_cap);
+}
+
+/**
+ * Kerning between the previous glyph on the line and glyph, from the
+ * Latin-1 pair table if both are from that table, c being glyph's character
+ * there, or -1 if it isn't.
+ */
+static int16_t kern(struct ttf_reader *reader, struct line *line,
+                    uint16_t glyph, int16_t c)
+{
+    if (reader->kerning == NULL || line->prev < 0) return 0;
+    if (c >= 0 && line->prev_latin1 >= 0)
+        return ttf_kerning_latin1(reader->kerning, line->prev_latin1, c);
+    return ttf_kerning(reader->kerning, line->prev, glyph);
+}
+
+static void place_glyph(struct ttf_reader *reader, struct layout *out,
+                        struct line *line, uint16_t glyph_id, int16_t c,
+                        float advance, bool space)
+{
+    line->x += kern(reader, line, glyph_id, c) * line->scale;
+    line->prev = glyph_id;
+    line->prev_latin1 = c;
+
+    if (line->max_width > 0 && line->x + advance > line->max_width && !space
+            && out->num_glyphs > line->start)
+    {
+        // move the word we're in the middle of down to the next line,
+        // or if there's no space to break at, just the current glyph
+        uint32_t wrap = line->last_space >= 0
+            ? line->last_space + 1
+            : out->num_glyphs;
+        float shift = wrap < out->num_glyphs
+            ? out->glyphs[wrap].x
+            : line->x;
+        float line_end = line->last_space >= 0
+            ? out->glyphs[line->last_space].x
+            : line->x;
+
+        push_run(out, line, wrap, line_end);
+        line->baseline -= line->height;
+        for (uint32_t g = wrap; g < out->num_glyphs; g++)
+        {
+            out->glyphs[g].x -= shift;
+            out->glyphs[g].y = line->baseline;
+        }
+        line->x -= shift;
+        line->start = wrap;
+        line->last_space = -1;
+    }
+
+    reserve_glyphs(out, line, 1);
+    struct layout_glyph *glyph = &out->glyphs[out->num_glyphs];
+    glyph->glyph = glyph_id;
+    glyph->x = line->x;
+    glyph->y = line->baseline;
+    if (space) line->last_space = out->num_glyphs;
+    out->num_glyphs++;
+    line->x += advance;
+}
+
+static void place_word(struct ttf_reader *reader, struct layout *out,
+                       struct line *line, const uint32_t *text, size_t len)
+{
+    uint32_t count;
+    const uint16_t *glyphs = shape_word(reader, text, len, &count);
+    for (uint32_t g = 0; g < (glyphs ? count : len); g++)
+    {
+        uint16_t glyph = glyphs ? glyphs[g] : lookup_glyph(reader, text[g]);
+        place_glyph(reader, out, line, glyph, -1,
+                    reader->hmetrics[glyph].advance_width * line->scale,
+                    false);
+    }
+}
+
+/**
+ * A word the shaper would leave alone, with every glyph and advance in the
+ * Latin-1 table. A word that fits on the line is placed in one go, kerned
+ * from the Latin-1 pair table, see ttf_kerning_build_latin1(). Without
+ * kerning, if every glyph in it is mono_advance wide that's just a multiply
+ * per glyph.
+ */
+static void place_latin1(struct ttf_reader *reader, struct layout *out,
+                         struct line *line, const uint32_t *text, size_t len,
+                         bool mono)
+{
+    struct latin1_glyph *table = reader->latin1;
+    reserve_glyphs(out, line, len);
+    struct layout_glyph *glyphs = &out->glyphs[out->num_glyphs];
+    float x = line->x, baseline = line->baseline;
+    bool fits = true;
+
+    if (reader->kerning)
+    {
+        // the same sums place_glyph() would do, to land on the same pixels,
+        // and if any glyph goes past the end of the line, start over there
+        for (size_t i = 0; i < len && fits; i++)
+        {
+            int16_t k = i > 0
+                ? ttf_kerning_latin1(reader->kerning, text[i - 1], text[i])
+                : kern(reader, line, table[text[0]].glyph, text[0]);
+            x += k * line->scale;
+            glyphs[i].glyph = table[text[i]].glyph;
+            glyphs[i].x = x;
+            glyphs[i].y = baseline;
+            x += table[text[i]].advance_width * line->scale;
+            fits = line->max_width <= 0 || x <= line->max_width;
+        }
+    }
+    else
+    {
+        float width;
+        if (mono)
+            width = len * reader->mono_advance * line->scale;
+        else
+        {
+            uint32_t units = 0;
+            for (size_t i = 0; i < len; i++)
+                units += table[text[i]].advance_width;
+            width = units * line->scale;
+        }
+        fits = line->max_width <= 0 || line->x + width <= line->max_width;
+
+        if (fits && mono)
+        {
+            float advance = reader->mono_advance * line->scale;
+            for (size_t i = 0; i < len; i++)
+            {
+                glyphs[i].glyph = table[text[i]].glyph;
+                glyphs[i].x = x + i * advance;
+                glyphs[i].y = baseline;
+            }
+        }
+        else if (fits)
+        {
+            for (size_t i = 0; i < len; i++)
+            {
+                glyphs[i].glyph = table[text[i]].glyph;
+                glyphs[i].x = x;
+                glyphs[i].y = baseline;
+                x += table[text[i]].advance_width * line->scale;
+            }
+        }
+        x = line->x + width;
+    }
+
+    if (!fits)
+    {
+        for (size_t i = 0; i < len; i++)
+        {
+            struct latin1_glyph *l = &table[text[i]];
+            place_glyph(reader, out, line, l->glyph, text[i],
+                        l->advance_width * line->scale, false);
+        }
+        return;
+    }
+
+    out->num_glyphs += len;
+    line->x = x;
+    line->prev = table[text[len - 1]].glyph;
+    line->prev_latin1 = text[len - 1];
+}
+
+/**
+ * Lay text out into lines no wider than max_width pixels, breaking at
+ * spaces where possible and mid word where not. A max_width of 0 means no
+ * wrapping at all, only explicit newlines start new lines. Words go through
+ * the font's shaper, if it has one.
+ */
+RESULT layout_paragraph(struct ttf_reader *reader, const char *text,
+                        size_t len, float size, float max_width,
+                        struct layout *out)
+{
+    uint32_t *codepoints = malloc(sizeof(*codepoints) * (len + 1));
+    size_t n;
+    if (utf8_decode(text, len, codepoints, &n, NULL) != OK)
+    {
+        free(codepoints);
+        return ERR;
+    }
+
+    layout_codepoints(reader, codepoints, n, size, max_width, out);
+    free(codepoints);
+    return OK;
+}
+
+/**
+ * Like layout_paragraph(), for text that's already been decoded.
+ */
+void layout_codepoints(struct ttf_reader *reader, const uint32_t *codepoints,
+                       size_t n, float size, float max_width,
+                       struct layout *out)
+{
+    struct line line =
+    {
+        .scale = size / reader->units_per_em,
+        .max_width = max_width,
+        .start = 0,
+        .last_space = -1,
+        .prev = -1,
+        .prev_latin1 = -1,
+        // shaping can add glyphs, but rarely, so these only grow if needed
+        .glyph_cap = n + 1,
+        .run_cap = n + 1,
+    };
+    line.height =
+        (reader->ascender - reader->descender + reader->line_gap) * line.scale;
+    line.baseline = -reader->ascender * line.scale;
+
+    out->glyphs = malloc(sizeof(*out->glyphs) * line.glyph_cap);
+    out->runs = malloc(sizeof(*out->runs) * line.run_cap);
+    out->num_glyphs = 0;
+    out->num_runs = 0;
+    out->width = 0;
+
+    for (size_t i = 0; i < n;)
+    {
+        uint32_t c = codepoints[i];
+        if (c == '\n')
+        {
+            new_line(out, &line);
+            i++;
+            continue;
+        }
+        if (c == ' ')
+        {
+            struct latin1_glyph *space = &reader->latin1[' '];
+            place_glyph(reader, out, &line, space->glyph, ' ',
+                        space->advance_width * line.scale, true);
+            i++;
+            continue;
+        }
+
+        size_t end = i;
+        bool latin1 = true, mono = true;
+        for (; end < n && codepoints[end] != ' ' && codepoints[end] != '\n'; end++)
+        {
+            latin1 = latin1 && codepoints[end] < 256
+                && !reader->latin1[codepoints[end]].shaped;
+            mono = mono && latin1 && reader->latin1[codepoints[end]].mono;
+        }
+
+        if (latin1)
+            place_latin1(reader, out, &line, codepoints + i, end - i, mono);
+        else
+            place_word(reader, out, &line, codepoints + i, end - i);
+        i = end;
+    }
+
+    push_run(out, &line, out->num_glyphs, line.x);
+    out->height = out->num_runs * line.height;
+}
+
+void layout_free(struct layout *layout)
+{
+    free(layout->glyphs);
+    free(layout->runs);
+    layout->glyphs = NULL;
+    layout->runs = NULL;
+}
+
+static uint64_t hash_text(const char *text, size_t len)
+{
+    // eight bytes at a time through the same mixing the hashmap uses
+    uint64_t h = len;
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, text + i, sizeof(word));
+        h = hashmap_hash(h ^ word) ^ (h >> 29);
+    }
+
+    uint64_t tail = 0;
+    memcpy(&tail, text + i, len - i);
+    return hashmap_hash(h ^ tail) ^ (h >> 29);
+}
+
+/**
+ * What the cache knows a layout by. Anything that keeps its own things
+ * derived from a layout can use it too.
+ */
+uint64_t layout_key(uint16_t font, const char *text, size_t len,
+                    float size, float max_width)
+{
+    uint32_t s, w;
+    memcpy(&s, &size, sizeof(s));
+    memcpy(&w, &max_width, sizeof(w));
+    uint64_t h = hash_text(text, len);
+    h = hashmap_hash(h ^ font) ^ s;
+    return hashmap_hash(h) ^ w;
+}
+
+static void entry_free(struct layout_entry *entry)
+{
+    layout_free(&entry->layout);
+    free(entry->text);
+    free(entry);
+}
+
+void layout_cache_init(struct layout_cache *cache)
+{
+    cache->entries = hashmap_create(16);
+    cache->frame = 0;
+}
+
+void layout_cache_destroy(struct layout_cache *cache)
+{
+    for (uint32_t i = 0; i < cache->entries.cap; i++)
+        if (cache->entries.buckets[i].dist)
+            entry_free(cache->entries.buckets[i].value);
+    hashmap_destroy(&cache->entries);
+}
+
+void layout_cache_begin_frame(struct layout_cache *cache)
+{
+    cache->frame++;
+
+    // removing shifts buckets around, so restart from the same slot
+    for (uint32_t i = 0; i < cache->entries.cap;)
+    {
+        struct hashmap_bucket *bucket = &cache->entries.buckets[i];
+        struct layout_entry *entry = bucket->value;
+        if (bucket->dist && cache->frame - entry->frame > LAYOUT_CACHE_FRAMES)
+        {
+            hashmap_remove(&cache->entries, bucket->key);
+            entry_free(entry);
+            continue;
+        }
+        i++;
+    }
+}
+
+/**
+ * Cached layout_paragraph(). The layout belongs to the cache and stays valid
+ * at least until the next layout_cache_begin_frame().
+ */
+struct layout *layout_cache_get(struct layout_cache *cache,
+                                struct ttf_reader *reader, uint16_t font,
+                                const char *text, size_t len,
+                                float size, float max_width)
+{
+    uint64_t key = layout_key(font, text, len, size, max_width);
+    struct layout_entry *entry = hashmap_get(&cache->entries, key);
+
+    if (entry != NULL
+            && entry->font == font
+            && entry->size == size
+            && entry->max_width == max_width
+            && entry->len == len
+            && memcmp(entry->text, text, len) == 0)
+    {
+        entry->frame = cache->frame;
+        return &entry->layout;
+    }
+
+    struct layout_entry *fresh = malloc(sizeof(*fresh));
+    if (layout_paragraph(reader, text, len, size, max_width,
+                         &fresh->layout) != OK)
+    {
+        free(fresh);
+        return NULL;
+    }
+
+    fresh->frame = cache->frame;
+    fresh->font = font;
+    fresh->size = size;
+    fresh->max_width = max_width;
+    fresh->len = len;
+    fresh->text = malloc(len);
+    memcpy(fresh->text, text, len);
+
+    // a different text that hashed the same, the newer one wins
+    if (entry != NULL) entry_free(entry);
+    hashmap_insert(&cache->entries, key, fresh);
+
+    return &fresh->layout;
+}
@@ -0,0 +1,65 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "hashmap.h"
+#include "truetype.h"
+
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+#ifndef LAYOUT_CACHE_FRAMES
+#define LAYOUT_CACHE_FRAMES 120
+#endif
+
+// Positions are in pixels, relative to the top left corner of the
+// paragraph, with y pointing up like in GL. Every line is one run.
+
+struct layout_glyph
+{
+    uint16_t glyph;
+    float x, y;
+};
+
+struct layout_run
+{
+    uint32_t first;
+    uint32_t count;
+    float width;
+    float baseline;
+};
+
+struct layout
+{
+    struct layout_glyph *glyphs;
+    uint32_t num_glyphs;
+    struct layout_run *runs;
+    uint32_t num_runs;
+    float width;
+    float height;
+};
+
+// Layouts that are asked for again keep being handed out from the cache.
+// The ones nobody asked for in LAYOUT_CACHE_FRAMES frames are thrown away.
+struct layout_cache
+{
+    hashmap_t entries;
+    uint64_t frame;
+};
+
+RESULT layout_paragraph(struct ttf_reader *, const char *text, size_t len,
+                        float size, float max_width, struct layout *);
+void layout_codepoints(struct ttf_reader *, const uint32_t *codepoints,
+                       size_t len, float size, float max_width,
+                       struct layout *);
+void layout_free(struct layout *);
+
+uint64_t layout_key(uint16_t font, const char *text, size_t len,
+                    float size, float max_width);
+void layout_cache_init(struct layout_cache *);
+void layout_cache_destroy(struct layout_cache *);
+void layout_cache_begin_frame(struct layout_cache *);
+struct layout *layout_cache_get(struct layout_cache *,
+                                struct ttf_reader *, uint16_t font,
+                                const char *text, size_t len,
+                                float size, float max_width);
+
+#endif // LAYOUT_H
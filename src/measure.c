@@ -0,0 +1,170 @@
+#include <stdlib.h>
+#include <string.h>
+#include "measure.h"
+#include "utf8.h"
+#include "kern.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#ifndef MEASURE_CHUNK
+#define MEASURE_CHUNK 256
+#endif
+
+struct ink
+{
+    bool any;
+    int64_t x_min, y_min, x_max, y_max;
+};
+
+static uint32_t sum_advances(const uint16_t *advances, size_t n)
+{
+    uint32_t sum = 0;
+    size_t i = 0;
+
+#ifdef __SSE2__
+    // widen to 32 bits before adding, a long line overflows 16 bits fast
+    __m128i zero = _mm_setzero_si128();
+    __m128i acc = zero;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *) (advances + i));
+        acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(v, zero));
+        acc = _mm_add_epi32(acc, _mm_unpackhi_epi16(v, zero));
+    }
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+    sum = _mm_cvtsi128_si32(acc);
+#endif
+
+    for (; i < n; i++)
+        sum += advances[i];
+    return sum;
+}
+
+static void add_ink(struct ttf_reader *reader, struct ink *ink,
+                    uint16_t glyph, int64_t x, int64_t y)
+{
+    bbox_t bbox;
+    if (!ttf_glyph_bbox(reader, glyph, &bbox)) return;
+
+    int64_t x_min = x + bbox.x_min, x_max = x + bbox.x_max;
+    int64_t y_min = y + bbox.y_min, y_max = y + bbox.y_max;
+    if (!ink->any)
+    {
+        ink->any = true;
+        ink->x_min = x_min;
+        ink->y_min = y_min;
+        ink->x_max = x_max;
+        ink->y_max = y_max;
+        return;
+    }
+
+    if (x_min < ink->x_min) ink->x_min = x_min;
+    if (y_min < ink->y_min) ink->y_min = y_min;
+    if (x_max > ink->x_max) ink->x_max = x_max;
+    if (y_max > ink->y_max) ink->y_max = y_max;
+}
+
+/**
+ * Measure UTF-8 text at size pixels per em. Lines are stacked the same way
+ * layout_paragraph() stacks them. Finding the ink box means reading a glyph
+ * header per glyph, so it's only done if ink is set.
+ */
+RESULT measure_text(struct ttf_reader *reader, const char *text, size_t len,
+                    float size, bool ink, struct measure *out)
+{
+    uint32_t *codepoints = malloc(sizeof(*codepoints) * (len + 1));
+    size_t n;
+    if (utf8_decode(text, len, codepoints, &n, NULL) != OK)
+    {
+        free(codepoints);
+        return ERR;
+    }
+
+    // everything is summed in font units and scaled once at the end
+    int64_t line_height =
+        reader->ascender - reader->descender + reader->line_gap;
+    int64_t x = 0, widest = 0, y = 0;
+    int32_t prev = -1, prev_latin1 = -1;
+    uint32_t lines = 1;
+    struct ink box = { 0 };
+
+    uint16_t glyphs[MEASURE_CHUNK];
+    uint16_t advances[MEASURE_CHUNK];
+
+    for (size_t i = 0; i < n;)
+    {
+        size_t count = 0;
+        for (; i < n && codepoints[i] != '\n' && count < MEASURE_CHUNK; i++)
+        {
+            uint32_t c = codepoints[i];
+            if (c < 256)
+            {
+                glyphs[count] = reader->latin1[c].glyph;
+                advances[count] = reader->latin1[c].advance_width;
+            }
+            else
+            {
+                // the cmap we read only covers the BMP
+                uint16_t glyph = c > 0xffff
+                    ? 0
+                    : ttf_lookup_index(reader->cmap, c);
+                glyphs[count] = glyph;
+                advances[count] = reader->hmetrics[glyph].advance_width;
+            }
+            count++;
+        }
+
+        if (ink || reader->kerning)
+        {
+            // every glyph's origin is needed, so sum as we go, with pairs
+            // of Latin-1 characters kerned from their own table like
+            // layout_paragraph() does
+            const uint32_t *chars = codepoints + i - count;
+            for (size_t g = 0; g < count; g++)
+            {
+                if (reader->kerning && prev >= 0)
+                    x += chars[g] < 256 && prev_latin1 >= 0
+                        ? ttf_kerning_latin1(reader->kerning, prev_latin1,
+                                             chars[g])
+                        : ttf_kerning(reader->kerning, prev, glyphs[g]);
+                prev = glyphs[g];
+                prev_latin1 = chars[g] < 256 ? (int32_t) chars[g] : -1;
+                if (ink) add_ink(reader, &box, glyphs[g], x, y);
+                x += advances[g];
+            }
+        }
+        else
+        {
+            x += sum_advances(advances, count);
+        }
+
+        if (i < n && codepoints[i] == '\n')
+        {
+            if (x > widest) widest = x;
+            x = 0;
+            y -= line_height;
+            prev = -1;
+            lines++;
+            i++;
+        }
+    }
+    if (x > widest) widest = x;
+
+    float scale = size / reader->units_per_em;
+    memset(out, 0, sizeof(*out));
+    out->width = widest * scale;
+    out->lines = lines;
+    if (box.any)
+    {
+        out->ink_x_min = box.x_min * scale;
+        out->ink_y_min = box.y_min * scale;
+        out->ink_x_max = box.x_max * scale;
+        out->ink_y_max = box.y_max * scale;
+    }
+
+    free(codepoints);
+    return OK;
+}
@@ -0,0 +1,29 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "truetype.h"
+
+#ifndef MEASURE_H
+#define MEASURE_H
+
+// How big text is without laying it out or rendering it. Only cmap, hmtx,
+// kerning and the bounding boxes in the glyf headers are looked at, outlines
+// are never decoded. Lines only break at newlines and words aren't shaped,
+// so a ligature measures as the characters it's made of.
+
+struct measure
+{
+    float width; // advance of the widest line
+    uint32_t lines;
+    // relative to the origin of the first line, with y pointing up, all 0
+    // when there's no ink or it wasn't asked for
+    float ink_x_min;
+    float ink_y_min;
+    float ink_x_max;
+    float ink_y_max;
+};
+
+RESULT measure_text(struct ttf_reader *, const char *text, size_t len,
+                    float size, bool ink, struct measure *);
+
+#endif // MEASURE_H
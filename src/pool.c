@@ -0,0 +1,165 @@
+#include <stdlib.h>
+#include "pool.h"
+
+static uint64_t pack(uint32_t first, uint32_t end)
+{
+    return (uint64_t) first << 32 | end;
+}
+
+static uint32_t range_first(uint64_t range) { return range >> 32; }
+static uint32_t range_end(uint64_t range) { return range; }
+
+static bool take(struct pool_worker *w, uint32_t *index)
+{
+    uint64_t range = atomic_load(&w->range);
+    while (range_first(range) < range_end(range))
+    {
+        uint64_t rest = pack(range_first(range) + 1, range_end(range));
+        if (atomic_compare_exchange_weak(&w->range, &range, rest))
+        {
+            *index = range_first(range);
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Move the back half of the biggest share left over to w's own, which is
+ * empty. Returns false once there's nothing left anywhere.
+ */
+static bool steal(struct pool_worker *w)
+{
+    struct pool *pool = w->pool;
+    for (;;)
+    {
+        struct pool_worker *victim = NULL;
+        uint64_t range = 0;
+        uint32_t most = 0;
+        for (int i = 0; i < pool->num_threads; i++)
+        {
+            uint64_t r = atomic_load(&pool->workers[i].range);
+            if (range_end(r) > range_first(r)
+                    && range_end(r) - range_first(r) > most)
+            {
+                victim = &pool->workers[i];
+                range = r;
+                most = range_end(r) - range_first(r);
+            }
+        }
+        if (victim == NULL) return false;
+
+        uint32_t half = (most + 1) / 2;
+        uint32_t split = range_end(range) - half;
+        if (atomic_compare_exchange_strong(&victim->range, &range,
+                                           pack(range_first(range), split)))
+        {
+            atomic_store(&w->range, pack(split, range_end(range)));
+            return true;
+        }
+    }
+}
+
+static void work(struct pool_worker *w)
+{
+    struct pool *pool = w->pool;
+    uint32_t index;
+    do
+    {
+        while (take(w, &index))
+            pool->fn(pool->ctx, index, w->index);
+    }
+    while (steal(w));
+}
+
+static void *thread_main(void *arg)
+{
+    struct pool_worker *w = arg;
+    struct pool *pool = w->pool;
+    uint64_t seen = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;)
+    {
+        while (pool->generation == seen && !pool->quit)
+            pthread_cond_wait(&pool->start, &pool->lock);
+        if (pool->quit) break;
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        work(w);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->running == 0) pthread_cond_signal(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+void pool_init(struct pool *pool, int num_threads)
+{
+    pool->num_threads = num_threads < 1 ? 1 : num_threads;
+    pool->workers = calloc(pool->num_threads, sizeof(*pool->workers));
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    pool->generation = 0;
+    pool->running = 0;
+    pool->quit = false;
+
+    // worker 0 is whoever calls pool_run()
+    for (int i = 0; i < pool->num_threads; i++)
+    {
+        struct pool_worker *w = &pool->workers[i];
+        w->pool = pool;
+        w->index = i;
+        atomic_init(&w->range, 0);
+        if (i > 0) pthread_create(&w->thread, NULL, thread_main, w);
+    }
+}
+
+void pool_destroy(struct pool *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = true;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 1; i < pool->num_threads; i++)
+        pthread_join(pool->workers[i].thread, NULL);
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->done);
+    free(pool->workers);
+}
+
+/**
+ * Call fn(ctx, i, thread) for every i below count, spread over the pool's
+ * threads, and wait for all of them. thread is which of them it is, from 0
+ * to num_threads - 1, for picking per thread scratch space.
+ */
+void pool_run(struct pool *pool, uint32_t count, pool_fn fn, void *ctx)
+{
+    pool->fn = fn;
+    pool->ctx = ctx;
+    for (int i = 0; i < pool->num_threads; i++)
+    {
+        uint32_t first = (uint64_t) count * i / pool->num_threads;
+        uint32_t end = (uint64_t) count * (i + 1) / pool->num_threads;
+        atomic_store(&pool->workers[i].range, pack(first, end));
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->generation++;
+    pool->running = pool->num_threads - 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    work(&pool->workers[0]);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->running > 0)
+        pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
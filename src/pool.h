@@ -0,0 +1,47 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifndef POOL_H
+#define POOL_H
+
+// A fixed set of threads that run a function for every index in a range,
+// for work that comes in many small independent pieces. Each thread starts
+// with an even share of the range and takes indices off the front of it.
+// One that runs out steals the back half of the biggest share left, so
+// uneven pieces even out without any locking. The thread calling
+// pool_run() works too, and it returns once every index is done.
+//
+// A share is packed into one 64-bit word, first index on top and end below,
+// so that taking and stealing are both a single CAS.
+
+typedef void (*pool_fn)(void *ctx, uint32_t index, int thread);
+
+struct pool_worker
+{
+    _Atomic uint64_t range;
+    pthread_t thread;
+    struct pool *pool;
+    int index;
+};
+
+struct pool
+{
+    int num_threads; // the caller included
+    struct pool_worker *workers;
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    uint64_t generation; // bumped for every run
+    int running; // threads still working on this one
+    bool quit;
+    pool_fn fn;
+    void *ctx;
+};
+
+void pool_init(struct pool *, int num_threads);
+void pool_destroy(struct pool *);
+void pool_run(struct pool *, uint32_t count, pool_fn, void *ctx);
+
+#endif // POOL_H
@@ -0,0 +1,119 @@
+#include <stdlib.h>
+#include <math.h>
+#include "coverage.h"
+#include "glyphcache.h"
+#include "raster.h"
+#include "sdf.h"
+
+static struct bitmap *load_bitmap(struct raster *raster,
+                                  struct ttf_reader *reader, uint64_t key)
+{
+    struct bitmap *bitmap = calloc(1, sizeof(*bitmap));
+
+    // a glyph that won't parse is cached as empty, not tried again
+    struct ttf_glyph glyph;
+    if (ttf_parse_glyf(reader, glyph_key_glyph(key), &glyph) != OK)
+        return bitmap;
+
+    float scale = glyph_key_size(key) / 4.0 / reader->units_per_em;
+    float offset = (float) glyph_key_phase(key) / RASTER_PHASES;
+    if (raster->coverage)
+        coverage_render_glyph(&glyph, scale, offset, bitmap);
+    else
+        sdf_bake_glyph(&glyph, scale, offset, bitmap, NULL);
+    free(glyph.points);
+    free(glyph.contour_endpoints);
+    return bitmap;
+}
+
+static void unload_bitmap(void *ctx, uint64_t key, void *data)
+{
+    bitmap_free(data);
+    free(data);
+}
+
+void raster_init(struct raster *raster, float size)
+{
+    raster->size = size;
+    raster->coverage = false;
+    concmap_init(&raster->glyphs, 1024);
+}
+
+void raster_destroy(struct raster *raster)
+{
+    concmap_for_each(&raster->glyphs, unload_bitmap, NULL);
+    concmap_destroy(&raster->glyphs);
+}
+
+/**
+ * Split x into a whole pixel and the nearest of the RASTER_PHASES subpixel
+ * offsets.
+ */
+int raster_phase(float x, float *whole)
+{
+    *whole = floorf(x);
+    int phase = (x - *whole) * RASTER_PHASES + 0.5f;
+    if (phase == RASTER_PHASES)
+    {
+        *whole += 1;
+        phase = 0;
+    }
+    return phase;
+}
+
+/**
+ * The bitmap for a glyph_key(), at its own size and phase, rendered the
+ * first time it's asked for. Empty if the glyph has no pixels.
+ */
+struct bitmap *raster_get_glyph(struct raster *raster,
+                                struct ttf_reader *reader, uint64_t key)
+{
+    struct bitmap *bitmap = concmap_get(&raster->glyphs, key);
+    if (bitmap == NULL)
+    {
+        struct bitmap *mine = load_bitmap(raster, reader, key);
+        bitmap = concmap_insert(&raster->glyphs, key, mine);
+        if (bitmap != mine) unload_bitmap(NULL, key, mine);
+    }
+    return bitmap;
+}
+
+/**
+ * Draw black text onto image, clipped to its edges.
+ */
+void raster_draw_layout(struct raster *raster, struct image *image,
+                        struct ttf_reader *reader, uint16_t font,
+                        struct layout *layout, float left, float top)
+{
+    uint16_t size = glyph_size_bucket(raster->size);
+
+    for (uint32_t i = 0; i < layout->num_glyphs; i++)
+    {
+        float whole;
+        int phase = raster_phase(left + layout->glyphs[i].x, &whole);
+        if (whole >= image->width) continue;
+
+        uint64_t key = glyph_key(font, layout->glyphs[i].glyph, size, phase, 0);
+        struct bitmap *bitmap = raster_get_glyph(raster, reader, key);
+        if (bitmap->width == 0) continue;
+
+        // the bitmap's rows go up from its bottom, the image's go down
+        int baseline = roundf(top - layout->glyphs[i].y);
+        int x0 = whole + bitmap->left;
+        int y0 = baseline - bitmap->bottom - bitmap->height;
+
+        int bx0 = x0 < 0 ? -x0 : 0;
+        int bx1 = x0 + bitmap->width > image->width
+                ? image->width - x0 : bitmap->width;
+        for (int by = 0; by < bitmap->height; by++)
+        {
+            int y = y0 + bitmap->height - 1 - by;
+            if (y < 0 || y >= image->height) continue;
+
+            const uint8_t *src = bitmap->pixels + by * bitmap->width;
+            uint8_t *dst = image->pixels + (size_t) y * image->width + x0;
+            for (int bx = bx0; bx < bx1; bx++)
+                dst[bx] = dst[bx] * (255 - src[bx]) / 255;
+        }
+    }
+}
@@ -0,0 +1,47 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include "bitmap.h"
+#include "concmap.h"
+#include "image.h"
+#include "layout.h"
+#include "truetype.h"
+
+#ifndef RASTER_H
+#define RASTER_H
+
+#ifndef RASTER_PHASES
+#define RASTER_PHASES 4
+#endif
+
+// Draws layouts into images on the CPU, for when there's no GL. Glyphs are
+// rendered with the same code as atlas sprites, or with exact coverage if
+// coverage is set, at RASTER_PHASES subpixel offsets, and kept until
+// raster_destroy(): a font only has so many.
+//
+// Any number of threads can draw with the same raster at once, sharing its
+// glyphs, as long as each passes a ttf_reader of its own, see
+// ttf_reader_clone(). Two threads that miss the same glyph both render it,
+// and the one that loses the race to insert it throws its copy away.
+//
+// Positions are in pixels from the top left corner of the image, with y
+// pointing down, and the layout's own y flipped to match.
+
+struct raster
+{
+    float size;
+    bool coverage; // coverage_render_glyph() instead of the SDF
+    concmap_t glyphs;
+};
+
+void raster_init(struct raster *, float size);
+void raster_destroy(struct raster *);
+void raster_draw_layout(struct raster *, struct image *,
+                        struct ttf_reader *, uint16_t font,
+                        struct layout *, float left, float top);
+
+// the pieces, for drawing the same glyphs some other way
+int raster_phase(float x, float *whole);
+struct bitmap *raster_get_glyph(struct raster *, struct ttf_reader *,
+                                uint64_t key);
+
+#endif // RASTER_H
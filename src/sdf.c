@@ -0,0 +1,615 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include "coverage.h"
+#include "sdf.h"
+
+// A CPU port of sdf.glsl, used to bake glyphs into the atlas. It should
+// produce the same pixels the shader would, so keep the two in sync. The
+// distance transform, render_edt(), is the exception: it's only close, so
+// only raster.c's bitmaps get it, never the atlas, see sdf_bake_glyph().
+
+typedef struct
+{
+    double x, y;
+} vec2;
+
+static vec2 sub(vec2 a, vec2 b) { return (vec2) { a.x - b.x, a.y - b.y }; }
+static vec2 add(vec2 a, vec2 b) { return (vec2) { a.x + b.x, a.y + b.y }; }
+static vec2 mul(vec2 a, double s) { return (vec2) { a.x * s, a.y * s }; }
+static double dot(vec2 a, vec2 b) { return a.x * b.x + a.y * b.y; }
+static double clamp(double x, double lo, double hi)
+{
+    return x < lo ? lo : x > hi ? hi : x;
+}
+
+// around a segment's control points, which it never leaves
+struct box
+{
+    vec2 min, max;
+};
+
+// an sdf_segment in pixels
+struct segment
+{
+    vec2 p[3];
+    bool quadratic;
+    struct box box;
+};
+
+// where a segment crosses a scanline, and which way it goes there
+struct crossing
+{
+    double x;
+    int dir;
+};
+
+static double min_dist_straight(vec2 pos, vec2 start, vec2 end)
+{
+    vec2 b = sub(end, start);
+    vec2 c = sub(pos, start);
+
+    double t = clamp(dot(b, c) / dot(b, b), 0, 1);
+    vec2 q = sub(c, mul(b, t));
+    return dot(q, q);
+}
+
+/**
+ * Approximate a root of the cubic f[0]t^3 + f[1]t^2 + f[2]t + f[3],
+ * starting from t.
+ */
+static double newton_rhapson_cubic(double t, const double f[4])
+{
+    for (int i = 0; i < 2; i++)
+    {
+        double value = ((f[0] * t + f[1]) * t + f[2]) * t + f[3];
+        double slope = (3 * f[0] * t + 2 * f[1]) * t + f[2];
+        if (slope == 0) break;
+        t -= value / slope;
+    }
+    return t;
+}
+
+static double min_dist_bezier(vec2 pos, vec2 start, vec2 control, vec2 end)
+{
+    vec2 aA = add(sub(start, mul(control, 2)), end);
+    vec2 bB = sub(control, start);
+
+    double f[4] = {
+        dot(aA, aA),
+        3 * dot(aA, bB),
+        2 * dot(bB, bB) + dot(aA, start) - dot(aA, pos),
+        dot(bB, start) - dot(bB, pos),
+    };
+
+    double best = INFINITY;
+    for (int i = 0; i < 2; i++)
+    {
+        double t = clamp(newton_rhapson_cubic(i, f), 0, 1);
+        vec2 point = add(add(mul(aA, t * t), mul(bB, 2 * t)), start);
+        vec2 d = sub(point, pos);
+        best = fmin(best, dot(d, d));
+    }
+    return best;
+}
+
+/**
+ * Where a segment, which never turns back in y, crosses the scanline at y.
+ * It counts from its lower end up to but not including its upper one, so a
+ * contour going on through the point where two segments meet crosses once,
+ * and one only touching the scanline there not at all. Returns 1 going up,
+ * -1 going down, or 0 if it doesn't cross.
+ */
+static int crossing(struct segment *s, double y, double *x)
+{
+    vec2 a = s->p[0], b = s->p[1], c = s->p[2];
+    if (fmin(a.y, c.y) > y || fmax(a.y, c.y) <= y) return 0;
+    int dir = c.y > a.y ? 1 : -1;
+
+    double k = y - a.y;
+    if (!s->quadratic)
+    {
+        *x = a.x + (c.x - a.x) * (k / (c.y - a.y));
+        return dir;
+    }
+
+    // the root of (a - 2b + c)t^2 + 2(b - a)t = k that's on the curve,
+    // written so it holds up when the curve is nearly straight
+    vec2 aA = add(sub(a, mul(b, 2)), c);
+    vec2 bB = sub(b, a);
+    double den = bB.y + dir * sqrt(fmax(bB.y * bB.y + aA.y * k, 0));
+    double t = clamp(den == 0 ? 0 : k / den, 0, 1);
+
+    *x = (aA.x * t + 2 * bB.x) * t + a.x;
+    return dir;
+}
+
+/**
+ * Whether a segment is worth keeping, making a quadratic that's really a
+ * line into one. Fonts are full of points on top of each other, and
+ * segments of no length only cost time, and a line is cheaper than a
+ * quadratic.
+ */
+static bool clean_segment(struct sdf_segment *seg)
+{
+    int64_t ax = seg->p[0][0], ay = seg->p[0][1];
+    int64_t bx = seg->p[1][0], by = seg->p[1][1];
+    int64_t cx = seg->p[2][0], cy = seg->p[2][1];
+
+    if (seg->type == SDF_QUADRATIC)
+    {
+        // a control point on the line between the ends, or on one of them,
+        // bends nothing. One past either end makes the curve double back,
+        // which is left to the distance code.
+        bool straight = (bx - ax) * (cy - ay) == (by - ay) * (cx - ax)
+                     && (bx - ax) * (cx - bx) + (by - ay) * (cy - by) >= 0;
+        if (straight)
+        {
+            seg->type = SDF_LINE;
+            seg->p[1][0] = cx;
+            seg->p[1][1] = cy;
+        }
+    }
+    if (seg->type == SDF_LINE) return ax != cx || ay != cy;
+    return true;
+}
+
+/**
+ * Split a quadratic that turns back in y where it does, so that both halves
+ * only go one way, leaving the result in seg[0] and seg[1]. The point it's
+ * split at is rounded to half units like the rest, but the new control
+ * points get the same y as it, which keeps either half from turning back.
+ * Returns how many of the segments to keep, after clean_segment().
+ */
+static int split_segment(struct sdf_segment *seg)
+{
+    int64_t ay = seg->p[0][1], by = seg->p[1][1], cy = seg->p[2][1];
+    if (seg->type == SDF_LINE || (by - ay) * (cy - by) >= 0)
+        return clean_segment(seg);
+
+    double t = (double) (ay - by) / (ay - 2 * by + cy);
+    int32_t a[2], b[2], c[2], m[2], b0[2], b1[2];
+    for (int k = 0; k < 2; k++)
+    {
+        a[k] = seg->p[0][k];
+        b[k] = seg->p[1][k];
+        c[k] = seg->p[2][k];
+        b0[k] = lround(a[k] + (b[k] - a[k]) * t);
+        b1[k] = lround(b[k] + (c[k] - b[k]) * t);
+        m[k] = lround(((a[k] - 2.0 * b[k] + c[k]) * t
+                       + 2.0 * (b[k] - a[k])) * t + a[k]);
+    }
+    b0[1] = b1[1] = m[1];
+
+    struct sdf_segment halves[2] =
+    {
+        { { { a[0], a[1] }, { b0[0], b0[1] }, { m[0], m[1] } }, SDF_QUADRATIC },
+        { { { m[0], m[1] }, { b1[0], b1[1] }, { c[0], c[1] } }, SDF_QUADRATIC },
+    };
+    int n = 0;
+    for (int i = 0; i < 2; i++)
+    {
+        seg[n] = halves[i];
+        n += clean_segment(&seg[n]);
+    }
+    return n;
+}
+
+/**
+ * Cut glyph's contours into the lines and quadratics that make them up, in
+ * the order they come. The on curve points the format leaves out between
+ * two off curve ones are filled in, quadratics split so that none turns
+ * back in y, and segments of no length dropped, see split_segment(). Returns
+ * how many there are, in a freshly allocated *out.
+ */
+uint32_t sdf_segments(struct ttf_glyph *glyph, struct sdf_segment **out)
+{
+    contour_point_t *points = glyph->points;
+    // a quadratic can split in two
+    struct sdf_segment *segments =
+        malloc(sizeof(*segments) * 2 * ttf_num_points(glyph));
+    uint32_t n = 0;
+
+    for (int c = 0, first = 0; c < glyph->num_contours; c++)
+    {
+        int end = glyph->contour_endpoints[c] + 1;
+        for (int i = first; i < end; i++)
+        {
+            contour_point_t *a = &points[i];
+            contour_point_t *b = &points[i + 1 < end ? i + 1 : first];
+            contour_point_t *d = &points[i + 2 < end ? i + 2 : i + 2 - end + first];
+            // an off curve point's own curve starts where the one before
+            // it ends
+            if (b->on_curve && !a->on_curve) continue;
+
+            struct sdf_segment *seg = &segments[n];
+            for (int k = 0; k < 2; k++)
+            {
+                if (b->on_curve)
+                {
+                    seg->p[0][k] = 2 * a->c[k];
+                    seg->p[1][k] = seg->p[2][k] = 2 * b->c[k];
+                    continue;
+                }
+                seg->p[0][k] = a->on_curve ? 2 * a->c[k] : a->c[k] + b->c[k];
+                seg->p[1][k] = 2 * b->c[k];
+                seg->p[2][k] = d->on_curve ? 2 * d->c[k] : b->c[k] + d->c[k];
+            }
+            seg->type = b->on_curve ? SDF_LINE : SDF_QUADRATIC;
+            n += split_segment(seg);
+        }
+        first = end;
+    }
+
+    *out = segments;
+    return n;
+}
+
+static struct box segment_box(vec2 p[3])
+{
+    struct box box = { p[0], p[0] };
+    for (int i = 1; i < 3; i++)
+    {
+        box.min.x = fmin(box.min.x, p[i].x);
+        box.min.y = fmin(box.min.y, p[i].y);
+        box.max.x = fmax(box.max.x, p[i].x);
+        box.max.y = fmax(box.max.y, p[i].y);
+    }
+    return box;
+}
+
+static double box_dist(vec2 pos, struct box box)
+{
+    vec2 d =
+    {
+        fmax(fmax(box.min.x - pos.x, pos.x - box.max.x), 0),
+        fmax(fmax(box.min.y - pos.y, pos.y - box.max.y), 0),
+    };
+    return dot(d, d);
+}
+
+static double distance(vec2 pos, struct segment *segments,
+                       uint32_t num_segments, struct sdf_stats *stats)
+{
+    double min_dist = INFINITY;
+
+    for (uint32_t i = 0; i < num_segments; i++)
+    {
+        struct segment *s = &segments[i];
+        // nothing in a box farther than the best so far can beat it
+        if (box_dist(pos, s->box) >= min_dist) continue;
+
+        double dist = s->quadratic
+                    ? min_dist_bezier(pos, s->p[0], s->p[1], s->p[2])
+                    : min_dist_straight(pos, s->p[0], s->p[2]);
+        if (stats != NULL) stats->evaluated++;
+        min_dist = fmin(min_dist, dist);
+    }
+
+    return sqrt(min_dist);
+}
+
+/**
+ * Where the bitmap of glyph goes and how big it is, with one pixel of
+ * margin for the antialiased edge, without rendering anything. Leaves
+ * out's pixels alone.
+ */
+void sdf_glyph_box(struct ttf_glyph *glyph, float scale, float x_offset,
+                   struct bitmap *out)
+{
+    if (glyph->num_contours <= 0)
+    {
+        out->left = out->bottom = 0;
+        out->width = out->height = 0;
+        return;
+    }
+
+    int x0 = floor(glyph->bbox.x_min * scale + x_offset) - 1;
+    int y0 = floor(glyph->bbox.y_min * scale) - 1;
+    int x1 = ceil(glyph->bbox.x_max * scale + x_offset) + 1;
+    int y1 = ceil(glyph->bbox.y_max * scale) + 1;
+
+    out->left = x0;
+    out->bottom = y0;
+    out->width = x1 - x0;
+    out->height = y1 - y0;
+}
+
+/**
+ * Allocate the bitmap glyph goes into, see sdf_glyph_box(). Returns false
+ * if there's nothing to draw.
+ */
+static bool place_glyph(struct ttf_glyph *glyph, float scale, float x_offset,
+                        struct bitmap *out)
+{
+    sdf_glyph_box(glyph, scale, x_offset, out);
+    bitmap_alloc(out, out->width, out->height);
+    return glyph->num_contours > 0;
+}
+
+static uint8_t alpha(double dist)
+{
+    return clamp(-(dist - SDF_EDGE_BIAS), 0, 1) * 255 + 0.5;
+}
+
+/**
+ * The exact distance to the outline for every pixel of out, already placed,
+ * from the glyph's raw segments, which it frees.
+ */
+static void render_exact(struct sdf_segment *raw, uint32_t num_segments,
+                         float scale, float x_offset, struct bitmap *out,
+                         struct sdf_stats *stats)
+{
+    // scale once up front, relative to the bitmap's corner
+    struct segment *segments = malloc(sizeof(*segments) * num_segments);
+    for (uint32_t i = 0; i < num_segments; i++)
+    {
+        for (int j = 0; j < 3; j++)
+        {
+            segments[i].p[j].x =
+                raw[i].p[j][0] * 0.5 * scale + x_offset - out->left;
+            segments[i].p[j].y = raw[i].p[j][1] * 0.5 * scale - out->bottom;
+        }
+        segments[i].quadratic = raw[i].type == SDF_QUADRATIC;
+        segments[i].box = segment_box(segments[i].p);
+    }
+    free(raw);
+
+    if (stats != NULL)
+    {
+        stats->pixels += out->width * out->height;
+        stats->segments += (uint64_t) num_segments * out->width * out->height;
+    }
+
+    // A pixel is inside if the contours wind around it, nonzero counting
+    // the segments crossing its scanline to the right of it and which way.
+    // Those are the same for the whole row, so find them once.
+    struct crossing *crossings = malloc(sizeof(*crossings) * num_segments);
+    for (int y = 0; y < out->height; y++)
+    {
+        uint32_t num_crossings = 0;
+        for (uint32_t i = 0; i < num_segments; i++)
+        {
+            struct crossing *c = &crossings[num_crossings];
+            c->dir = crossing(&segments[i], y + 0.5, &c->x);
+            if (c->dir != 0) num_crossings++;
+        }
+
+        for (int x = 0; x < out->width; x++)
+        {
+            vec2 pos = { x + 0.5, y + 0.5 };
+            int winding = 0;
+            for (uint32_t i = 0; i < num_crossings; i++)
+                if (crossings[i].x > pos.x) winding += crossings[i].dir;
+
+            double dist = distance(pos, segments, num_segments, stats);
+            if (winding != 0) dist = -dist;
+            out->pixels[y * out->width + x] = alpha(dist);
+        }
+    }
+
+    free(crossings);
+    free(segments);
+}
+
+/**
+ * Felzenszwalb and Huttenlocher's exact distance transform along one line:
+ * d[q] is the least (q - p)^2 + f[p] over every p, found in linear time by
+ * keeping the lower envelope of the parabolas rooted at each p. v and z are
+ * scratch for n and n + 1 entries.
+ */
+static void edt_line(const float *f, float *d, int n, int *v, double *z)
+{
+    int k = 0;
+    v[0] = 0;
+    z[0] = -INFINITY;
+    z[1] = INFINITY;
+    for (int q = 1; q < n; q++)
+    {
+        // where q's parabola drops below the one on top at the moment,
+        // which hides it altogether if that's before where it starts
+        double s;
+        for (;;)
+        {
+            int p = v[k];
+            s = (f[q] + (double) q * q - f[p] - (double) p * p) / (2 * (q - p));
+            if (s > z[k]) break;
+            k--;
+        }
+        k++;
+        v[k] = q;
+        z[k] = s;
+        z[k + 1] = INFINITY;
+    }
+
+    k = 0;
+    for (int q = 0; q < n; q++)
+    {
+        while (z[k + 1] < q) k++;
+        d[q] = (double) (q - v[k]) * (q - v[k]) + f[v[k]];
+    }
+}
+
+struct edt_lines
+{
+    struct coverage_accumulator acc;
+    float left, bottom, width;
+};
+
+static void edt_line_to(void *ctx, float x0, float y0, float x1, float y1)
+{
+    // clamped, in case a control point strays outside the bbox
+    struct edt_lines *e = ctx;
+    coverage_draw_line(&e->acc,
+        fminf(fmaxf(x0 - e->left, 0), e->width),
+        fminf(fmaxf(y0 - e->bottom, 0), e->acc.height),
+        fminf(fmaxf(x1 - e->left, 0), e->width),
+        fminf(fmaxf(y1 - e->bottom, 0), e->acc.height));
+}
+
+/**
+ * The distance for every pixel of out, already placed, from the glyph's
+ * coverage at SDF_EDT_SCALE times the resolution instead of its outline.
+ * Fine pixels at least half covered are inside. Every pixel of out is
+ * centered on the corner of four fine ones, and gets the mean of their
+ * distances to the nearest fine pixel on the other side, so it's off from
+ * the exact distance by about half a fine pixel at most, but costs the
+ * same however many segments there are.
+ *
+ * Only the fine rows through those corners are needed in the end. Their
+ * distances along each column take one scan down and one up, and the
+ * exact distance along the rows from there edt_line().
+ */
+static void render_edt(struct ttf_glyph *glyph, float scale, float x_offset,
+                       struct bitmap *out)
+{
+    const int f = SDF_EDT_SCALE;
+    int width = out->width * f, height = out->height * f;
+
+    // rows spill into the next, which is fine since their cells add up to
+    // zero, and the last one into a couple of spare cells
+    size_t n = (size_t) width * height;
+    struct edt_lines lines =
+    {
+        .acc = { calloc(n + 2, sizeof(float)), width, height },
+        .left = (float) out->left * f,
+        .bottom = (float) out->bottom * f,
+        .width = width,
+    };
+    uint8_t *cover = malloc(n);
+    coverage_flatten(glyph, scale * f, x_offset * f, edt_line_to, &lines);
+    coverage_accumulate(lines.acc.cells, cover, n);
+    free(lines.acc.cells);
+
+    // for each sampled row, how far up or down its column the nearest
+    // fine pixel inside is, and the nearest outside one
+    int rows = out->height * 2;
+    float *to_in = malloc(sizeof(float) * rows * width);
+    float *to_out = malloc(sizeof(float) * rows * width);
+    int *last_in = malloc(sizeof(int) * width);
+    int *last_out = malloc(sizeof(int) * width);
+    const int far = width + height;
+
+    for (int pass = 0; pass < 2; pass++)
+    {
+        for (int x = 0; x < width; x++)
+            last_in[x] = last_out[x] = pass == 0 ? -far : height + far;
+
+        for (int i = 0; i < height; i++)
+        {
+            int y = pass == 0 ? i : height - 1 - i;
+            const uint8_t *row = cover + (size_t) y * width;
+            for (int x = 0; x < width; x++)
+            {
+                if (row[x] >= 128) last_in[x] = y;
+                else last_out[x] = y;
+            }
+
+            // sampled rows are the two on either side of every pixel's
+            // middle, f / 2 - 1 and f / 2 into it
+            int r = (y + 1 - f / 2) % f;
+            if (r != 0 && r != 1) continue;
+            int sample = (y + 1 - f / 2) / f * 2 + r;
+            if (sample < 0 || sample >= rows) continue;
+            float *in = to_in + (size_t) sample * width;
+            float *outside = to_out + (size_t) sample * width;
+            for (int x = 0; x < width; x++)
+            {
+                float a = abs(y - last_in[x]), b = abs(y - last_out[x]);
+                in[x] = pass == 0 ? a * a : fminf(in[x], a * a);
+                outside[x] = pass == 0 ? b * b : fminf(outside[x], b * b);
+            }
+        }
+    }
+    free(last_in);
+    free(last_out);
+
+    // and then along the sampled rows, into signed distances in fine pixels,
+    // half a pixel short of the centers of the nearest ones
+    float *signed_dist = malloc(sizeof(float) * rows * width);
+    float *in_d = malloc(sizeof(float) * width);
+    float *out_d = malloc(sizeof(float) * width);
+    int *v = malloc(sizeof(int) * width);
+    double *z = malloc(sizeof(double) * (width + 1));
+    for (int sample = 0; sample < rows; sample++)
+    {
+        int y = sample / 2 * f + f / 2 - 1 + sample % 2;
+        const uint8_t *row = cover + (size_t) y * width;
+        edt_line(to_in + (size_t) sample * width, in_d, width, v, z);
+        edt_line(to_out + (size_t) sample * width, out_d, width, v, z);
+
+        float *d = signed_dist + (size_t) sample * width;
+        for (int x = 0; x < width; x++)
+            d[x] = row[x] >= 128 ? 0.5f - sqrtf(out_d[x])
+                                 : sqrtf(in_d[x]) - 0.5f;
+    }
+    free(in_d);
+    free(out_d);
+    free(v);
+    free(z);
+    free(to_in);
+    free(to_out);
+    free(cover);
+
+    for (int y = 0; y < out->height; y++)
+    {
+        const float *lo = signed_dist + (size_t) y * 2 * width;
+        const float *hi = lo + width;
+        for (int x = 0; x < out->width; x++)
+        {
+            int fx = x * f + f / 2 - 1;
+            double dist = (lo[fx] + lo[fx + 1] + hi[fx] + hi[fx + 1]) / 4;
+            out->pixels[y * out->width + x] = alpha(dist / f);
+        }
+    }
+    free(signed_dist);
+}
+
+/**
+ * Render glyph scaled by scale (pixels per font unit), shifted right by
+ * x_offset pixels, into a freshly allocated bitmap. If stats isn't NULL,
+ * the pixels and segments that took are added to it.
+ */
+void sdf_render_glyph(struct ttf_glyph *glyph, float scale, float x_offset,
+                      struct bitmap *out, struct sdf_stats *stats)
+{
+    if (!place_glyph(glyph, scale, x_offset, out)) return;
+
+    struct sdf_segment *raw;
+    uint32_t num_segments = sdf_segments(glyph, &raw);
+    render_exact(raw, num_segments, scale, x_offset, out, stats);
+}
+
+/**
+ * sdf_render_glyph() by a distance transform of finer coverage, see
+ * render_edt(), taking time in proportion to the glyph's area alone. It's
+ * up to a couple of levels out of 255 off the exact distance on average,
+ * more along hairlines, so it isn't what sdf.glsl would draw.
+ */
+void sdf_render_glyph_edt(struct ttf_glyph *glyph, float scale,
+                          float x_offset, struct bitmap *out)
+{
+    if (!place_glyph(glyph, scale, x_offset, out)) return;
+    render_edt(glyph, scale, x_offset, out);
+}
+
+/**
+ * For bitmaps nothing has to match the shader on: sdf_render_glyph_edt()
+ * for glyphs of more than SDF_EDT_SEGMENTS segments, sdf_render_glyph()
+ * for the rest, whichever is quicker. stats only counts the latter.
+ */
+void sdf_bake_glyph(struct ttf_glyph *glyph, float scale, float x_offset,
+                    struct bitmap *out, struct sdf_stats *stats)
+{
+    if (!place_glyph(glyph, scale, x_offset, out)) return;
+
+    struct sdf_segment *raw;
+    uint32_t num_segments = sdf_segments(glyph, &raw);
+    if (num_segments > SDF_EDT_SEGMENTS)
+    {
+        free(raw);
+        render_edt(glyph, scale, x_offset, out);
+        return;
+    }
+    render_exact(raw, num_segments, scale, x_offset, out, stats);
+}
@@ -0,0 +1,56 @@
+#include <stdint.h>
+#include "bitmap.h"
+#include "truetype.h"
+
+#ifndef SDF_H
+#define SDF_H
+
+// sdf_bake_glyph() gives glyphs with more segments than this distances from
+// a transform of their coverage, rather than to each segment, see
+// sdf_render_glyph_edt(). It's about where that starts to be quicker for
+// Devanagari and CJK glyphs at 32 and 96 px, see make bench-raster-scripts.
+#ifndef SDF_EDT_SEGMENTS
+#define SDF_EDT_SEGMENTS 35
+#endif
+
+// how many times finer than the bitmap that coverage is, an even number
+#ifndef SDF_EDT_SCALE
+#define SDF_EDT_SCALE 8
+#endif
+
+// How far past the outline, in pixels, the edge is drawn, which thickens
+// glyphs a little. sdf.glsl has its own EDGE_BIAS, keep the two the same.
+#define SDF_EDGE_BIAS 0.4
+
+enum sdf_segment_type { SDF_LINE, SDF_QUADRATIC };
+
+// A line from p[0] to p[2], or a quadratic from p[0] through p[1] to p[2],
+// in half font units so that implied on curve points fall on whole ones.
+// Lines have p[1] on p[2]. None of them turn back in y, so each crosses a
+// scanline at most once.
+struct sdf_segment
+{
+    int32_t p[3][2];
+    enum sdf_segment_type type;
+};
+
+// How much work the distance loop did. Every pixel could look at every
+// segment, but skips those whose box is farther than the best so far.
+struct sdf_stats
+{
+    uint64_t pixels;
+    uint64_t segments; // in all the glyphs, times their pixels
+    uint64_t evaluated;
+};
+
+void sdf_render_glyph(struct ttf_glyph *, float scale, float x_offset,
+                      struct bitmap *, struct sdf_stats *);
+void sdf_render_glyph_edt(struct ttf_glyph *, float scale, float x_offset,
+                          struct bitmap *);
+void sdf_bake_glyph(struct ttf_glyph *, float scale, float x_offset,
+                    struct bitmap *, struct sdf_stats *);
+void sdf_glyph_box(struct ttf_glyph *, float scale, float x_offset,
+                   struct bitmap *);
+uint32_t sdf_segments(struct ttf_glyph *, struct sdf_segment **out);
+
+#endif // SDF_H
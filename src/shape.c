@@ -0,0 +1,622 @@
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "shape.h"
+
+#define MAX_LOOKUPS 256
+
+#define TAG(a, b, c, d) ((uint32_t) (a) << 24 | (b) << 16 | (c) << 8 | (d))
+
+enum
+{
+    CAT_OTHER,
+    CAT_CONSONANT,
+    CAT_RA,
+    CAT_NUKTA,
+    CAT_HALANT,
+    CAT_VOWEL,
+    CAT_MATRA,
+    CAT_PRE_MATRA,
+    CAT_MODIFIER,
+    CAT_ZWJ,
+    CAT_ZWNJ,
+    CAT_REPH, // not a character, what Ra + Halant becomes after rphf
+};
+
+// Which glyphs of a syllable each feature may touch.
+enum
+{
+    MASK_GLOBAL = 1 << 0,
+    MASK_RPHF   = 1 << 1,
+    MASK_HALF   = 1 << 2,
+    MASK_POST   = 1 << 3,
+};
+
+struct feature
+{
+    uint32_t tag;
+    uint32_t mask;
+};
+
+// Applied one feature at a time, in this order.
+static const struct feature indic_basic[] =
+{
+    { TAG('n','u','k','t'), MASK_GLOBAL },
+    { TAG('a','k','h','n'), MASK_GLOBAL },
+    { TAG('r','p','h','f'), MASK_RPHF },
+    { TAG('r','k','r','f'), MASK_GLOBAL },
+    { TAG('b','l','w','f'), MASK_POST },
+    { TAG('a','b','v','f'), MASK_POST },
+    { TAG('h','a','l','f'), MASK_HALF },
+    { TAG('p','s','t','f'), MASK_POST },
+    { TAG('v','a','t','u'), MASK_GLOBAL },
+    { TAG('c','j','c','t'), MASK_GLOBAL },
+};
+
+// Applied together, in lookup order.
+static const struct feature indic_presentation[] =
+{
+    { TAG('p','r','e','s'), MASK_GLOBAL },
+    { TAG('a','b','v','s'), MASK_GLOBAL },
+    { TAG('b','l','w','s'), MASK_GLOBAL },
+    { TAG('p','s','t','s'), MASK_GLOBAL },
+    { TAG('h','a','l','n'), MASK_GLOBAL },
+    { TAG('c','a','l','t'), MASK_GLOBAL },
+    { TAG('c','l','i','g'), MASK_GLOBAL },
+};
+
+static const struct feature default_features[] =
+{
+    { TAG('c','c','m','p'), MASK_GLOBAL },
+    { TAG('l','o','c','l'), MASK_GLOBAL },
+    { TAG('r','l','i','g'), MASK_GLOBAL },
+    { TAG('c','a','l','t'), MASK_GLOBAL },
+    { TAG('l','i','g','a'), MASK_GLOBAL },
+    { TAG('c','l','i','g'), MASK_GLOBAL },
+};
+
+#define LENGTH(a) (sizeof(a) / sizeof(*(a)))
+
+struct word_entry
+{
+    uint32_t *text;
+    size_t len;
+    uint16_t *glyphs;
+    uint32_t num_glyphs;
+};
+
+static bool is_devanagari(uint32_t c)
+{
+    return c >= 0x0900 && c <= 0x097f;
+}
+
+static uint8_t category(uint32_t c)
+{
+    if (c == 0x200c) return CAT_ZWNJ;
+    if (c == 0x200d) return CAT_ZWJ;
+    if (!is_devanagari(c)) return CAT_OTHER;
+
+    if (c == 0x0930) return CAT_RA;
+    if ((c >= 0x0915 && c <= 0x0939) || (c >= 0x0958 && c <= 0x095f)
+            || (c >= 0x0978 && c <= 0x097f))
+        return CAT_CONSONANT;
+    if (c == 0x093c) return CAT_NUKTA;
+    if (c == 0x094d) return CAT_HALANT;
+    if (c == 0x093f || c == 0x094e) return CAT_PRE_MATRA;
+    if ((c >= 0x093a && c <= 0x094c) || c == 0x094f
+            || (c >= 0x0955 && c <= 0x0957) || c == 0x0962 || c == 0x0963)
+        return CAT_MATRA;
+    if ((c >= 0x0904 && c <= 0x0914) || c == 0x0960 || c == 0x0961
+            || (c >= 0x0972 && c <= 0x0977))
+        return CAT_VOWEL;
+    if (c >= 0x0900 && c <= 0x0903) return CAT_MODIFIER;
+    return CAT_OTHER;
+}
+
+static bool is_consonant(uint8_t cat)
+{
+    return cat == CAT_CONSONANT || cat == CAT_RA;
+}
+
+/**
+ * Add a stage for features, applied to glyphs with mask. Features the font
+ * doesn't have under script don't add anything.
+ */
+static void add_stage(struct shape_plan *plan, struct ttf_gsub *gsub,
+                      uint32_t script, const struct feature *features,
+                      int num_features)
+{
+    uint16_t lookups[MAX_LOOKUPS];
+    int n = 0;
+    uint32_t mask = 0;
+
+    for (int f = 0; f < num_features; f++)
+    {
+        int added = gsub_feature_lookups(gsub, script, features[f].tag,
+                                         lookups + n, MAX_LOOKUPS - n);
+        if (added) mask |= features[f].mask;
+        n += added;
+    }
+    if (n == 0) return;
+
+    // merged features still go in lookup order, and only once each
+    for (int i = 1; i < n; i++)
+        for (int j = i; j > 0 && lookups[j - 1] > lookups[j]; j--)
+        {
+            uint16_t tmp = lookups[j];
+            lookups[j] = lookups[j - 1];
+            lookups[j - 1] = tmp;
+        }
+    int unique = 0;
+    for (int i = 0; i < n; i++)
+        if (unique == 0 || lookups[unique - 1] != lookups[i])
+            lookups[unique++] = lookups[i];
+
+    plan->stages = realloc(plan->stages,
+                           sizeof(*plan->stages) * (plan->num_stages + 1));
+    struct shape_stage *stage = &plan->stages[plan->num_stages++];
+    stage->mask = mask;
+    stage->num_lookups = unique;
+    stage->lookups = malloc(sizeof(*stage->lookups) * unique);
+    memcpy(stage->lookups, lookups, sizeof(*lookups) * unique);
+}
+
+static void plan_free(struct shape_plan *plan)
+{
+    for (int i = 0; i < plan->num_stages; i++)
+        free(plan->stages[i].lookups);
+    free(plan->stages);
+}
+
+static uint32_t pick_script(struct ttf_gsub *gsub, const uint32_t *scripts,
+                            int count)
+{
+    for (int i = 0; i < count; i++)
+        if (gsub_has_script(gsub, scripts[i])) return scripts[i];
+    return 0;
+}
+
+static void plan_indic(struct shape_plan *plan, struct ttf_gsub *gsub)
+{
+    // dev2 is the newer shaping model, deva fonts get treated the same
+    static const uint32_t scripts[] =
+        { TAG('d','e','v','2'), TAG('d','e','v','a') };
+    uint32_t script = pick_script(gsub, scripts, LENGTH(scripts));
+
+    memset(plan, 0, sizeof(*plan));
+    plan->rphf_stage = -1;
+    plan->reorder_stage = -1;
+    if (script == 0) return;
+
+    for (size_t i = 0; i < LENGTH(indic_basic); i++)
+    {
+        int before = plan->num_stages;
+        add_stage(plan, gsub, script, &indic_basic[i], 1);
+        if (indic_basic[i].mask == MASK_RPHF && plan->num_stages > before)
+            plan->rphf_stage = before;
+    }
+    plan->reorder_stage = plan->num_stages;
+    add_stage(plan, gsub, script, indic_presentation,
+              LENGTH(indic_presentation));
+}
+
+static void plan_default(struct shape_plan *plan, struct ttf_gsub *gsub)
+{
+    static const uint32_t scripts[] =
+        { TAG('l','a','t','n'), TAG('D','F','L','T') };
+    uint32_t script = pick_script(gsub, scripts, LENGTH(scripts));
+
+    memset(plan, 0, sizeof(*plan));
+    plan->rphf_stage = -1;
+    plan->reorder_stage = -1;
+    if (script == 0) return;
+
+    add_stage(plan, gsub, script, default_features, LENGTH(default_features));
+}
+
+struct ttf_shaper *ttf_parse_shaper(void *gsub, void *gdef)
+{
+    if (gsub == NULL) return NULL;
+
+    struct ttf_shaper *s = calloc(1, sizeof(*s));
+    if (ttf_parse_gsub(&s->gsub, gsub, gdef) != OK)
+    {
+        free(s);
+        return NULL;
+    }
+
+    plan_indic(&s->indic, &s->gsub);
+    plan_default(&s->other, &s->gsub);
+    if (s->indic.num_stages == 0 && s->other.num_stages == 0)
+    {
+        plan_free(&s->indic);
+        plan_free(&s->other);
+        ttf_gsub_free(&s->gsub);
+        free(s);
+        return NULL;
+    }
+
+    s->words = hashmap_create(64);
+    return s;
+}
+
+static void entry_free(struct word_entry *entry)
+{
+    free(entry->text);
+    free(entry->glyphs);
+    free(entry);
+}
+
+static void flush_words(struct ttf_shaper *s)
+{
+    for (uint32_t i = 0; i < s->words.cap; i++)
+        if (s->words.buckets[i].dist)
+            entry_free(s->words.buckets[i].value);
+    hashmap_destroy(&s->words);
+    s->words = hashmap_create(64);
+}
+
+/**
+ * A shaper for another thread. The parsed tables are shared, which is fine
+ * since shaping only reads them, but the word cache and scratch buffer are
+ * its own. It has to be freed before the one it was cloned from.
+ */
+struct ttf_shaper *ttf_shaper_clone(struct ttf_shaper *s)
+{
+    if (s == NULL) return NULL;
+
+    struct ttf_shaper *clone = calloc(1, sizeof(*clone));
+    clone->gsub = s->gsub;
+    clone->indic = s->indic;
+    clone->other = s->other;
+    clone->words = hashmap_create(64);
+    clone->clone = true;
+    return clone;
+}
+
+void ttf_shaper_free(struct ttf_shaper *s)
+{
+    if (s == NULL) return;
+
+    flush_words(s);
+    hashmap_destroy(&s->words);
+    if (!s->clone)
+    {
+        plan_free(&s->indic);
+        plan_free(&s->other);
+        ttf_gsub_free(&s->gsub);
+    }
+    gsub_buffer_free(&s->buffer);
+    free(s->glyphs);
+    free(s);
+}
+
+/**
+ * Find the syllable starting at start and return where it ends. Only
+ * consonant and vowel syllables are more than one character long, the
+ * broken ones are left alone.
+ */
+static size_t syllable_end(struct gsub_buffer *buf, size_t start)
+{
+    struct gsub_glyph *g = buf->glyphs;
+    size_t i = start;
+    uint8_t cat = g[i].category;
+
+    if (is_consonant(cat))
+    {
+        for (;;)
+        {
+            // C N? (H (ZWJ|ZWNJ)? C N?)*
+            i++;
+            if (i < buf->len && g[i].category == CAT_NUKTA) i++;
+            if (i >= buf->len || g[i].category != CAT_HALANT) break;
+
+            size_t j = i + 1;
+            if (j < buf->len && (g[j].category == CAT_ZWJ
+                                 || g[j].category == CAT_ZWNJ))
+                j++;
+            if (j >= buf->len || !is_consonant(g[j].category)) break;
+            i = j;
+        }
+    }
+    else if (cat == CAT_VOWEL)
+    {
+        i++;
+        if (i < buf->len && g[i].category == CAT_NUKTA) i++;
+    }
+    else
+    {
+        return start + 1;
+    }
+
+    // then any dependent signs
+    while (i < buf->len)
+    {
+        uint8_t c = g[i].category;
+        if (c != CAT_MATRA && c != CAT_PRE_MATRA && c != CAT_NUKTA
+                && c != CAT_HALANT && c != CAT_MODIFIER
+                && c != CAT_ZWJ && c != CAT_ZWNJ)
+            break;
+        i++;
+    }
+
+    return i;
+}
+
+/**
+ * Find the base consonant, set up the masks that say which glyphs can form
+ * reph, half forms and post base forms, and move a pre base matra in front
+ * of the consonants.
+ */
+static void initial_reorder(struct gsub_buffer *buf, size_t start, size_t end)
+{
+    struct gsub_glyph *g = buf->glyphs;
+    if (!is_consonant(g[start].category)) return;
+
+    // the base is the last consonant, unless that's a Ra taking its below
+    // base form. A leading Ra Halant before another consonant is reph and
+    // can't be the base, so in Ra Halant Ra the second Ra is
+    size_t base = start;
+    for (size_t i = start; i < end; i++)
+        if (is_consonant(g[i].category)) base = i;
+
+    size_t reph_end = start;
+    if (g[start].category == CAT_RA && base >= start + 2
+            && g[start + 1].category == CAT_HALANT
+            && g[start + 2].category != CAT_ZWJ)
+        reph_end = start + 2;
+
+    if (g[base].category == CAT_RA && base > reph_end
+            && g[base - 1].category == CAT_HALANT)
+    {
+        for (size_t i = base - 1; i > reph_end; i--)
+            if (is_consonant(g[i - 1].category))
+            {
+                base = i - 1;
+                break;
+            }
+    }
+
+    for (size_t i = start; i < reph_end; i++)
+        g[i].mask |= MASK_RPHF;
+    for (size_t i = reph_end; i < base; i++)
+        g[i].mask |= MASK_HALF;
+    for (size_t i = base + 1; i < end; i++)
+        g[i].mask |= MASK_POST;
+
+    for (size_t i = base + 1; i < end; i++)
+    {
+        if (g[i].category != CAT_PRE_MATRA) continue;
+
+        struct gsub_glyph matra = g[i];
+        memmove(&g[reph_end + 1], &g[reph_end],
+                sizeof(*g) * (i - reph_end));
+        g[reph_end] = matra;
+    }
+}
+
+/**
+ * After rphf, a syllable that starts with a single substituted glyph
+ * carrying the rphf mask has formed a reph.
+ */
+static void find_reph(struct gsub_buffer *buf)
+{
+    struct gsub_glyph *g = buf->glyphs;
+    for (uint32_t i = 0; i < buf->len; i++)
+    {
+        bool first = i == 0 || g[i - 1].syllable != g[i].syllable;
+        if (!first || !(g[i].mask & MASK_RPHF) || !g[i].substituted)
+            continue;
+        if (i + 1 < buf->len && (g[i + 1].mask & MASK_RPHF)
+                && g[i + 1].syllable == g[i].syllable)
+            continue; // Ra and Halant are still separate glyphs
+        g[i].category = CAT_REPH;
+    }
+}
+
+/**
+ * A pre base matra goes after the last halant before the base that didn't
+ * form a half form, rather than in front of a consonant that's drawn with a
+ * visible halant. Reph is written first but drawn last, move it to the end
+ * of its syllable, before any trailing anusvara, candrabindu or visarga.
+ */
+static void final_reorder(struct gsub_buffer *buf)
+{
+    struct gsub_glyph *g = buf->glyphs;
+    for (uint32_t i = 0; i < buf->len; i++)
+    {
+        if (g[i].category != CAT_PRE_MATRA) continue;
+
+        // a ZWJ after the halant asked for the half form, a ZWNJ stays with
+        // the halant
+        uint32_t to = i;
+        for (uint32_t j = i + 1; j < buf->len && (g[j].mask & MASK_HALF)
+                && g[j].syllable == g[i].syllable; j++)
+        {
+            if (g[j].category != CAT_HALANT) continue;
+            uint8_t next = j + 1 < buf->len ? g[j + 1].category : CAT_OTHER;
+            if (next != CAT_ZWJ) to = next == CAT_ZWNJ ? j + 1 : j;
+        }
+
+        struct gsub_glyph matra = g[i];
+        memmove(&g[i], &g[i + 1], sizeof(*g) * (to - i));
+        g[to] = matra;
+        i = to;
+    }
+
+    for (uint32_t i = 0; i < buf->len; i++)
+    {
+        if (g[i].category != CAT_REPH) continue;
+
+        uint32_t end = i + 1;
+        while (end < buf->len && g[end].syllable == g[i].syllable) end++;
+        while (end > i + 1 && g[end - 1].category == CAT_MODIFIER) end--;
+
+        struct gsub_glyph reph = g[i];
+        reph.category = CAT_OTHER;
+        memmove(&g[i], &g[i + 1], sizeof(*g) * (end - i - 1));
+        g[end - 1] = reph;
+    }
+}
+
+static void run_stage(struct ttf_shaper *s, struct shape_stage *stage)
+{
+    for (int i = 0; i < stage->num_lookups; i++)
+        gsub_apply_lookup(&s->gsub, stage->lookups[i], stage->mask,
+                          &s->buffer);
+}
+
+static void shape(struct ttf_shaper *s, struct ttf_reader *reader,
+                  const uint32_t *text, size_t len)
+{
+    struct gsub_buffer *buf = &s->buffer;
+    buf->len = 0;
+
+    bool indic = false;
+    for (size_t i = 0; i < len; i++)
+    {
+        // the cmap we read only covers the BMP
+        uint32_t c = text[i];
+        struct gsub_glyph g =
+        {
+            .glyph = c > 0xffff ? 0 : ttf_lookup_index(reader->cmap, c),
+            .category = category(c),
+            .mask = MASK_GLOBAL,
+        };
+        gsub_buffer_push(buf, g);
+        indic |= is_devanagari(c);
+    }
+
+    struct shape_plan *plan = &s->other;
+    if (indic && s->indic.num_stages)
+    {
+        plan = &s->indic;
+        uint16_t syllable = 0;
+        for (size_t start = 0, end; start < buf->len; start = end)
+        {
+            end = syllable_end(buf, start);
+            for (size_t i = start; i < end; i++)
+                buf->glyphs[i].syllable = syllable;
+            initial_reorder(buf, start, end);
+            syllable++;
+        }
+    }
+
+    for (int i = 0; i <= plan->num_stages; i++)
+    {
+        // reph goes into place before the presentation forms see it
+        if (i == plan->reorder_stage) final_reorder(buf);
+        if (i == plan->num_stages) break;
+
+        run_stage(s, &plan->stages[i]);
+        if (i == plan->rphf_stage) find_reph(buf);
+    }
+
+    // joiners only steer the substitutions, but some fonts have a glyph
+    // that shows them
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < buf->len; i++)
+        if (buf->glyphs[i].category != CAT_ZWJ
+                && buf->glyphs[i].category != CAT_ZWNJ)
+            buf->glyphs[n++] = buf->glyphs[i];
+    buf->len = n;
+}
+
+static uint64_t hash_word(const uint32_t *text, size_t len)
+{
+    uint64_t h = len;
+    for (size_t i = 0; i < len; i++)
+        h = hashmap_hash(h ^ text[i]) ^ (h >> 29);
+    return h;
+}
+
+/**
+ * Shape a word, that is a run of text without spaces or newlines. The glyphs
+ * belong to the shaper and stay valid until the next call. Without GSUB this
+ * is just a cmap lookup per character.
+ */
+const uint16_t *shape_word(struct ttf_reader *reader, const uint32_t *text,
+                           size_t len, uint32_t *num_glyphs)
+{
+    struct ttf_shaper *s = reader->shaper;
+    if (s == NULL) return NULL;
+
+    if (s->uncached)
+    {
+        s->stats.misses++;
+        shape(s, reader, text, len);
+        if (s->buffer.len + 1 > s->glyphs_cap)
+        {
+            s->glyphs_cap = s->buffer.len + 1;
+            s->glyphs = realloc(s->glyphs, sizeof(*s->glyphs) * s->glyphs_cap);
+        }
+        for (uint32_t i = 0; i < s->buffer.len; i++)
+            s->glyphs[i] = s->buffer.glyphs[i].glyph;
+        *num_glyphs = s->buffer.len;
+        return s->glyphs;
+    }
+
+    uint64_t key = hash_word(text, len);
+    struct word_entry *entry = hashmap_get(&s->words, key);
+    if (entry != NULL && entry->len == len
+            && memcmp(entry->text, text, sizeof(*text) * len) == 0)
+    {
+        s->stats.hits++;
+        *num_glyphs = entry->num_glyphs;
+        return entry->glyphs;
+    }
+    s->stats.misses++;
+
+    shape(s, reader, text, len);
+
+    if (entry == NULL && s->words.len >= SHAPE_CACHE_WORDS)
+    {
+        flush_words(s);
+        s->stats.flushes++;
+    }
+
+    // a different word that hashed the same, the newer one wins
+    if (entry != NULL)
+    {
+        hashmap_remove(&s->words, key);
+        entry_free(entry);
+    }
+
+    entry = malloc(sizeof(*entry));
+    entry->len = len;
+    entry->text = malloc(sizeof(*text) * len);
+    memcpy(entry->text, text, sizeof(*text) * len);
+    entry->num_glyphs = s->buffer.len;
+    entry->glyphs = malloc(sizeof(*entry->glyphs) * (s->buffer.len + 1));
+    for (uint32_t i = 0; i < s->buffer.len; i++)
+        entry->glyphs[i] = s->buffer.glyphs[i].glyph;
+    hashmap_insert(&s->words, key, entry);
+
+    *num_glyphs = entry->num_glyphs;
+    return entry->glyphs;
+}
+
+/**
+ * Whether shaping could change a word with glyph in it, outside of
+ * Devanagari. Words made only of glyphs it couldn't change can skip the
+ * shaper entirely.
+ */
+bool shape_may_change(struct ttf_shaper *s, uint16_t glyph)
+{
+    for (int i = 0; i < s->other.num_stages; i++)
+    {
+        struct shape_stage *stage = &s->other.stages[i];
+        for (int l = 0; l < stage->num_lookups; l++)
+            if (gsub_lookup_covers(&s->gsub, stage->lookups[l], glyph))
+                return true;
+    }
+    return false;
+}
+
+void shape_print_stats(struct ttf_shaper *s, FILE *f)
+{
+    fprintf(f, "shaper: %u words cached, %" PRIu64 " hits, "
+            "%" PRIu64 " misses, %" PRIu64 " flushes\n",
+            s->words.len, s->stats.hits, s->stats.misses, s->stats.flushes);
+}
@@ -0,0 +1,68 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdint.h>
+#include "hashmap.h"
+#include "gsub.h"
+#include "truetype.h"
+
+#ifndef SHAPE_H
+#define SHAPE_H
+
+#ifndef SHAPE_CACHE_WORDS
+#define SHAPE_CACHE_WORDS 8192
+#endif
+
+// Turns words into glyphs with the font's GSUB features. Devanagari words
+// are split into syllables and reordered the way the OpenType Indic spec
+// describes before the features run, everything else just gets the default
+// ligatures. Text is mostly the same few words over and over, so shaped
+// words are cached per font. Once the cache holds SHAPE_CACHE_WORDS words it
+// is emptied and starts over, which is crude but never thrashes worse than
+// not caching.
+
+struct shape_stage
+{
+    uint32_t mask;
+    uint16_t *lookups;
+    int num_lookups;
+};
+
+struct shape_plan
+{
+    struct shape_stage *stages;
+    int num_stages;
+    int rphf_stage;    // reph is looked for after this stage, -1 for never
+    int reorder_stage; // and moved into place before this one
+};
+
+struct shape_stats
+{
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t flushes;
+};
+
+struct ttf_shaper
+{
+    struct ttf_gsub gsub;
+    struct shape_plan indic;
+    struct shape_plan other;
+    hashmap_t words;
+    struct gsub_buffer buffer; // scratch
+    struct shape_stats stats;
+    bool uncached; // shape every word every time, to see what the cache buys
+    uint16_t *glyphs; // what an uncached word came out as
+    uint32_t glyphs_cap;
+    bool clone; // the gsub tables and plans belong to another shaper
+};
+
+struct ttf_shaper *ttf_parse_shaper(void *gsub, void *gdef);
+struct ttf_shaper *ttf_shaper_clone(struct ttf_shaper *);
+void ttf_shaper_free(struct ttf_shaper *);
+const uint16_t *shape_word(struct ttf_reader *, const uint32_t *codepoints,
+                           size_t len, uint32_t *num_glyphs);
+bool shape_may_change(struct ttf_shaper *, uint16_t glyph);
+void shape_print_stats(struct ttf_shaper *, FILE *);
+
+#endif // SHAPE_H
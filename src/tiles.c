@@ -0,0 +1,244 @@
+#include <math.h>
+#include <stdlib.h>
+#include "glyphcache.h"
+#include "tiles.h"
+
+void tiles_init(struct tile_renderer *tr, int width, int height,
+                int num_threads)
+{
+    tr->width = width;
+    tr->height = height;
+    tr->tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+    tr->tiles_y = (height + TILE_SIZE - 1) / TILE_SIZE;
+    tr->tiles = calloc((size_t) tr->tiles_x * tr->tiles_y, sizeof(*tr->tiles));
+    tr->rows = calloc(tr->tiles_y, sizeof(*tr->rows));
+    tr->glyphs = NULL;
+    tr->num_glyphs = tr->num_placed = tr->glyph_cap = 0;
+    raster_init(&tr->raster, 0);
+    tr->raster.coverage = true;
+    tr->misses = NULL;
+    tr->num_misses = tr->miss_cap = 0;
+    tr->missed = hashmap_create(64);
+    pool_init(&tr->pool, num_threads);
+    tr->readers = calloc(tr->pool.num_threads, sizeof(*tr->readers));
+    tr->target = NULL;
+}
+
+void tiles_destroy(struct tile_renderer *tr)
+{
+    pool_destroy(&tr->pool);
+    raster_destroy(&tr->raster);
+    hashmap_destroy(&tr->missed);
+    free(tr->misses);
+    free(tr->readers);
+
+    for (int i = 0; i < tr->tiles_x * tr->tiles_y; i++)
+        free(tr->tiles[i].glyphs);
+    for (int i = 0; i < tr->tiles_y; i++)
+        free(tr->rows[i].glyphs);
+    free(tr->tiles);
+    free(tr->rows);
+    free(tr->glyphs);
+}
+
+/**
+ * Forget every glyph drawn so far, to start on the next frame.
+ */
+void tiles_clear(struct tile_renderer *tr)
+{
+    tr->num_glyphs = tr->num_placed = 0;
+    for (int i = 0; i < tr->tiles_y; i++)
+        tr->rows[i].num_glyphs = 0;
+}
+
+static void push_index(uint32_t **indices, uint32_t *count, uint32_t *cap,
+                       uint32_t index)
+{
+    if (*count == *cap)
+    {
+        *cap = *cap ? *cap * 2 : 64;
+        *indices = realloc(*indices, sizeof(**indices) * *cap);
+    }
+    (*indices)[(*count)++] = index;
+}
+
+/**
+ * Queue up a layout's glyphs for the next tiles_render(), with the layout's
+ * top left corner at left, top. Glyphs the renderer hasn't seen at a phase
+ * yet are rendered there, on clones of reader, so it has to stay open
+ * until then.
+ */
+void tiles_draw_layout(struct tile_renderer *tr, struct ttf_reader *reader,
+                       uint16_t font, float size, struct layout *layout,
+                       float left, float top)
+{
+    uint16_t bucket = glyph_size_bucket(size);
+
+    for (uint32_t i = 0; i < layout->num_glyphs; i++)
+    {
+        struct layout_glyph *g = &layout->glyphs[i];
+        float whole;
+        int phase = raster_phase(left + g->x, &whole);
+        if (whole >= tr->width) continue;
+
+        uint64_t key = glyph_key(font, g->glyph, bucket, phase, 0);
+        struct bitmap *bitmap = concmap_get(&tr->raster.glyphs, key);
+        if (bitmap == NULL && hashmap_get(&tr->missed, key) == NULL)
+        {
+            if (tr->num_misses == tr->miss_cap)
+            {
+                tr->miss_cap = tr->miss_cap ? tr->miss_cap * 2 : 64;
+                tr->misses = realloc(tr->misses,
+                                     sizeof(*tr->misses) * tr->miss_cap);
+            }
+            tr->misses[tr->num_misses++] = (struct tile_miss) { key, reader };
+            hashmap_insert(&tr->missed, key, reader);
+        }
+
+        if (tr->num_glyphs == tr->glyph_cap)
+        {
+            tr->glyph_cap = tr->glyph_cap ? tr->glyph_cap * 2 : 1024;
+            tr->glyphs = realloc(tr->glyphs,
+                                 sizeof(*tr->glyphs) * tr->glyph_cap);
+        }
+        // the same pixels raster_draw_layout() puts it on
+        tr->glyphs[tr->num_glyphs++] = (struct tile_glyph) {
+            bitmap, key, whole, roundf(top - g->y)
+        };
+    }
+}
+
+static void render_miss(void *ctx, uint32_t index, int thread)
+{
+    struct tile_renderer *tr = ctx;
+    struct tile_miss *miss = &tr->misses[index];
+
+    // clones are made as they're needed, misses come one font after another
+    struct tile_reader *reader = &tr->readers[thread];
+    if (reader->source != miss->reader)
+    {
+        if (reader->source != NULL) ttf_reader_free_clone(&reader->clone);
+        ttf_reader_clone(miss->reader, &reader->clone);
+        reader->source = miss->reader;
+    }
+    raster_get_glyph(&tr->raster, &reader->clone, miss->key);
+}
+
+/**
+ * Give every glyph drawn since the last call its bitmap and its place in
+ * the image, drop the ones that don't show, and put the rest in the rows
+ * they overlap.
+ */
+static void place_glyphs(struct tile_renderer *tr)
+{
+    uint32_t placed = tr->num_placed;
+    for (uint32_t i = placed; i < tr->num_glyphs; i++)
+    {
+        struct tile_glyph g = tr->glyphs[i];
+        if (g.bitmap == NULL) g.bitmap = concmap_get(&tr->raster.glyphs, g.key);
+        struct bitmap *bitmap = g.bitmap;
+        if (bitmap->width == 0) continue;
+
+        g.x += bitmap->left;
+        g.y -= bitmap->bottom + bitmap->height;
+        if (g.x + bitmap->width <= 0 || g.x >= tr->width
+                || g.y + bitmap->height <= 0 || g.y >= tr->height)
+            continue;
+
+        int first = g.y > 0 ? g.y / TILE_SIZE : 0;
+        int last = g.y + bitmap->height - 1;
+        if (last >= tr->height) last = tr->height - 1;
+        for (int r = first; r <= last / TILE_SIZE; r++)
+        {
+            struct tile_row *row = &tr->rows[r];
+            push_index(&row->glyphs, &row->num_glyphs, &row->cap, placed);
+        }
+        tr->glyphs[placed++] = g;
+    }
+    tr->num_glyphs = tr->num_placed = placed;
+}
+
+static void bin_row(void *ctx, uint32_t r, int thread)
+{
+    struct tile_renderer *tr = ctx;
+    struct tile *row = &tr->tiles[(size_t) r * tr->tiles_x];
+    for (int tx = 0; tx < tr->tiles_x; tx++)
+        row[tx].num_glyphs = 0;
+
+    struct tile_row *glyphs = &tr->rows[r];
+    for (uint32_t i = 0; i < glyphs->num_glyphs; i++)
+    {
+        uint32_t index = glyphs->glyphs[i];
+        struct tile_glyph *g = &tr->glyphs[index];
+        int first = g->x > 0 ? g->x / TILE_SIZE : 0;
+        int last = g->x + g->bitmap->width - 1;
+        if (last >= tr->width) last = tr->width - 1;
+        for (int tx = first; tx <= last / TILE_SIZE; tx++)
+        {
+            struct tile *tile = &row[tx];
+            push_index(&tile->glyphs, &tile->num_glyphs, &tile->cap, index);
+        }
+    }
+}
+
+static void render_tile(void *ctx, uint32_t index, int thread)
+{
+    struct tile_renderer *tr = ctx;
+    struct tile *tile = &tr->tiles[index];
+    if (tile->num_glyphs == 0) return;
+
+    struct image *image = tr->target;
+    int x0 = index % tr->tiles_x * TILE_SIZE;
+    int y0 = index / tr->tiles_x * TILE_SIZE;
+    int x1 = x0 + TILE_SIZE < image->width ? x0 + TILE_SIZE : image->width;
+    int y1 = y0 + TILE_SIZE < image->height ? y0 + TILE_SIZE : image->height;
+
+    for (uint32_t i = 0; i < tile->num_glyphs; i++)
+    {
+        struct tile_glyph *g = &tr->glyphs[tile->glyphs[i]];
+        struct bitmap *bitmap = g->bitmap;
+
+        // the part of it in this tile
+        int gx0 = g->x > x0 ? g->x : x0;
+        int gx1 = g->x + bitmap->width < x1 ? g->x + bitmap->width : x1;
+        int gy0 = g->y > y0 ? g->y : y0;
+        int gy1 = g->y + bitmap->height < y1 ? g->y + bitmap->height : y1;
+
+        for (int y = gy0; y < gy1; y++)
+        {
+            // the bitmap's rows go up from its bottom, the image's go down
+            const uint8_t *src = bitmap->pixels
+                + (bitmap->height - 1 - (y - g->y)) * bitmap->width;
+            uint8_t *dst = image->pixels + (size_t) y * image->width;
+            for (int x = gx0; x < gx1; x++)
+                dst[x] = dst[x] * (255 - src[x - g->x]) / 255;
+        }
+    }
+}
+
+/**
+ * Blend every glyph drawn since tiles_clear() into image, black on
+ * whatever is there. image has to be the size the renderer was made for.
+ */
+void tiles_render(struct tile_renderer *tr, struct image *image)
+{
+    if (tr->num_misses > 0)
+    {
+        pool_run(&tr->pool, tr->num_misses, render_miss, tr);
+        for (int i = 0; i < tr->pool.num_threads; i++)
+        {
+            if (tr->readers[i].source == NULL) continue;
+            ttf_reader_free_clone(&tr->readers[i].clone);
+            tr->readers[i].source = NULL;
+        }
+        for (uint32_t i = 0; i < tr->num_misses; i++)
+            hashmap_remove(&tr->missed, tr->misses[i].key);
+        tr->num_misses = 0;
+    }
+    place_glyphs(tr);
+
+    tr->target = image;
+    pool_run(&tr->pool, tr->tiles_y, bin_row, tr);
+    pool_run(&tr->pool, tr->tiles_x * tr->tiles_y, render_tile, tr);
+    tr->target = NULL;
+}
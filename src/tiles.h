@@ -0,0 +1,100 @@
+#include <stdint.h>
+#include "hashmap.h"
+#include "image.h"
+#include "layout.h"
+#include "pool.h"
+#include "raster.h"
+#include "truetype.h"
+
+#ifndef TILES_H
+#define TILES_H
+
+#ifndef TILE_SIZE
+#define TILE_SIZE 16
+#endif
+
+// Renders whole pages of text on the CPU a tile at a time, so each tile's
+// pixels stay in cache while every glyph on it is blended in. The glyphs
+// are raster_draw_layout()'s coverage bitmaps, at the same whole pixels and
+// subpixel phases, rendered once and kept in a raster of the renderer's
+// own. Drawing a layout only records which glyphs go where, and which of
+// them haven't been rendered yet. tiles_render() then works in three passes
+// over the pool, each piece of work independent:
+//
+//  - per glyph not rendered yet, render it, with a clone of its reader for
+//    each thread
+//  - per row of tiles, hand each glyph overlapping it to the tiles in the
+//    row it overlaps
+//  - per tile, blend the part of each of its glyphs inside it into the
+//    image
+//
+// Between the first two, glyphs are given their bitmaps and put in the rows
+// they overlap, in order, on the calling thread. A tile only ever touches
+// its own pixels, and takes its glyphs in the order they were drawn, so the
+// result comes out the same bit for bit whichever threads do what, and the
+// same as raster_draw_layout() with coverage drawing the same layouts.
+
+struct tile_glyph
+{
+    struct bitmap *bitmap; // NULL until tiles_render() renders it
+    uint64_t key;
+    int x, y; // of its origin until tiles_render() places it, then of its
+              // top left pixel in the image, y down
+};
+
+struct tile_miss
+{
+    uint64_t key;
+    struct ttf_reader *reader;
+};
+
+struct tile_reader
+{
+    struct ttf_reader *source; // NULL if there's no clone
+    struct ttf_reader clone;
+};
+
+struct tile
+{
+    uint32_t *glyphs; // indices of the glyphs overlapping it, in order
+    uint32_t num_glyphs;
+    uint32_t cap;
+};
+
+struct tile_row
+{
+    uint32_t *glyphs; // indices of the glyphs overlapping it
+    uint32_t num_glyphs;
+    uint32_t cap;
+};
+
+struct tile_renderer
+{
+    int width, height;
+    int tiles_x, tiles_y;
+    struct tile *tiles;
+    struct tile_row *rows;
+    struct tile_glyph *glyphs;
+    uint32_t num_glyphs;
+    uint32_t num_placed; // the ones before this are in their rows
+    uint32_t glyph_cap;
+    struct raster raster; // only for its glyphs, at every size drawn
+    struct tile_miss *misses; // glyphs to render before the next frame
+    uint32_t num_misses;
+    uint32_t miss_cap;
+    hashmap_t missed; // the same keys, so each is rendered once
+    struct tile_reader *readers; // one per thread
+    struct pool pool;
+    struct image *target; // while rendering
+};
+
+void tiles_init(struct tile_renderer *, int width, int height,
+                int num_threads);
+void tiles_destroy(struct tile_renderer *);
+void tiles_clear(struct tile_renderer *);
+void tiles_draw_layout(struct tile_renderer *, struct ttf_reader *,
+                       uint16_t font, float size, struct layout *,
+                       float left, float top);
+void tiles_render(struct tile_renderer *, struct image *);
+
+#endif // TILES_H
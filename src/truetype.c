@@ -1,8 +1,11 @@
 #include <stdlib.h>
 #include <error.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include "truetype.h"
+#include "kern.h"
+#include "shape.h"
 
 typedef uint32_t Fixed;
 typedef uint64_t Date;
@@ -39,6 +42,7 @@ enum
     TAG_head               = 0x68656164,
     TAG_hhea               = 0x68686561,
     TAG_hmtx               = 0x686d7478,
+    TAG_kern               = 0x6b65726e,
     TAG_loca               = 0x6c6f6361,
     TAG_maxp               = 0x6d617870,
     TAG_name               = 0x6e616d65,
@@ -154,7 +158,8 @@ RESULT ttf_parse_loca(struct ttf_reader *reader, uint16_t loc_format)
     size_t size = sizeof(*reader->locations) * (reader->num_glyphs + 1);
     reader->locations = malloc(size);
 
-    for (int i = 0; i < reader->num_glyphs; i++)
+    // one more than there are glyphs, so every glyph has an end
+    for (int i = 0; i <= reader->num_glyphs; i++)
     {
         if (loc_format == 0)
             reader->locations[i] = read_16(reader) * 2;
@@ -243,6 +248,42 @@ struct cmap_arrs ttf_cmap_arrays(struct cmap_4 *cmap)
     return out;
 }
 
+/**
+ * Read the whole font file at path into memory and parse it. Sets errno if
+ * it's the reading that failed, and clears it if it's the parsing.
+ */
+RESULT ttf_load(const char *path, struct ttf_reader *reader)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) return ERR;
+
+    long size;
+    if (fseek(file, 0, SEEK_END) != 0 || (size = ftell(file)) < 0
+            || fseek(file, 0, SEEK_SET) != 0)
+    {
+        fclose(file);
+        return ERR;
+    }
+
+    reader->data = malloc(size);
+    if (fread(reader->data, 1, size, file) != (size_t) size)
+    {
+        free(reader->data);
+        fclose(file);
+        return ERR;
+    }
+    fclose(file);
+
+    reader->cursor = reader->data;
+    if (ttf_parse(reader) == ERR)
+    {
+        errno = 0;
+        return ERR;
+    }
+
+    return OK;
+}
+
 RESULT ttf_parse(struct ttf_reader *reader)
 {
     uint32_t magic = read_32(reader);
@@ -265,7 +306,8 @@ RESULT ttf_parse(struct ttf_reader *reader)
     read_16(reader); // skip range shift
 
     void *head = NULL, *maxp = NULL, *hhea = NULL, *hmtx = NULL,
-         *cmap = NULL, *loca = NULL, *glyf = NULL;
+         *cmap = NULL, *loca = NULL, *glyf = NULL, *gpos = NULL,
+         *kern = NULL, *gsub = NULL, *gdef = NULL;
 
     for (int i = 0; i < num_tables; i++)
     {
@@ -284,6 +326,10 @@ RESULT ttf_parse(struct ttf_reader *reader)
             case TAG_cmap: cmap = table; break;
             case TAG_loca: loca = table; break;
             case TAG_glyf: glyf = table; break;
+            case TAG_gpos: gpos = table; break;
+            case TAG_kern: kern = table; break;
+            case TAG_gsub: gsub = table; break;
+            case TAG_gdef: gdef = table; break;
             default: break; // ignore other tables
         }
     }
@@ -309,9 +355,47 @@ RESULT ttf_parse(struct ttf_reader *reader)
 
     reader->glyphs = glyf;
 
+    // optional, so no kerning or shaping is not an error
+    reader->kerning = ttf_parse_kerning(reader, gpos, kern);
+    reader->shaper = ttf_parse_shaper(gsub, gdef);
+
+    ttf_build_latin1(reader);
+
     return OK;
 }
 
+void ttf_build_latin1(struct ttf_reader *reader)
+{
+    bool mono = true;
+    UFWord advance = 0;
+
+    for (int c = 0; c < 256; c++)
+    {
+        struct latin1_glyph *l = &reader->latin1[c];
+        l->glyph = ttf_lookup_index(reader->cmap, c);
+        l->advance_width = reader->hmetrics[l->glyph].advance_width;
+        l->left_side_bearing = reader->hmetrics[l->glyph].left_side_bearing;
+        l->shaped = reader->shaper && shape_may_change(reader->shaper, l->glyph);
+
+        // soft hyphen is allowed to be zero width even in monospace fonts
+        bool printable = (c >= 0x20 && c < 0x7f) || (c >= 0xa0 && c != 0xad);
+        if (!printable || l->glyph == 0) continue;
+        if (advance == 0) advance = l->advance_width;
+        else if (l->advance_width != advance) mono = false;
+    }
+
+    reader->mono_advance = mono ? advance : 0;
+
+    // control characters, soft hyphen and missing glyphs weren't checked, so
+    // they can still differ
+    for (int c = 0; c < 256; c++)
+        reader->latin1[c].mono = mono
+            && reader->latin1[c].advance_width == advance;
+
+    if (reader->kerning)
+        ttf_kerning_build_latin1(reader->kerning, reader->latin1);
+}
+
 RESULT ttf_parse_hhea(struct ttf_reader *reader)
 {
     if (read_32(reader) != 0x10000)
@@ -320,10 +404,11 @@ RESULT ttf_parse_hhea(struct ttf_reader *reader)
         return ERR;
     }
 
+    reader->ascender  = read_16(reader);
+    reader->descender = read_16(reader);
+    reader->line_gap  = read_16(reader);
+
     /*
-    FWord ascender           = read_16(reader);
-    FWord descender          = read_16(reader);
-    FWord line_gap           = read_16(reader);
     UFWord advance_max       = read_16(reader);
     FWord min_lsb            = read_16(reader);
     FWord min_rsb            = read_16(reader);
@@ -338,7 +423,7 @@ RESULT ttf_parse_hhea(struct ttf_reader *reader)
     read_16(reader); // 0 for current format
     */
 
-    reader->cursor += sizeof(int16_t) * 15;
+    reader->cursor += sizeof(int16_t) * 12;
     reader->num_hmetrics = read_16(reader);
 
     return OK;
@@ -369,7 +454,8 @@ uint16_t ttf_lookup_index(struct cmap_4 *cmap, uint16_t c)
     struct cmap_arrs arrs = ttf_cmap_arrays(cmap);
 
     // Binary search
-    int a = 0, b = cmap->seg_count, mid;
+    int a = 0, b = cmap->seg_count, mid = 0;
+    if (b == 0) return 0;
     while (a < b)
     {
         mid = (a + b) / 2;
@@ -624,8 +710,7 @@ static RESULT parse_compound_glyf(struct ttf_reader *reader,
     if (flags & WE_HAVE_INSTRUCTIONS)
     {
         uint16_t num_instr = read_16(reader);
-        reader->cursor += num_instr;
-        printf("we skipped %d instructions\n", num_instr);
+        reader->cursor += num_instr; // we don't hint
     }
 
     return OK;
@@ -636,6 +721,41 @@ fail:
     return ERR;
 }
 
+/**
+ * Make clone a reader of the same font that another thread can use at the
+ * same time. Everything parsed is shared, it's the cursor and the shaper's
+ * caches that can't be.
+ */
+void ttf_reader_clone(struct ttf_reader *reader, struct ttf_reader *clone)
+{
+    *clone = *reader;
+    clone->cursor = NULL;
+    clone->shaper = ttf_shaper_clone(reader->shaper);
+}
+
+void ttf_reader_free_clone(struct ttf_reader *clone)
+{
+    ttf_shaper_free(clone->shaper);
+    clone->shaper = NULL;
+}
+
+/**
+ * Read just the bounding box from the glyph header. Returns false for glyphs
+ * without an outline, like space.
+ */
+bool ttf_glyph_bbox(struct ttf_reader *reader, uint16_t index, bbox_t *bbox)
+{
+    if (reader->locations[index] == reader->locations[index + 1])
+        return false;
+
+    void *old_cursor = reader->cursor;
+    reader->cursor = reader->glyphs + reader->locations[index];
+    read_16(reader); // skip number of contours
+    *bbox = read_bbox(reader);
+    reader->cursor = old_cursor;
+    return true;
+}
+
 RESULT ttf_parse_glyf(struct ttf_reader *reader,
                       uint16_t index,
                       struct ttf_glyph *glyph)
@@ -1,3 +1,4 @@
+#include <stdbool.h>
 #include <stdint.h>
 
 #ifndef TRUETYPE_H
@@ -22,6 +23,20 @@ struct hmetric
     FWord left_side_bearing;
 };
 
+// Straight from the code point for the first 256 of them, so Latin text
+// doesn't have to search the cmap.
+struct latin1_glyph
+{
+    uint16_t glyph;
+    UFWord advance_width;
+    FWord left_side_bearing;
+    bool shaped; // the shaper may change words with this in them
+    bool mono; // mono_advance wide
+};
+
+struct ttf_kerning;
+struct ttf_shaper;
+
 struct ttf_reader
 {
     void *data;
@@ -31,8 +46,15 @@ struct ttf_reader
     struct cmap_4 *cmap;
     uint32_t *locations;
     uint16_t num_glyphs;
-    int16_t num_hmetrics;
+    uint16_t num_hmetrics;
     uint16_t units_per_em;
+    FWord ascender;
+    FWord descender;
+    FWord line_gap;
+    struct ttf_kerning *kerning;
+    struct ttf_shaper *shaper;
+    struct latin1_glyph latin1[256];
+    UFWord mono_advance; // shared by all printable Latin-1, 0 if they differ
 };
 
 typedef struct
@@ -57,16 +79,25 @@ struct ttf_glyph
     uint16_t *contour_endpoints;
 };
 
+RESULT ttf_load(const char *path, struct ttf_reader *);
 RESULT ttf_parse(struct ttf_reader *);
+void ttf_reader_clone(struct ttf_reader *, struct ttf_reader *clone);
+void ttf_reader_free_clone(struct ttf_reader *clone);
 RESULT ttf_parse_head(struct ttf_reader *, int16_t *);
 RESULT ttf_parse_maxp(struct ttf_reader *);
 RESULT ttf_parse_loca(struct ttf_reader *, uint16_t);
 RESULT ttf_parse_glyf(struct ttf_reader *, uint16_t, struct ttf_glyph *);
+bool ttf_glyph_bbox(struct ttf_reader *, uint16_t, bbox_t *);
 RESULT ttf_parse_cmap(struct ttf_reader *);
 RESULT ttf_parse_hhea(struct ttf_reader *);
 RESULT ttf_parse_hmtx(struct ttf_reader *);
+void ttf_build_latin1(struct ttf_reader *);
 
 uint16_t ttf_lookup_index(struct cmap_4 *, uint16_t c);
+
+uint8_t read_8(struct ttf_reader *);
+uint16_t read_16(struct ttf_reader *);
+uint32_t read_32(struct ttf_reader *);
 int ttf_num_points(struct ttf_glyph *);
 
 #endif // TRUETYPE_H
@@ -0,0 +1,173 @@
+#include <endian.h>
+#include <string.h>
+#include "utf8.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/**
+ * Decode and validate one multi-byte sequence, as per table 3-7 of the
+ * Unicode standard. Rejects overlong forms, surrogates and anything past
+ * U+10FFFF. Returns the sequence length, or 0 if it is invalid or cut short.
+ */
+static int decode_sequence(const uint8_t *s, size_t avail, uint32_t *out)
+{
+    uint8_t lo = 0x80, hi = 0xbf;
+    uint32_t cp;
+    int len;
+
+    uint8_t b = s[0];
+    if (b >= 0xc2 && b <= 0xdf)
+    {
+        len = 2;
+        cp = b & 0x1f;
+    }
+    else if (b >= 0xe0 && b <= 0xef)
+    {
+        len = 3;
+        cp = b & 0x0f;
+        if (b == 0xe0) lo = 0xa0; // overlong
+        if (b == 0xed) hi = 0x9f; // surrogates
+    }
+    else if (b >= 0xf0 && b <= 0xf4)
+    {
+        len = 4;
+        cp = b & 0x07;
+        if (b == 0xf0) lo = 0x90; // overlong
+        if (b == 0xf4) hi = 0x8f; // past U+10FFFF
+    }
+    else
+    {
+        return 0;
+    }
+
+    if (avail < len) return 0;
+
+    // only the first continuation byte has a restricted range
+    if (s[1] < lo || s[1] > hi) return 0;
+    cp = cp << 6 | (s[1] & 0x3f);
+
+    for (int i = 2; i < len; i++)
+    {
+        if ((s[i] & 0xc0) != 0x80) return 0;
+        cp = cp << 6 | (s[i] & 0x3f);
+    }
+
+    *out = cp;
+    return len;
+}
+
+/**
+ * Decode len bytes of UTF-8 into codepoints. out needs room for len
+ * codepoints, which is the most there can be. Runs of ASCII are widened
+ * 16 bytes at a time. On invalid or truncated input, nothing past the
+ * offending sequence is decoded, and its byte offset is stored in
+ * error_offset.
+ */
+RESULT utf8_decode(const char *in, size_t len, uint32_t *out,
+                   size_t *out_len, size_t *error_offset)
+{
+    const uint8_t *s = (const uint8_t *) in;
+    size_t i = 0, n = 0;
+
+    while (i < len)
+    {
+        if (s[i] >= 0x80)
+        {
+            // 3-byte sequences, ie. most non-latin scripts, checked inline
+            // with one branch: the bit pattern, then the top five bits of
+            // the codepoint, which can't all be clear (overlong) or be
+            // 11011 (surrogates)
+            if (len - i >= 4)
+            {
+                uint32_t w;
+                memcpy(&w, s + i, sizeof(w));
+                w = le32toh(w);
+                uint32_t top = w & 0x200f;
+                if (((w & 0xc0c0f0) == 0x8080e0) & (top != 0) & (top != 0x200d))
+                {
+                    out[n++] = (w & 0x0f) << 12 | (w >> 2 & 0xfc0)
+                             | (w >> 16 & 0x3f);
+                    i += 3;
+                    continue;
+                }
+            }
+            int seq = decode_sequence(s + i, len - i, &out[n]);
+            if (seq == 0)
+            {
+                if (error_offset) *error_offset = i;
+                *out_len = n;
+                return ERR;
+            }
+            i += seq;
+            n++;
+            continue;
+        }
+
+#ifdef __SSE2__
+        // a lone space between words isn't worth a vector load
+        if (len - i >= 16 && s[i + 1] < 0x80)
+        {
+            __m128i bytes = _mm_loadu_si128((const __m128i *) (s + i));
+            unsigned high = _mm_movemask_epi8(bytes);
+            if (high == 0)
+            {
+                __m128i zero = _mm_setzero_si128();
+                __m128i lo = _mm_unpacklo_epi8(bytes, zero);
+                __m128i hi = _mm_unpackhi_epi8(bytes, zero);
+                _mm_storeu_si128((__m128i *) (out + n + 0), _mm_unpacklo_epi16(lo, zero));
+                _mm_storeu_si128((__m128i *) (out + n + 4), _mm_unpackhi_epi16(lo, zero));
+                _mm_storeu_si128((__m128i *) (out + n + 8), _mm_unpacklo_epi16(hi, zero));
+                _mm_storeu_si128((__m128i *) (out + n + 12), _mm_unpackhi_epi16(hi, zero));
+                i += 16;
+                n += 16;
+                continue;
+            }
+
+            // copy the ascii prefix, the next byte starts a sequence
+            int ascii = __builtin_ctz(high);
+            for (int j = 0; j < ascii; j++)
+                out[n++] = s[i++];
+            continue;
+        }
+#else
+        if (len - i >= 8)
+        {
+            uint64_t word;
+            memcpy(&word, s + i, sizeof(word));
+            if ((word & 0x8080808080808080) == 0)
+            {
+                for (int j = 0; j < 8; j++)
+                    out[n++] = s[i++];
+                continue;
+            }
+        }
+#endif
+
+        out[n++] = s[i++];
+    }
+
+    *out_len = n;
+    return OK;
+}
+
+void bmp_to_utf8(uint16_t c, char *s)
+{
+    if (c <= 0x7F) {
+        // 1-byte UTF-8
+        s[0] = (char)c;
+        s[1] = '\0';
+    } else if (c <= 0x7FF) {
+        // 2-byte UTF-8
+        s[0] = (char)((c >> 6) | 0xC0);
+        s[1] = (char)((c & 0x3F) | 0x80);
+        s[2] = '\0';
+    } else {
+        // 3-byte UTF-8
+        s[0] = (char)((c >> 12) | 0xE0);
+        s[1] = (char)(((c >> 6) & 0x3F) | 0x80);
+        s[2] = (char)((c & 0x3F) | 0x80);
+        s[3] = '\0';
+    }
+}
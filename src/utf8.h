@@ -0,0 +1,12 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "truetype.h"
+
+#ifndef UTF8_H
+#define UTF8_H
+
+RESULT utf8_decode(const char *in, size_t len, uint32_t *out,
+                   size_t *out_len, size_t *error_offset);
+void bmp_to_utf8(uint16_t c, char *s);
+
+#endif // UTF8_H